@@ -0,0 +1,416 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#if HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#  include <emmintrin.h>
+#  define ASCII_SSE2
+#endif
+
+typedef struct __tftp_ascii ASCII_IMAGE;
+#define __ASCII_PRIVATE__
+
+#include "ascii.h"
+#include "util.h"
+#include "debug.h"
+
+#ifndef DEBUG_ASCII
+#  undef P_DEBUG
+#  define P_DEBUG(fmt...) /* null */
+#endif
+
+struct __tftp_ascii {
+    dev_t dev;                      /* key of the file */
+    ino_t ino;
+    time_t mtime;
+    off_t fsize;
+    u_int8_t *data;                 /* translated image */
+    size_t len;                     /* bytes in data */
+    int refs;                       /* sessions reading */
+    unsigned long used;             /* last use (for LRU) */
+    ASCII_IMAGE *hnext;             /* hash chain */
+};
+
+/*
+ * file scope variables
+ */
+static ASCII_IMAGE *ImageHash[ASCII_HASH];
+static u_int8_t *ReadBuf = NULL;    /* ASCII_CHUNK bytes */
+static size_t CachedBytes = 0;      /* bytes of unused images */
+static unsigned long Tick = 0;      /* LRU clock */
+static int ImageUsed = 0;
+
+static unsigned int BuildCounter = 0;
+static unsigned int HitCounter = 0;
+static unsigned int EvictCounter = 0;
+static unsigned int TooBigCounter = 0;
+
+/* forward declarations of private functions */
+static unsigned int image_hash(dev_t dev, ino_t ino);
+static ASCII_IMAGE *image_build(int fd, struct stat *st);
+static void image_free(ASCII_IMAGE *image);
+static void cache_trim(size_t limit);
+
+/*
+ * Exported functions
+ */
+int
+ascii_init(void)
+{
+    memset(ImageHash, 0, sizeof(ImageHash));
+    ImageUsed = 0;
+    CachedBytes = 0;
+    ReadBuf = (u_int8_t *)safe_malloc(ASCII_CHUNK);
+    if (ReadBuf == NULL) {
+        P_WARNING("safe_malloc() failed.\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Image of the file opened as fd. Returns NULL with errno set on
+ * failure. fd is not used after return.
+ */
+ASCII_IMAGE *
+ascii_open(int fd, struct stat *st)
+{
+    unsigned int h;
+    ASCII_IMAGE *image, *next;
+
+    h = image_hash(st->st_dev, st->st_ino);
+    for (image = ImageHash[h]; image != NULL; image = next) {
+        next = image->hnext;
+        if (image->dev != st->st_dev || image->ino != st->st_ino) continue;
+        if (image->mtime == st->st_mtime && image->fsize == st->st_size) {
+            if (image->refs++ == 0) CachedBytes -= image->len;
+            image->used = ++Tick;
+            HitCounter++;
+            P_DEBUG("image of %lld bytes reused.\n", (long long)image->len);
+            return image;
+        }
+        /* the file was modified. old image is useless. */
+        if (image->refs == 0) {
+            CachedBytes -= image->len;
+            image_free(image);
+        }
+    }
+
+    image = image_build(fd, st);
+    if (image == NULL) return NULL;
+    image->hnext = ImageHash[h];
+    ImageHash[h] = image;
+    ImageUsed++;
+    BuildCounter++;
+
+    return image;
+}
+
+void
+ascii_close(ASCII_IMAGE *image)
+{
+    if (image == NULL) {
+        P_WARNING("Invalid image specified.\n");
+        return;
+    }
+    if (--image->refs > 0) return;
+
+    /* last session. keep it for next one. */
+    image->used = ++Tick;
+    if (image->len > ASCII_CACHE_MAX) {
+        image_free(image);
+        return;
+    }
+    CachedBytes += image->len;
+    cache_trim(ASCII_CACHE_MAX);
+
+    return;
+}
+
+/*
+ * Read len bytes at offset. Returns bytes read, which is less than
+ * len only at the end of image.
+ */
+ssize_t
+ascii_read(ASCII_IMAGE *image, off_t offset, void *buf, size_t len)
+{
+    if (image == NULL) {
+        P_WARNING("Invalid image specified.\n");
+        return -1;
+    }
+    if (offset >= (off_t)image->len) return 0;
+    if (len > image->len - offset) len = image->len - offset;
+    memcpy(buf, image->data + offset, len);
+
+    return len;
+}
+
+off_t
+ascii_get_size(ASCII_IMAGE *image)
+{
+    if (image == NULL) {
+        P_WARNING("Invalid image specified.\n");
+        return 0;
+    }
+
+    return image->len;
+}
+
+/*
+ * Translate len bytes of src to netascii. dst must have
+ * ASCII_ENCODE_SIZE(len) bytes. Returns bytes stored in dst.
+ */
+size_t
+ascii_encode(u_int8_t *dst, const u_int8_t *src, size_t len)
+{
+#ifdef ASCII_SSE2
+    const u_int8_t *end;
+    u_int8_t *out;
+    unsigned int mask, pos, k;
+    __m128i v, cr, lf;
+
+    end = src + len;
+    out = dst;
+    cr = _mm_set1_epi8('\r');
+    lf = _mm_set1_epi8('\n');
+    /* copying a run may load 16 bytes from any offset of the vector */
+    while (end - src >= 2 * ASCII_VEC) {
+        v = _mm_loadu_si128((const __m128i *)src);
+        mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr),
+                                              _mm_cmpeq_epi8(v, lf)));
+        if (mask == 0) {
+            _mm_storeu_si128((__m128i *)out, v);
+            src += ASCII_VEC;
+            out += ASCII_VEC;
+            continue;
+        }
+        if (__builtin_popcount(mask) > ASCII_VEC / 4) {
+            /* runs are too short to be worth moving as vector */
+            out += ascii_encode_ref(out, src, ASCII_VEC);
+            src += ASCII_VEC;
+            continue;
+        }
+        /* copy the run before each CR or LF, then expand it. */
+        for (pos = 0; mask != 0; pos = k + 1) {
+            k = __builtin_ctz(mask);
+            mask &= mask - 1;
+            _mm_storeu_si128((__m128i *)out,
+                             _mm_loadu_si128((const __m128i *)(src + pos)));
+            out += k - pos;
+            *out++ = '\r';
+            *out++ = (src[k] == '\n') ? '\n' : '\0';
+        }
+        _mm_storeu_si128((__m128i *)out,
+                         _mm_loadu_si128((const __m128i *)(src + pos)));
+        out += ASCII_VEC - pos;
+        src += ASCII_VEC;
+    }
+
+    return (out - dst) + ascii_encode_ref(out, src, end - src);
+#else
+    return ascii_encode_ref(dst, src, len);
+#endif
+}
+
+/* one byte at a time. */
+size_t
+ascii_encode_ref(u_int8_t *dst, const u_int8_t *src, size_t len)
+{
+    size_t i;
+    u_int8_t *out;
+
+    out = dst;
+    for (i = 0; i < len; i++) {
+        switch (src[i]) {
+            case '\n':
+                *out++ = '\r';
+                *out++ = '\n';
+                break;
+            case '\r':
+                *out++ = '\r';
+                *out++ = '\0';
+                break;
+            default:
+                *out++ = src[i];
+                break;
+        }
+    }
+
+    return out - dst;
+}
+
+void
+ascii_report(void)
+{
+    P_INFO("--- netascii statics ---\n");
+    P_INFO(" Entry    Counter = %d\n", ImageUsed);
+    P_INFO(" Build    Counter = %d\n", BuildCounter);
+    P_INFO(" Hit      Counter = %d\n", HitCounter);
+    P_INFO(" Evict    Counter = %d\n", EvictCounter);
+    P_INFO(" TooBig   Counter = %d\n", TooBigCounter);
+    P_INFO(" Cached   Bytes   = %lu\n", (unsigned long)CachedBytes);
+
+    return;
+}
+
+/*
+ * Private functions
+ */
+static unsigned int
+image_hash(dev_t dev, ino_t ino)
+{
+    return (unsigned int)(dev * 31 + ino) % ASCII_HASH;
+}
+
+/* read whole file and translate it. */
+static ASCII_IMAGE *
+image_build(int fd, struct stat *st)
+{
+    off_t offset;
+    ssize_t nread;
+    size_t want;
+    u_int8_t *data;
+    ASCII_IMAGE *image;
+
+    /* translated in the main loop, other sessions wait meanwhile */
+    if (ReadBuf == NULL || st->st_size > ASCII_IMAGE_MAX) {
+        P_INFO("%lld bytes file too big for netascii.\n",
+               (long long)st->st_size);
+        TooBigCounter++;
+        errno = EFBIG;
+        return NULL;
+    }
+    image = (ASCII_IMAGE *)safe_malloc(sizeof(ASCII_IMAGE));
+    if (image == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(image, 0, sizeof(*image));
+    image->data = (u_int8_t *)safe_malloc(ASCII_ENCODE_SIZE(st->st_size));
+    if (image->data == NULL) {
+        safe_free(image);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    /* file may grow while reading. image holds st_size bytes. */
+    for (offset = 0; offset < st->st_size; offset += nread) {
+        want = ASCII_CHUNK;
+        if ((off_t)want > st->st_size - offset) want = st->st_size - offset;
+        nread = pread(fd, ReadBuf, want, offset);
+        if (nread < 0) {
+            P_WARNING("pread() failed: %s.\n", strerror(errno));
+            safe_free(image->data);
+            safe_free(image);
+            return NULL;
+        }
+        if (nread == 0) break;
+        image->len += ascii_encode(image->data + image->len, ReadBuf, nread);
+    }
+
+    /* give back the room for expansion not used */
+    data = (u_int8_t *)safe_realloc(image->data, image->len + 1);
+    if (data != NULL) image->data = data;
+
+    image->dev = st->st_dev;
+    image->ino = st->st_ino;
+    image->mtime = st->st_mtime;
+    image->fsize = st->st_size;
+    image->refs = 1;
+    image->used = ++Tick;
+    P_DEBUG("%lld bytes translated to %lld bytes.\n",
+            (long long)st->st_size, (long long)image->len);
+
+    return image;
+}
+
+static void
+image_free(ASCII_IMAGE *image)
+{
+    unsigned int h;
+    ASCII_IMAGE **walk;
+
+    h = image_hash(image->dev, image->ino);
+    for (walk = &ImageHash[h]; *walk != NULL; walk = &(*walk)->hnext) {
+        if (*walk == image) {
+            *walk = image->hnext;
+            break;
+        }
+    }
+    safe_free(image->data);
+    safe_free(image);
+    ImageUsed--;
+
+    return;
+}
+
+/* drop unused images in LRU order until they fit in limit. */
+static void
+cache_trim(size_t limit)
+{
+    int i;
+    ASCII_IMAGE *image, *lru;
+
+    while (CachedBytes > limit) {
+        lru = NULL;
+        for (i = 0; i < ASCII_HASH; i++) {
+            for (image = ImageHash[i]; image != NULL; image = image->hnext) {
+                if (image->refs == 0 && (lru == NULL || image->used < lru->used))
+                    lru = image;
+            }
+        }
+        if (lru == NULL) break; /* BUG? */
+        P_DEBUG("image of %lld bytes evicted.\n", (long long)lru->len);
+        CachedBytes -= lru->len;
+        image_free(lru);
+        EvictCounter++;
+    }
+
+    return;
+}
@@ -0,0 +1,114 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __ASCII_H__
+#define __ASCII_H__
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef __ASCII_PRIVATE__
+typedef struct __tftp_ascii ASCII_IMAGE;
+
+struct __tftp_ascii {
+    /* image structure is protected. Only ascii.c can read actual value. */
+    char *__dummy[0];
+};
+#endif
+
+int ascii_init(void);
+ASCII_IMAGE *ascii_open(int fd, struct stat *st);
+void ascii_close(ASCII_IMAGE *image);
+ssize_t ascii_read(ASCII_IMAGE *image, off_t offset, void *buf, size_t len);
+off_t ascii_get_size(ASCII_IMAGE *image);
+size_t ascii_encode(u_int8_t *dst, const u_int8_t *src, size_t len);
+size_t ascii_encode_ref(u_int8_t *dst, const u_int8_t *src, size_t len);
+void ascii_report(void);
+
+/* dst of ascii_encode() must have this many bytes */
+#define ASCII_ENCODE_SIZE(len) (2 * (len) + ASCII_VEC)
+
+enum ascii_params {
+    ASCII_VEC = 16,                     /* bytes per vector */
+    ASCII_CHUNK = 64 * 1024,            /* bytes read from file at a time */
+    ASCII_CACHE_MAX = 16 * 1024 * 1024, /* bytes of images kept unused */
+    ASCII_IMAGE_MAX = 16 * 1024 * 1024, /* max file translated [bytes] */
+    ASCII_HASH = 64,                    /* size of hash table of images */
+};
+
+/*
+ * NOTE:
+ *
+ * - netascii
+ *     RFC764 text: LF of the file is sent as CR LF, and bare CR as
+ *   CR NUL. Each byte is translated alone, so the file is converted
+ *   as a whole into an image, and blocks are cut from the image at
+ *   any offset. CR LF or CR NUL split at the end of a block is legal,
+ *   and the client joins them. The image also gives the exact size
+ *   told by tsize.
+ *     The image is built at once in the main loop, and every other
+ *   session waits for it. A file larger than ASCII_IMAGE_MAX is not
+ *   translated: the request is rejected ("File too big", errno EFBIG
+ *   from ascii_open()) instead of allocating twice its size and
+ *   stalling the server. Boot menus and configs are far smaller;
+ *   large files are sent in octet mode.
+ *
+ * - Translation
+ *     ascii_encode() compares 16 bytes at a time with CR and LF (SSE2
+ *   where available). A vector without them is copied as is. Otherwise
+ *   the runs between them are copied by unaligned 16 byte moves, and
+ *   each CR or LF found is expanded. A vector with more than 4 of
+ *   them is done byte by byte. ascii_encode_ref() is the plain byte
+ *   loop, used where SSE2 is not available and as the reference of
+ *   ascii_bench ("make ascii_bench").
+ *
+ * - Image cache
+ *     Images are shared by sessions reading the same file (same
+ *   device, inode, mtime and size), and kept after the last session
+ *   up to ASCII_CACHE_MAX bytes in total, so repeated reads of a text
+ *   file translate nothing. Unused images are dropped in LRU order.
+ *   An image larger than ASCII_CACHE_MAX is dropped when unused.
+ */
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* __ASCII_H__ */
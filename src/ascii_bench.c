@@ -0,0 +1,179 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * ascii_bench: compare ascii_encode() with the byte loop reference.
+ *
+ *   usage: ascii_bench [megabytes [rounds]]
+ *
+ * Checks the output is the same for slices of random text at every
+ * length and alignment, and splitting the input anywhere gives the
+ * same bytes as translating it at once. Then reports the speed of
+ * both on text, on data without CR/LF and on data of only LF.
+ */
+#if HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include "ascii.h"
+#include "util.h"
+
+typedef size_t (*encoder)(u_int8_t *dst, const u_int8_t *src, size_t len);
+
+static int check(const u_int8_t *src, size_t size);
+static double bench(encoder enc, const u_int8_t *src, size_t size,
+                    int rounds);
+static void fill_text(u_int8_t *buf, size_t size);
+
+static u_int8_t *Dst, *Ref;
+
+int
+main(int argc, char *argv[])
+{
+    size_t size;
+    int rounds, i;
+    u_int8_t *src;
+    double t_ref, t_vec;
+    const char *name[] = { "text", "no CR/LF", "all LF" };
+
+    size = (argc > 1) ? (size_t)atol(argv[1]) * 1024 * 1024 : 16 * 1024 * 1024;
+    rounds = (argc > 2) ? atoi(argv[2]) : 10;
+    if (size == 0 || rounds <= 0) {
+        fprintf(stderr, "usage: %s [megabytes [rounds]]\n", argv[0]);
+        return 1;
+    }
+    src = (u_int8_t *)malloc(size);
+    Dst = (u_int8_t *)malloc(ASCII_ENCODE_SIZE(size));
+    Ref = (u_int8_t *)malloc(ASCII_ENCODE_SIZE(size));
+    if (src == NULL || Dst == NULL || Ref == NULL) {
+        fprintf(stderr, "malloc() failed.\n");
+        return 1;
+    }
+
+    srandom(1);
+    fill_text(src, size);
+    if (check(src, size) == 0) return 1;
+    printf("check: ok\n");
+
+    printf("%-10s %12s %12s %8s\n", "input", "ref [MB/s]", "vec [MB/s]",
+           "speedup");
+    for (i = 0; i < 3; i++) {
+        if (i == 1) memset(src, 'a', size);
+        if (i == 2) memset(src, '\n', size);
+        t_ref = bench(ascii_encode_ref, src, size, rounds);
+        t_vec = bench(ascii_encode, src, size, rounds);
+        printf("%-10s %12.1f %12.1f %7.2fx\n", name[i],
+               size * rounds / t_ref / 1e6, size * rounds / t_vec / 1e6,
+               t_ref / t_vec);
+    }
+
+    return 0;
+}
+
+static int
+check(const u_int8_t *src, size_t size)
+{
+    size_t off, len, cut, n, nref;
+    int i;
+
+    for (i = 0; i < 100000; i++) {
+        len = (i < 1000) ? (size_t)(i % 100) : (size_t)(random() % 4096);
+        if (len > size) len = size;
+        off = random() % (size - len + 1);
+        nref = ascii_encode_ref(Ref, src + off, len);
+        n = ascii_encode(Dst, src + off, len);
+        if (n != nref || memcmp(Dst, Ref, n) != 0) {
+            fprintf(stderr, "mismatch at offset %lu, length %lu.\n",
+                    (unsigned long)off, (unsigned long)len);
+            return 0;
+        }
+        cut = (len > 0) ? random() % len : 0;
+        n = ascii_encode(Dst, src + off, cut);
+        n += ascii_encode(Dst + n, src + off + cut, len - cut);
+        if (n != nref || memcmp(Dst, Ref, n) != 0) {
+            fprintf(stderr, "mismatch at offset %lu, length %lu, cut %lu.\n",
+                    (unsigned long)off, (unsigned long)len,
+                    (unsigned long)cut);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* seconds taken */
+static double
+bench(encoder enc, const u_int8_t *src, size_t size, int rounds)
+{
+    int i;
+    struct timeval t0, t1;
+
+    enc(Dst, src, size); /* warm up */
+    gettimeofday(&t0, NULL);
+    for (i = 0; i < rounds; i++) enc(Dst, src, size);
+    gettimeofday(&t1, NULL);
+
+    return (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+}
+
+/* lines of 0-99 printable bytes. some end with CR LF, some have CR. */
+static void
+fill_text(u_int8_t *buf, size_t size)
+{
+    size_t i, eol;
+
+    for (i = 0, eol = 0; i < size; i++) {
+        if (i == eol) {
+            eol = i + 1 + random() % 100;
+            buf[i] = '\n';
+            if (random() % 8 == 0 && i > 0) buf[i - 1] = '\r';
+        } else if (random() % 500 == 0) {
+            buf[i] = '\r';
+        } else {
+            buf[i] = ' ' + random() % 95;
+        }
+    }
+
+    return;
+}
@@ -0,0 +1,388 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#if HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "task.h"
+#include "client.h"
+#include "cong.h"
+#include "proto_tftp.h"
+#include "proto_udp.h"
+#include "timer.h"
+#include "util.h"
+#include "debug.h"
+
+#ifndef DEBUG_CLIENT
+#  undef P_DEBUG
+#  define P_DEBUG(fmt...) /* null */
+#endif
+
+struct client_ent {
+    int family;                     /* address family, 0 if unused */
+    u_int8_t addr[CLIENT_ADDRLEN];  /* client address */
+    long srtt;                      /* smoothed RTT [us], -1 if unknown */
+    long rttvar;                    /* RTT variation [us] */
+    unsigned int loss;              /* smoothed loss rate [1/1000] */
+    unsigned int ssthresh;          /* slow start threshold [blocks] */
+    int mtu;                        /* path MTU, 0 if unknown */
+    unsigned int count;             /* number of sessions learned */
+    struct client_ent *hnext;       /* hash chain */
+    struct client_ent *prev;        /* LRU list (more recent) */
+    struct client_ent *next;        /* LRU list (less recent) */
+};
+
+/*
+ * file scope variables
+ */
+static struct client_ent ClientPool[CLIENT_MAX];
+static struct client_ent *ClientHash[CLIENT_HASH];
+static struct client_ent *LruHead = NULL;
+static struct client_ent *LruTail = NULL;
+static int ClientUsed = 0;
+
+static unsigned int HitCounter = 0;
+static unsigned int MissCounter = 0;
+static unsigned int LearnCounter = 0;
+static unsigned int EvictCounter = 0;
+
+/* forward declarations of private functions */
+static int addr_key(struct sockaddr *sa, u_int8_t addr[]);
+static unsigned int addr_hash(int family, u_int8_t addr[]);
+static struct client_ent *ent_lookup(int family, u_int8_t addr[]);
+static struct client_ent *ent_create(int family, u_int8_t addr[]);
+static void lru_unlink(struct client_ent *ent);
+static void lru_push(struct client_ent *ent);
+static void hash_unlink(struct client_ent *ent);
+static unsigned int isqrt(unsigned int n);
+
+/*
+ * Exported functions
+ */
+int
+client_init(void)
+{
+    memset(ClientPool, 0, sizeof(ClientPool));
+    memset(ClientHash, 0, sizeof(ClientHash));
+    LruHead = NULL;
+    LruTail = NULL;
+    ClientUsed = 0;
+
+    return 1;
+}
+
+/*
+ * Start new session with the values saved for the client.
+ * Call this before option negotiation.
+ */
+int
+client_seed(TASK *task)
+{
+    int family;
+    unsigned int ssthresh, limit;
+    u_int8_t addr[CLIENT_ADDRLEN];
+    struct client_ent *ent;
+
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    family = addr_key(task_get_caddr(task), addr);
+    if (family == 0) return 0;
+
+    ent = ent_lookup(family, addr);
+    if (ent == NULL) {
+        MissCounter++;
+        return 0;
+    }
+    HitCounter++;
+    lru_unlink(ent);
+    lru_push(ent);
+
+    if (ent->srtt >= 0) {
+        task_set_rtt(task, ent->srtt, ent->rttvar);
+        task_set_rinit(task, timer_rto(ent->srtt, ent->rttvar));
+    }
+    ssthresh = ent->ssthresh;
+    if (ent->loss > 0) {
+        /* window the loss rate allows, W = sqrt(3 / 2p) */
+        limit = isqrt(3 * CLIENT_LOSS_SCALE / (2 * ent->loss));
+        if (limit < CONG_CWND_MIN) limit = CONG_CWND_MIN;
+        if (ssthresh == 0 || ssthresh > limit) ssthresh = limit;
+    }
+    if (ssthresh > 0) {
+        task_set_ssthresh(task, ssthresh);
+    }
+    if (ent->mtu > 0) {
+        task_set_pmtu(task, ent->mtu);
+    }
+
+    P_DEBUG("Task %d: srtt %ld [us], loss %u/%d, ssthresh %u from memory.\n",
+            task_get_id(task), ent->srtt, ent->loss, CLIENT_LOSS_SCALE,
+            ssthresh);
+
+    return 1;
+}
+
+/*
+ * Save the values of finished session.
+ */
+int
+client_learn(TASK *task)
+{
+    int family, mtu;
+    unsigned int loss;
+    u_int32_t xmit, rexmit;
+    u_int8_t addr[CLIENT_ADDRLEN];
+    struct client_ent *ent;
+
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    /* nothing to learn from session never sent a block. */
+    xmit = task_get_nxmit(task);
+    if (xmit == 0) return 0;
+    rexmit = task_get_nrexmit(task);
+
+    family = addr_key(task_get_caddr(task), addr);
+    if (family == 0) return 0;
+
+    ent = ent_lookup(family, addr);
+    if (ent == NULL) {
+        ent = ent_create(family, addr);
+    } else {
+        lru_unlink(ent);
+    }
+    lru_push(ent);
+
+    if (task_get_srtt(task) >= 0) {
+        ent->srtt = task_get_srtt(task);
+        ent->rttvar = task_get_rttvar(task);
+    }
+
+    ent->ssthresh = task_get_ssthresh(task);
+    mtu = udp_get_mtu(task_get_sockfd(task));
+    if (mtu > 0) ent->mtu = mtu;
+
+    loss = (unsigned long)rexmit * CLIENT_LOSS_SCALE / (xmit + rexmit);
+    if (ent->count == 0) {
+        ent->loss = loss;
+    } else {
+        ent->loss = (3 * ent->loss + loss) / 4;
+    }
+    ent->count++;
+    LearnCounter++;
+
+    P_DEBUG("Task %d: srtt %ld [us], loss %u/%d, ssthresh %u saved.\n",
+            task_get_id(task), ent->srtt, ent->loss, CLIENT_LOSS_SCALE,
+            ent->ssthresh);
+
+    return 1;
+}
+
+void
+client_report(void)
+{
+    P_INFO("--- client statics ---\n");
+    P_INFO(" Entry    Counter = %d\n", ClientUsed);
+    P_INFO(" Hit      Counter = %d\n", HitCounter);
+    P_INFO(" Miss     Counter = %d\n", MissCounter);
+    P_INFO(" Learn    Counter = %d\n", LearnCounter);
+    P_INFO(" Evict    Counter = %d\n", EvictCounter);
+
+    return;
+}
+
+/*
+ * Private functions
+ */
+static int
+addr_key(struct sockaddr *sa, u_int8_t addr[])
+{
+    memset(addr, 0, CLIENT_ADDRLEN);
+    if (sa == NULL) return 0;
+
+    switch (sa->sa_family) {
+        case AF_INET:
+            memcpy(addr, &((struct sockaddr_in *)sa)->sin_addr,
+                   sizeof(struct in_addr));
+            break;
+#ifdef AF_INET6
+        case AF_INET6:
+            memcpy(addr, &((struct sockaddr_in6 *)sa)->sin6_addr,
+                   sizeof(struct in6_addr));
+            break;
+#endif
+        default:
+            P_DEBUG("Unknown address family %d.\n", sa->sa_family);
+            return 0;
+    }
+
+    return sa->sa_family;
+}
+
+static unsigned int
+addr_hash(int family, u_int8_t addr[])
+{
+    int i;
+    unsigned int hash = family;
+
+    for (i = 0; i < CLIENT_ADDRLEN; i++)
+        hash = hash * 31 + addr[i];
+
+    return hash % CLIENT_HASH;
+}
+
+static struct client_ent *
+ent_lookup(int family, u_int8_t addr[])
+{
+    struct client_ent *ent;
+
+    for (ent = ClientHash[addr_hash(family, addr)]; ent != NULL;
+         ent = ent->hnext) {
+        if (ent->family == family &&
+            memcmp(ent->addr, addr, CLIENT_ADDRLEN) == 0)
+            return ent;
+    }
+
+    return NULL;
+}
+
+static struct client_ent *
+ent_create(int family, u_int8_t addr[])
+{
+    unsigned int hash;
+    struct client_ent *ent;
+
+    if (ClientUsed < CLIENT_MAX) {
+        ent = &ClientPool[ClientUsed++];
+    } else {
+        /* forget the least recently used client */
+        ent = LruTail;
+        lru_unlink(ent);
+        hash_unlink(ent);
+        EvictCounter++;
+    }
+
+    memset(ent, 0, sizeof(struct client_ent));
+    ent->family = family;
+    memcpy(ent->addr, addr, CLIENT_ADDRLEN);
+    ent->srtt = -1;
+
+    hash = addr_hash(family, addr);
+    ent->hnext = ClientHash[hash];
+    ClientHash[hash] = ent;
+
+    return ent;
+}
+
+static void
+lru_unlink(struct client_ent *ent)
+{
+    if (ent->prev != NULL) {
+        ent->prev->next = ent->next;
+    } else {
+        LruHead = ent->next;
+    }
+    if (ent->next != NULL) {
+        ent->next->prev = ent->prev;
+    } else {
+        LruTail = ent->prev;
+    }
+    ent->prev = NULL;
+    ent->next = NULL;
+
+    return;
+}
+
+static void
+lru_push(struct client_ent *ent)
+{
+    ent->prev = NULL;
+    ent->next = LruHead;
+    if (LruHead != NULL) LruHead->prev = ent;
+    LruHead = ent;
+    if (LruTail == NULL) LruTail = ent;
+
+    return;
+}
+
+static void
+hash_unlink(struct client_ent *ent)
+{
+    struct client_ent **walk;
+
+    for (walk = &ClientHash[addr_hash(ent->family, ent->addr)];
+         *walk != NULL; walk = &(*walk)->hnext) {
+        if (*walk == ent) {
+            *walk = ent->hnext;
+            break;
+        }
+    }
+    ent->hnext = NULL;
+
+    return;
+}
+
+static unsigned int
+isqrt(unsigned int n)
+{
+    unsigned int x = 0, bit = 1U << 30;
+
+    while (bit > n) bit >>= 2;
+    while (bit != 0) {
+        if (n >= x + bit) {
+            n -= x + bit;
+            x = (x >> 1) + bit;
+        } else {
+            x >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return x;
+}
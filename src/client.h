@@ -0,0 +1,81 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __CLIENT_H__
+#define __CLIENT_H__
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "task.h"
+
+int client_init(void);
+int client_seed(TASK *task);
+int client_learn(TASK *task);
+void client_report(void);
+
+enum client_params {
+    CLIENT_MAX = 256,       /* number of clients remembered */
+    CLIENT_HASH = 64,       /* number of hash buckets */
+    CLIENT_ADDRLEN = 16,    /* length of address (enough for IPv6) */
+    CLIENT_LOSS_SCALE = 1000, /* loss rate is in 1/1000 */
+};
+
+/*
+ * NOTE:
+ *
+ * - Client memory
+ *     Clients are remembered by address (port is ignored, it changes
+ *   every transfer). When a session ends, only timing and congestion
+ *   state is saved: SRTT/RTTVAR, ssthresh, loss rate of the session
+ *   and path MTU. The next RRQ from
+ *   the same client starts with the saved RTT instead of the static
+ *   initial interval and the saved ssthresh (see cong.h). A client
+ *   that lost packets last time starts with ssthresh no larger than
+ *   the window its loss rate allows (sqrt(3/2p) blocks). Path MTU seen
+ *   at the end of the session bounds blksize of the next one.
+ *     Options are not remembered: rollover, windowsize and the rest
+ *   are only used when the request asks for them (RFC 2347).
+ *     At most CLIENT_MAX clients are remembered, the least recently
+ *   used one is forgotten first.
+ */
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* __CLIENT_H__ */
@@ -0,0 +1,203 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#if HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <sys/types.h>
+
+#include "task.h"
+#include "cong.h"
+#include "util.h"
+#include "debug.h"
+
+#ifndef DEBUG_CONG
+#  undef P_DEBUG
+#  define P_DEBUG(fmt...) /* null */
+#endif
+
+/*
+ * file scope variables
+ */
+static unsigned int LossCounter = 0;
+static unsigned int RestartCounter = 0;
+static unsigned int CwndHist[CONG_HIST_MAX];
+
+/* forward declarations of private functions */
+static void cwnd_set(TASK *task, unsigned int cwnd);
+
+/*
+ * Exported functions
+ */
+
+/*
+ * Open cwnd by `acked' blocks newly acked (RFC5681 3.1).
+ */
+int
+cong_ack(TASK *task, u_int32_t acked)
+{
+    unsigned int cwnd, acc;
+
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    cwnd = task_get_cwnd(task);
+    if (cwnd < task_get_ssthresh(task)) {
+        /* slow start, up to ssthresh */
+        cwnd += acked;
+        if (cwnd > task_get_ssthresh(task)) cwnd = task_get_ssthresh(task);
+    } else {
+        /* congestion avoidance: 1 block per cwnd blocks acked */
+        acc = task_get_cwndacc(task) + acked;
+        while (acc >= cwnd) {
+            acc -= cwnd;
+            cwnd++;
+        }
+        task_set_cwndacc(task, acc);
+    }
+    cwnd_set(task, cwnd);
+
+    return 1;
+}
+
+/*
+ * Blocks lost in the window. Halve cwnd once per window of data.
+ */
+int
+cong_loss(TASK *task)
+{
+    unsigned int ssthresh;
+
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    /* blocks sent before the last reduction belong to the same loss. */
+    if ((int32_t)(task_get_blockn(task) - task_get_recover(task)) < 0)
+        return 0;
+
+    ssthresh = task_get_cwnd(task) / 2;
+    if (ssthresh < CONG_CWND_MIN) ssthresh = CONG_CWND_MIN;
+    task_set_ssthresh(task, ssthresh);
+    task_set_cwndacc(task, 0);
+    cwnd_set(task, ssthresh);
+    task_set_recover(task, task_get_sendn(task));
+    LossCounter++;
+
+    P_DEBUG("Task %d: loss, cwnd %u ssthresh %u.\n",
+            task_get_id(task), task_get_cwnd(task), ssthresh);
+
+    return 1;
+}
+
+/*
+ * Retransmit timeout. Restart from slow start (RFC5681 3.1).
+ */
+int
+cong_timeout(TASK *task)
+{
+    unsigned int ssthresh;
+
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    /* don't shrink ssthresh again while backing off */
+    if (task_get_rcounter(task) == 0) {
+        ssthresh = task_get_cwnd(task) / 2;
+        if (ssthresh < CONG_CWND_MIN) ssthresh = CONG_CWND_MIN;
+        task_set_ssthresh(task, ssthresh);
+    }
+    task_set_cwndacc(task, 0);
+    cwnd_set(task, 1);
+    task_set_recover(task, task_get_sendn(task));
+    RestartCounter++;
+
+    P_DEBUG("Task %d: timeout, cwnd 1 ssthresh %u.\n",
+            task_get_id(task), task_get_ssthresh(task));
+
+    return 1;
+}
+
+void
+cong_report(void)
+{
+    int i;
+    unsigned int limit;
+
+    P_INFO("--- congestion statics ---\n");
+    P_INFO(" Loss     Counter = %d\n", LossCounter);
+    P_INFO(" Restart  Counter = %d\n", RestartCounter);
+    for (i = 0, limit = 1; i < CONG_HIST_MAX; i++, limit *= 2) {
+        if (CwndHist[i] == 0) continue;
+        if (i == CONG_HIST_MAX - 1) {
+            P_INFO(" cwnd >= %4u [blocks] = %d\n", limit, CwndHist[i]);
+        } else {
+            P_INFO(" cwnd <  %4u [blocks] = %d\n", limit * 2, CwndHist[i]);
+        }
+    }
+
+    return;
+}
+
+/*
+ * Private functions
+ */
+static void
+cwnd_set(TASK *task, unsigned int cwnd)
+{
+    int i;
+    unsigned int window;
+
+    window = task_get_window(task);
+    if (cwnd > window) cwnd = window;
+    if (cwnd < 1) cwnd = 1;
+    task_set_cwnd(task, cwnd);
+
+    for (i = 0; i < CONG_HIST_MAX - 1; i++) {
+        if (cwnd < (2U << i)) break;
+    }
+    CwndHist[i]++;
+
+    return;
+}
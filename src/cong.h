@@ -0,0 +1,86 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __CONG_H__
+#define __CONG_H__
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "task.h"
+
+int cong_ack(TASK *task, u_int32_t acked);
+int cong_loss(TASK *task);
+int cong_timeout(TASK *task);
+void cong_report(void);
+
+enum cong_params {
+    CONG_CWND_INIT = 4,      /* initial congestion window [blocks] */
+    CONG_CWND_MIN = 2,       /* lower bound of ssthresh [blocks] */
+    CONG_SSTHRESH_INIT = 0xffff, /* initial slow start threshold */
+    CONG_HIST_MAX = 8,       /* number of cwnd histogram bins (x2 each) */
+};
+
+/*
+ * NOTE:
+ *
+ * - Congestion control
+ *     Each session has a congestion window (cwnd) in blocks. It
+ *   starts at CONG_CWND_INIT, grows by the blocks acked while below
+ *   ssthresh (slow start) and by one block per cwnd blocks acked
+ *   above it (congestion avoidance). Partial ack of a window halves
+ *   cwnd once per window, retransmit timeout sets it back to 1.
+ *   cwnd never grows over the negotiated windowsize.
+ *
+ * - Pacing
+ *     RFC7440 client acks after it received `windowsize' blocks, so
+ *   the server can't keep fewer blocks in flight than windowsize
+ *   without stalling the client until its timeout. Instead of that,
+ *   cwnd blocks are sent per round trip (SRTT) and the rest of the
+ *   window follows after the next round trip. Without windowsize
+ *   option, the transfer is lock-step and cwnd has no effect.
+ *
+ * [References]
+ *   RFC5681 TCP Congestion Control
+ *   RFC7440 TFTP Windowsize Option
+ */
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* __CONG_H__ */
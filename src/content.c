@@ -0,0 +1,1682 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#if HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE /* memfd_create() */
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#if defined(HAVE_LZ4_H) && defined(HAVE_LIBLZ4)
+#  include <lz4.h>
+#  define CONTENT_LZ4
+#endif
+#if defined(HAVE_MEMFD_CREATE) && defined(MFD_ALLOW_SEALING)
+#  define CONTENT_MEMFD
+#endif
+
+typedef struct __tftp_content CONTENT;
+#define __CONTENT_PRIVATE__
+
+#include "content.h"
+#include "dirindex.h"
+#include "proto_tftp.h"
+#include "warm.h"
+#include "util.h"
+#include "debug.h"
+
+#ifndef DEBUG_CONTENT
+#  undef P_DEBUG
+#  define P_DEBUG(fmt...) /* null */
+#endif
+
+/* CONTENT_ZCHUNK bytes of file, compressed (-C) */
+struct content_zchunk {
+    u_int8_t *z;                    /* LZ4 block, or raw if not smaller */
+    size_t zlen;
+    size_t len;                     /* bytes of file */
+};
+
+/* whole file encoded as DATA packets */
+struct content_pkts {
+    size_t blksize;
+    int rollover;                   /* block number after 65535 is 1 */
+    size_t stride;                  /* bytes per packet in image */
+    u_int32_t nblock;               /* packets in image */
+    size_t len;                     /* bytes of image */
+    unsigned long used;             /* last use (for LRU) */
+    u_int8_t *image;                /* NULL if it can't be made */
+    struct content_pkts *next;
+};
+
+/* data of a file, shared by names of same bytes (see content.h) */
+struct content_blob {
+    u_int64_t sum;                  /* FNV-1a of data */
+    off_t size;
+    int nname;                      /* names referring */
+    int refs;                       /* sessions reading (all names) */
+    int pinned;                     /* names pinned */
+    u_int8_t *data;                 /* size bytes, NULL if compressed */
+    struct content_zchunk *zchunks; /* compressed chunks (-C) */
+    int nzchunk;
+    size_t stored;                  /* bytes of data or zchunks */
+    struct content_pkts *pkts;      /* packet images */
+    u_int8_t *seg;                  /* memfd segment mapped, or NULL */
+    int segfd;                      /* memfd to hand off, or -1 */
+    struct content_blob *hnext;     /* hash chain by sum */
+};
+
+/* index record of a blob handed off (see "Handoff" in content.h) */
+struct content_rec {
+    u_int64_t sum;
+    off_t size;
+    size_t stored;
+    int nzchunk;                    /* followed by (zlen, len) of chunks */
+    int nname;                      /* followed by names, 0 if the end */
+    int segment;                    /* memfd attached, else data follows */
+};
+
+struct content_rec_name {
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+    off_t size;
+    size_t len;                     /* followed by len bytes of name */
+};
+
+/* decompressed chunk (hot window) */
+struct content_zslot {
+    struct content_blob *blob;      /* owner, NULL if empty */
+    int index;                      /* chunk of owner */
+    unsigned long used;             /* last use (for LRU) */
+    u_int8_t *buf;                  /* CONTENT_ZCHUNK bytes */
+};
+
+/* name requested */
+struct __tftp_content {
+    char *fname;                    /* key */
+    unsigned int hash;
+    dev_t dev;                      /* file loaded */
+    ino_t ino;
+    time_t mtime;
+    off_t size;
+    int refs;                       /* sessions reading */
+    int stale;                      /* not in hash, free at last close */
+    int pinned;                     /* never evicted (see warm.h) */
+    unsigned long used;             /* last use (for LRU) */
+    struct content_blob *blob;
+    struct __tftp_content *hnext;   /* hash chain by name */
+    struct __tftp_content *inext;   /* hash chain by inode */
+};
+
+/*
+ * file scope variables
+ */
+static CONTENT *ContentHash[CONTENT_HASH];
+static CONTENT *InodeHash[CONTENT_HASH];
+static struct content_blob *BlobHash[CONTENT_HASH];
+static size_t Budget = 0;           /* 0 if disabled */
+static int Compress = 0;            /* chunks are compressed (-C) */
+static struct content_zslot ZWindow[CONTENT_ZWINDOW];
+static size_t CachedBytes = 0;      /* data of blobs (in use too) */
+static int ContentUsed = 0;
+static int BlobUsed = 0;
+static int PktsUsed = 0;
+static unsigned long Tick = 0;
+
+static unsigned int HitCounter = 0;
+static unsigned int MissCounter = 0;
+static unsigned int LoadCounter = 0;
+static unsigned int InodeCounter = 0;
+static unsigned int DedupCounter = 0;
+static unsigned int StaleCounter = 0;
+static unsigned int EvictCounter = 0;
+static unsigned int SkipCounter = 0;
+static unsigned int PinCounter = 0;
+static unsigned long long ServedBytes = 0;
+static unsigned int EncodeCounter = 0;
+static unsigned int PacketCounter = 0;
+static unsigned int PktsDropCounter = 0;
+static unsigned int NoImageCounter = 0;
+static unsigned long long RawBytes = 0;     /* of compressed blobs */
+static unsigned long long ZBytes = 0;
+static unsigned int UnzipCounter = 0;
+static unsigned long long UnzipUsec = 0;
+static unsigned int WindowHitCounter = 0;
+static unsigned int SegmentCounter = 0;
+static unsigned int ExportCounter = 0;
+static unsigned int AdoptCounter = 0;
+static unsigned long long AdoptBytes = 0;
+
+/* forward declarations of private functions */
+static unsigned int name_hash(const char *fname);
+static u_int64_t data_sum(const u_int8_t *data, size_t len);
+static int file_stat(const char *fname, struct stat *st);
+static int size_ok(struct stat *st);
+static u_int8_t *file_load(const char *fname, struct stat *st);
+static CONTENT *name_find(const char *fname, struct stat *st);
+static struct content_blob *blob_add(u_int8_t *data, off_t size);
+static CONTENT *content_new(const char *fname, struct stat *st,
+                            struct content_blob *blob);
+static void content_unlink(CONTENT *content);
+static void content_free(CONTENT *content);
+static struct content_blob *blob_by_inode(struct stat *st);
+static struct content_blob *blob_find(u_int64_t sum, const u_int8_t *data,
+                                      off_t size);
+static struct content_blob *blob_new(u_int8_t *data, off_t size,
+                                     u_int64_t sum);
+static void blob_free(struct content_blob *blob);
+static void blob_link(struct content_blob *blob);
+static void blob_seal(struct content_blob *blob);
+static int blob_zip(struct content_blob *blob);
+static const u_int8_t *blob_unzip(struct content_blob *blob, int index);
+static int cache_trim(size_t need);
+static struct content_pkts *pkts_encode(struct content_blob *blob,
+                                        size_t blksize, int rollover);
+static void pkts_free(struct content_blob *blob, struct content_pkts *pkts);
+static int pkts_trim(int keep);
+static void pkts_forget(struct content_blob *blob);
+static size_t rec_pack(struct content_blob *blob, u_int8_t *buf, size_t size);
+static int rec_adopt(const u_int8_t *buf, size_t len, int fd);
+
+/*
+ * Exported functions
+ */
+int
+content_init(size_t budget, int compress)
+{
+#ifdef CONTENT_MEMFD
+    struct rlimit rl;
+#endif
+
+    memset(ContentHash, 0, sizeof(ContentHash));
+    memset(InodeHash, 0, sizeof(InodeHash));
+    memset(BlobHash, 0, sizeof(BlobHash));
+    memset(ZWindow, 0, sizeof(ZWindow));
+    Budget = budget;
+    Compress = compress;
+#ifndef CONTENT_LZ4
+    if (Compress) {
+        P_WARNING("LZ4 is not available. Cached files are not compressed.\n");
+        Compress = 0;
+    }
+#endif
+    CachedBytes = 0;
+    ContentUsed = 0;
+    BlobUsed = 0;
+#ifdef CONTENT_MEMFD
+    /* segments are kept above the descriptors select()ed */
+    if (Budget > 0 && getrlimit(RLIMIT_NOFILE, &rl) == 0 &&
+        rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+#endif
+
+    return 1;
+}
+
+/*
+ * Content of fname if it is (or can be) cached, or NULL (read the
+ * file as before).
+ */
+CONTENT *
+content_open(const char *fname)
+{
+    u_int8_t *data;
+    struct stat st;
+    struct content_blob *blob;
+    CONTENT *content;
+
+    if (Budget == 0) return NULL;
+    if (file_stat(fname, &st) == 0) return NULL;
+
+    content = name_find(fname, &st);
+    if (content != NULL) {
+        content->refs++;
+        content->blob->refs++;
+        content->used = ++Tick;
+        HitCounter++;
+        warm_request(fname, 1);
+        return content;
+    }
+    MissCounter++;
+    warm_request(fname, 0);
+
+    if (size_ok(&st) == 0) {
+        SkipCounter++;
+        return NULL;
+    }
+
+    /* same file by other name (hard link)? no need to read. */
+    blob = blob_by_inode(&st);
+    if (blob != NULL) {
+        InodeCounter++;
+    } else {
+        data = file_load(fname, &st);
+        if (data == NULL) return NULL;
+        blob = blob_add(data, st.st_size);
+        if (blob == NULL) return NULL;
+    }
+
+    content = content_new(fname, &st, blob);
+    if (content == NULL) {
+        if (blob->nname == 0) blob_free(blob);
+        return NULL;
+    }
+    content->refs = 1;
+    blob->refs++;
+    P_DEBUG("\"%s\" cached, %lu bytes used.\n", fname,
+            (unsigned long)CachedBytes);
+
+    return content;
+}
+
+void
+content_close(CONTENT *content)
+{
+    if (content == NULL) {
+        P_WARNING("Invalid content specified.\n");
+        return;
+    }
+    if (--content->blob->refs == 0) pkts_forget(content->blob);
+    if (--content->refs > 0) return;
+
+    content->used = ++Tick;
+    if (content->stale) content_free(content);
+
+    return;
+}
+
+/*
+ * Read len bytes at offset. Returns bytes read, which is less than
+ * len only at EOF.
+ */
+ssize_t
+content_read(CONTENT *content, off_t offset, void *buf, size_t len)
+{
+    size_t done, n, inchunk;
+    const u_int8_t *chunk;
+    struct content_blob *blob;
+
+    if (content == NULL) {
+        P_WARNING("Invalid content specified.\n");
+        return -1;
+    }
+    blob = content->blob;
+    if (offset >= blob->size) return 0;
+    if (len > blob->size - offset) len = blob->size - offset;
+
+    if (blob->data != NULL) {
+        memcpy(buf, blob->data + offset, len);
+        ServedBytes += len;
+        return len;
+    }
+
+    for (done = 0; done < len; done += n) {
+        chunk = blob_unzip(blob, (offset + done) / CONTENT_ZCHUNK);
+        if (chunk == NULL) return -1;
+        inchunk = (offset + done) % CONTENT_ZCHUNK;
+        n = blob->zchunks[(offset + done) / CONTENT_ZCHUNK].len - inchunk;
+        if (n > len - done) n = len - done;
+        memcpy((u_int8_t *)buf + done, chunk + inchunk, n);
+    }
+    ServedBytes += len;
+
+    return len;
+}
+
+/*
+ * Pointer to len bytes at offset. Returns bytes there, which is less
+ * than len only at EOF, or -1 if compressed (use content_read()).
+ * Valid until the content is closed.
+ */
+ssize_t
+content_map(CONTENT *content, off_t offset, size_t len,
+            const u_int8_t **data)
+{
+    struct content_blob *blob;
+
+    if (content == NULL) {
+        P_WARNING("Invalid content specified.\n");
+        return -1;
+    }
+    blob = content->blob;
+    if (blob->data == NULL) return -1;
+
+    if (offset >= blob->size) {
+        *data = blob->data;
+        return 0;
+    }
+    if (len > blob->size - offset) len = blob->size - offset;
+    *data = blob->data + offset;
+    ServedBytes += len;
+
+    return len;
+}
+
+/*
+ * Encoded DATA packet of blockn (see "Packet image" in content.h).
+ * Returns length of the packet, or -1 if no image (read the content).
+ * Valid until the content is closed.
+ */
+ssize_t
+content_packet(CONTENT *content, size_t blksize, int rollover,
+               u_int32_t blockn, const u_int8_t **pkt)
+{
+    off_t offset;
+    struct content_blob *blob;
+    struct content_pkts *pkts;
+
+    if (content == NULL) {
+        P_WARNING("Invalid content specified.\n");
+        return -1;
+    }
+    blob = content->blob;
+    if (blob->data == NULL) return -1; /* compressed */
+    rollover = (rollover == 1);
+
+    for (pkts = blob->pkts; pkts != NULL; pkts = pkts->next) {
+        if (pkts->blksize == blksize && pkts->rollover == rollover) break;
+    }
+    if (pkts == NULL) {
+        /* warm up by first session */
+        pkts = pkts_encode(blob, blksize, rollover);
+        if (pkts == NULL) return -1;
+    }
+    /* no image (nblock is 0) until the blob is unused */
+    if (blockn == 0 || blockn > pkts->nblock) return -1;
+    pkts->used = ++Tick;
+
+    offset = (off_t)(blockn - 1) * blksize;
+    *pkt = pkts->image + (size_t)(blockn - 1) * pkts->stride;
+    PacketCounter++;
+    if (blockn == pkts->nblock) {
+        ServedBytes += blob->size - offset;
+        return TFTP_HDLEN + TFTP_DATA_HDLEN + (blob->size - offset);
+    }
+    ServedBytes += blksize;
+
+    return pkts->stride;
+}
+
+/*
+ * Prefetch (see prefetch.h), step 1: fills st and returns 1 if fname
+ * can be cached and needs to be read by content_load(). A hard link
+ * of a cached file is cached here without read.
+ */
+int
+content_want(const char *fname, struct stat *st)
+{
+    struct content_blob *blob;
+
+    if (Budget == 0) return 0;
+    if (file_stat(fname, st) == 0 || size_ok(st) == 0) return 0;
+    if (name_find(fname, st) != NULL) return 0;
+
+    blob = blob_by_inode(st);
+    if (blob != NULL) {
+        content_new(fname, st, blob);
+        InodeCounter++;
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Step 2: read whole file into buf of st->st_size bytes. Fails if the
+ * file is not the one of st any more. Touches nothing else, so may be
+ * called from any thread. Returns 0 with errno set on failure.
+ */
+int
+content_load(const char *fname, struct stat *st, u_int8_t *buf)
+{
+    int fd, save_errno;
+    off_t done;
+    ssize_t nread;
+    struct stat fst;
+
+    fd = open(fname, O_RDONLY);
+    if (fd < 0) return 0;
+    /* replaced after lookup? */
+    if (fstat(fd, &fst) < 0 || fst.st_dev != st->st_dev ||
+        fst.st_ino != st->st_ino || fst.st_mtime != st->st_mtime ||
+        fst.st_size != st->st_size) {
+        close(fd);
+        errno = ESTALE;
+        return 0;
+    }
+    for (done = 0; done < st->st_size; done += nread) {
+        nread = pread(fd, buf + done, st->st_size - done, done);
+        if (nread <= 0) {
+            /* error or truncated. */
+            save_errno = (nread < 0) ? errno : EIO;
+            close(fd);
+            errno = save_errno;
+            return 0;
+        }
+    }
+    close(fd);
+
+    return 1;
+}
+
+/*
+ * Step 3: cache data (safe_malloc()ed, taken) read as fname of st, not
+ * opened. Returns 1 if cached.
+ */
+int
+content_insert(const char *fname, struct stat *st, u_int8_t *data)
+{
+    struct content_blob *blob;
+    CONTENT *content;
+
+    if (Budget == 0 || name_find(fname, st) != NULL) {
+        safe_free(data);
+        return 0;
+    }
+    blob = blob_by_inode(st);
+    if (blob != NULL) {
+        safe_free(data);
+    } else {
+        blob = blob_add(data, st->st_size);
+        if (blob == NULL) return 0;
+    }
+    content = content_new(fname, st, blob);
+    if (content == NULL) {
+        if (blob->nname == 0) blob_free(blob);
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Load fname (if not cached) and keep it from eviction. Returns its
+ * size, or -1 if it can't be cached.
+ */
+off_t
+content_pin(const char *fname)
+{
+    off_t size;
+    CONTENT *content;
+
+    content = content_open(fname);
+    if (content == NULL) return -1;
+    if (content->pinned == 0) {
+        content->pinned = 1;
+        content->blob->pinned++;
+        PinCounter++;
+    }
+    size = content->size;
+    content_close(content);
+
+    return size;
+}
+
+off_t
+content_get_size(CONTENT *content)
+{
+    if (content == NULL) {
+        P_WARNING("Invalid content specified.\n");
+        return 0;
+    }
+
+    return content->size;
+}
+
+void
+content_report(void)
+{
+    int i;
+    unsigned long long saved;
+    struct content_blob *blob;
+
+    if (Budget == 0) return;
+
+    /* bytes which would be cached again without dedup */
+    saved = 0;
+    for (i = 0; i < CONTENT_HASH; i++) {
+        for (blob = BlobHash[i]; blob != NULL; blob = blob->hnext)
+            saved += (unsigned long long)(blob->nname - 1) * blob->stored;
+    }
+
+    P_INFO("--- content cache statics ---\n");
+    P_INFO(" Entry    Counter = %d\n", ContentUsed);
+    P_INFO(" Blob     Counter = %d\n", BlobUsed);
+    P_INFO(" Cached   Bytes   = %lu / %lu\n",
+           (unsigned long)CachedBytes, (unsigned long)Budget);
+    P_INFO(" Hit      Counter = %d\n", HitCounter);
+    P_INFO(" Miss     Counter = %d\n", MissCounter);
+    P_INFO(" Hit Rate [%%]     = %d\n",
+           (HitCounter + MissCounter) ?
+           HitCounter * 100 / (HitCounter + MissCounter) : 0);
+    P_INFO(" Load     Counter = %d\n", LoadCounter);
+    P_INFO(" Inode    Counter = %d\n", InodeCounter);
+    P_INFO(" Dedup    Counter = %d\n", DedupCounter);
+    P_INFO(" Saved    Bytes   = %llu\n", saved);
+    P_INFO(" Stale    Counter = %d\n", StaleCounter);
+    P_INFO(" Evict    Counter = %d\n", EvictCounter);
+    P_INFO(" Skip     Counter = %d\n", SkipCounter);
+    P_INFO(" Pin      Counter = %d\n", PinCounter);
+    P_INFO(" Served   Bytes   = %llu\n", ServedBytes);
+    if (Compress) {
+        P_INFO(" Zip Raw  Bytes   = %llu\n", RawBytes);
+        P_INFO(" Zip      Bytes   = %llu\n", ZBytes);
+        P_INFO(" Zip Ratio [%%]    = %d\n",
+               RawBytes ? (int)(ZBytes * 100 / RawBytes) : 0);
+        P_INFO(" Unzip    Counter = %d\n", UnzipCounter);
+        P_INFO(" Unzip Avg [us]   = %d\n",
+               UnzipCounter ? (int)(UnzipUsec / UnzipCounter) : 0);
+        P_INFO(" Window   Counter = %d\n", WindowHitCounter);
+    }
+    P_INFO(" Segment  Counter = %d\n", SegmentCounter);
+    P_INFO(" Export   Counter = %d\n", ExportCounter);
+    P_INFO(" Adopt    Counter = %d\n", AdoptCounter);
+    P_INFO(" Adopt    Bytes   = %llu\n", AdoptBytes);
+    P_INFO(" Image    Counter = %d\n", PktsUsed);
+    P_INFO(" Encode   Counter = %d\n", EncodeCounter);
+    P_INFO(" Packet   Counter = %d\n", PacketCounter);
+    P_INFO(" Drop     Counter = %d\n", PktsDropCounter);
+    P_INFO(" NoImage  Counter = %d\n", NoImageCounter);
+
+    return;
+}
+
+/*
+ * Send cached files to the process replacing us (see "Handoff" in
+ * content.h). Returns number of blobs sent, or -1 on error.
+ */
+int
+content_export(int sock)
+{
+    int i, nsent;
+    size_t len;
+    u_int8_t *buf;
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct content_rec end;
+    struct content_blob *blob;
+    union {
+        struct cmsghdr hdr;
+        char space[CMSG_SPACE(sizeof(int))];
+    } ctl;
+
+    buf = (u_int8_t *)safe_malloc(CONTENT_REC_MAX);
+    if (buf == NULL) {
+        P_WARNING("safe_malloc() failed.\n");
+        return -1;
+    }
+
+    nsent = 0;
+    for (i = 0; i < CONTENT_HASH; i++) {
+        for (blob = BlobHash[i]; blob != NULL; blob = blob->hnext) {
+            len = rec_pack(blob, buf, CONTENT_REC_MAX);
+            if (len == 0) continue;
+
+            memset(&msg, 0, sizeof(msg));
+            iov.iov_base = buf;
+            iov.iov_len = len;
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            if (blob->segfd >= 0) {
+                memset(&ctl, 0, sizeof(ctl));
+                msg.msg_control = ctl.space;
+                msg.msg_controllen = sizeof(ctl.space);
+                cmsg = CMSG_FIRSTHDR(&msg);
+                cmsg->cmsg_level = SOL_SOCKET;
+                cmsg->cmsg_type = SCM_RIGHTS;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+                memcpy(CMSG_DATA(cmsg), &blob->segfd, sizeof(int));
+            }
+            if (sendmsg(sock, &msg, 0) < 0) {
+                P_WARNING("sendmsg() failed: %s.\n", strerror(errno));
+                safe_free(buf);
+                return -1;
+            }
+            nsent++;
+            ExportCounter++;
+        }
+    }
+    safe_free(buf);
+
+    memset(&end, 0, sizeof(end));
+    if (send(sock, &end, sizeof(end), 0) < 0) {
+        P_WARNING("send() failed: %s.\n", strerror(errno));
+        return -1;
+    }
+
+    return nsent;
+}
+
+/*
+ * Adopt cached files sent by content_export() of the process we
+ * replace. Returns number of blobs adopted, or -1 on error.
+ */
+int
+content_import(int sock)
+{
+    int fd, nadopt;
+    ssize_t n;
+    u_int8_t *buf;
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct content_rec rec;
+    union {
+        struct cmsghdr hdr;
+        char space[CMSG_SPACE(sizeof(int))];
+    } ctl;
+
+    buf = (u_int8_t *)safe_malloc(CONTENT_REC_MAX);
+    if (buf == NULL) {
+        P_WARNING("safe_malloc() failed.\n");
+        return -1;
+    }
+
+    nadopt = 0;
+    for (;;) {
+        memset(&msg, 0, sizeof(msg));
+        iov.iov_base = buf;
+        iov.iov_len = CONTENT_REC_MAX;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctl.space;
+        msg.msg_controllen = sizeof(ctl.space);
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if (n < 0) {
+            P_WARNING("recvmsg() failed: %s.\n", strerror(errno));
+            safe_free(buf);
+            return -1;
+        }
+        if (n == 0) break; /* closed before the end */
+
+        fd = -1;
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET &&
+                cmsg->cmsg_type == SCM_RIGHTS)
+                memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+        if ((size_t)n < sizeof(rec)) {
+            if (fd >= 0) close(fd);
+            continue;
+        }
+        memcpy(&rec, buf, sizeof(rec));
+        if (rec.nname == 0) break;
+
+        if ((msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) == 0 &&
+            rec_adopt(buf, n, fd) > 0)
+            nadopt++;
+        if (fd >= 0) close(fd);
+    }
+    safe_free(buf);
+
+    return nadopt;
+}
+
+/*
+ * Private functions
+ */
+static unsigned int
+name_hash(const char *fname)
+{
+    unsigned int h;
+    const unsigned char *p;
+
+    for (h = 0, p = (const unsigned char *)fname; *p != '\0'; p++)
+        h = h * 31 + *p;
+
+    return h;
+}
+
+/* 64bit FNV-1a */
+static u_int64_t
+data_sum(const u_int8_t *data, size_t len)
+{
+    size_t i;
+    u_int64_t sum;
+
+    sum = 0xcbf29ce484222325ULL;
+    for (i = 0; i < len; i++) {
+        sum ^= data[i];
+        sum *= 0x100000001b3ULL;
+    }
+
+    return sum;
+}
+
+/* current attributes, by one hash probe if indexed. 0 if missing. */
+static int
+file_stat(const char *fname, struct stat *st)
+{
+    int st_ok;
+
+    st_ok = dirindex_stat(fname, st);
+    if (st_ok < 0) st_ok = (stat(fname, st) == 0);
+
+    return st_ok;
+}
+
+/* file of st may be cached? */
+static int
+size_ok(struct stat *st)
+{
+    return (S_ISREG(st->st_mode) && st->st_size > 0 &&
+            st->st_size <= CONTENT_FILE_MAX &&
+            (Compress || (size_t)st->st_size <= Budget));
+}
+
+/* read whole file. st is what the name had at lookup. */
+static u_int8_t *
+file_load(const char *fname, struct stat *st)
+{
+    u_int8_t *data;
+
+    data = (u_int8_t *)safe_malloc(st->st_size);
+    if (data == NULL) {
+        P_WARNING("safe_malloc() failed.\n");
+        return NULL;
+    }
+    if (content_load(fname, st, data) == 0) {
+        if (errno != ESTALE)
+            P_WARNING("Can't read \"%s\": %s.\n", fname, strerror(errno));
+        safe_free(data);
+        return NULL;
+    }
+
+    return data;
+}
+
+/*
+ * Entry of fname valid for st, or NULL. A stale one is dropped (after
+ * its last session).
+ */
+static CONTENT *
+name_find(const char *fname, struct stat *st)
+{
+    unsigned int h;
+    CONTENT *content;
+
+    h = name_hash(fname);
+    for (content = ContentHash[h % CONTENT_HASH]; content != NULL;
+         content = content->hnext) {
+        if (content->hash != h || strcmp(content->fname, fname) != 0)
+            continue;
+        if (content->dev == st->st_dev && content->ino == st->st_ino &&
+            content->mtime == st->st_mtime && content->size == st->st_size)
+            return content;
+        /* the file was modified or replaced */
+        P_DEBUG("\"%s\" changed. content dropped.\n", fname);
+        StaleCounter++;
+        content_unlink(content);
+        if (content->refs == 0) content_free(content);
+        else content->stale = 1;
+        break;
+    }
+
+    return NULL;
+}
+
+/* blob of data (taken): same bytes cached, or new one. */
+static struct content_blob *
+blob_add(u_int8_t *data, off_t size)
+{
+    u_int64_t sum;
+    struct content_blob *blob;
+
+    sum = data_sum(data, size);
+
+    /* same bytes by other file (copy)? */
+    blob = blob_find(sum, data, size);
+    if (blob != NULL) {
+        P_DEBUG("%d bytes same as cached one.\n", (int)size);
+        safe_free(data);
+        DedupCounter++;
+        return blob;
+    }
+    blob = blob_new(data, size, sum);
+    if (blob != NULL) LoadCounter++;
+
+    return blob;
+}
+
+/* name entry of blob. */
+static CONTENT *
+content_new(const char *fname, struct stat *st, struct content_blob *blob)
+{
+    CONTENT *content;
+
+    content = (CONTENT *)safe_malloc(sizeof(CONTENT));
+    if (content == NULL) return NULL;
+    memset(content, 0, sizeof(*content));
+    content->fname = (char *)safe_malloc(strlen(fname) + 1);
+    if (content->fname == NULL) {
+        safe_free(content);
+        return NULL;
+    }
+    strcpy(content->fname, fname);
+    content->hash = name_hash(fname);
+    content->dev = st->st_dev;
+    content->ino = st->st_ino;
+    content->mtime = st->st_mtime;
+    content->size = st->st_size;
+    content->used = ++Tick;
+    content->blob = blob;
+    blob->nname++;
+
+    content->hnext = ContentHash[content->hash % CONTENT_HASH];
+    ContentHash[content->hash % CONTENT_HASH] = content;
+    content->inext = InodeHash[(unsigned int)st->st_ino % CONTENT_HASH];
+    InodeHash[(unsigned int)st->st_ino % CONTENT_HASH] = content;
+    ContentUsed++;
+
+    return content;
+}
+
+/* remove from hashes. freed by content_free() later. */
+static void
+content_unlink(CONTENT *content)
+{
+    CONTENT **walk;
+
+    for (walk = &ContentHash[content->hash % CONTENT_HASH]; *walk != NULL;
+         walk = &(*walk)->hnext) {
+        if (*walk == content) {
+            *walk = content->hnext;
+            break;
+        }
+    }
+    for (walk = &InodeHash[(unsigned int)content->ino % CONTENT_HASH];
+         *walk != NULL; walk = &(*walk)->inext) {
+        if (*walk == content) {
+            *walk = content->inext;
+            break;
+        }
+    }
+
+    return;
+}
+
+/* free name entry (unlinked). blob is freed with its last name. */
+static void
+content_free(CONTENT *content)
+{
+    if (content->pinned) {
+        content->blob->pinned--;
+        PinCounter--;
+    }
+    if (--content->blob->nname == 0) blob_free(content->blob);
+    ContentUsed--;
+    safe_free(content->fname);
+    safe_free(content);
+
+    return;
+}
+
+static struct content_blob *
+blob_by_inode(struct stat *st)
+{
+    CONTENT *walk;
+
+    for (walk = InodeHash[(unsigned int)st->st_ino % CONTENT_HASH];
+         walk != NULL; walk = walk->inext) {
+        if (walk->dev == st->st_dev && walk->ino == st->st_ino &&
+            walk->mtime == st->st_mtime && walk->size == st->st_size)
+            return walk->blob;
+    }
+
+    return NULL;
+}
+
+/* blob of same bytes as data. compared whole, not only by sum. */
+static struct content_blob *
+blob_find(u_int64_t sum, const u_int8_t *data, off_t size)
+{
+    int i, same;
+    const u_int8_t *chunk;
+    struct content_blob *blob;
+
+    for (blob = BlobHash[(unsigned int)sum % CONTENT_HASH]; blob != NULL;
+         blob = blob->hnext) {
+        if (blob->sum != sum || blob->size != size) continue;
+        if (blob->data != NULL) {
+            if (memcmp(blob->data, data, size) == 0) return blob;
+            continue;
+        }
+        for (i = 0, same = 1; same && i < blob->nzchunk; i++) {
+            chunk = blob_unzip(blob, i);
+            same = (chunk != NULL &&
+                    memcmp(chunk, data + (size_t)i * CONTENT_ZCHUNK,
+                           blob->zchunks[i].len) == 0);
+        }
+        if (same) return blob;
+    }
+
+    return NULL;
+}
+
+/*
+ * Cache data (taken, freed on failure) as new blob. NULL if it
+ * doesn't fit in the budget.
+ */
+static struct content_blob *
+blob_new(u_int8_t *data, off_t size, u_int64_t sum)
+{
+    struct content_blob *blob;
+
+    blob = (struct content_blob *)safe_malloc(sizeof(struct content_blob));
+    if (blob == NULL) {
+        safe_free(data);
+        return NULL;
+    }
+    memset(blob, 0, sizeof(*blob));
+    blob->sum = sum;
+    blob->size = size;
+    blob->data = data;
+    blob->stored = size;
+    blob->segfd = -1;
+    if (Compress && blob_zip(blob) == 0) {
+        blob_free(blob);
+        return NULL;
+    }
+
+    /* size compressed is known here */
+    if (blob->stored > Budget || cache_trim(blob->stored) == 0) {
+        SkipCounter++;
+        blob_free(blob);
+        return NULL;
+    }
+    blob_seal(blob);
+    blob_link(blob);
+
+    return blob;
+}
+
+/* add blob to hash and budget. */
+static void
+blob_link(struct content_blob *blob)
+{
+    CachedBytes += blob->stored;
+    if (blob->zchunks != NULL) {
+        RawBytes += blob->size;
+        ZBytes += blob->stored;
+    }
+    blob->hnext = BlobHash[(unsigned int)blob->sum % CONTENT_HASH];
+    BlobHash[(unsigned int)blob->sum % CONTENT_HASH] = blob;
+    BlobUsed++;
+
+    return;
+}
+
+/*
+ * Move data (or chunks) of blob into a sealed memfd segment, which can
+ * be handed off. Kept on heap if small or on failure.
+ */
+static void
+blob_seal(struct content_blob *blob)
+{
+#ifdef CONTENT_MEMFD
+    int i, fd, hifd;
+    size_t off;
+    ssize_t nwrite;
+    u_int8_t *seg;
+
+    if (blob->stored < CONTENT_SEG_MIN) return;
+
+    fd = memfd_create("sue.tftpd", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        P_WARNING("memfd_create() failed: %s.\n", strerror(errno));
+        return;
+    }
+    for (i = 0, off = 0; off < blob->stored; i++, off += nwrite) {
+        if (blob->data != NULL)
+            nwrite = pwrite(fd, blob->data + off, blob->stored - off, off);
+        else
+            nwrite = pwrite(fd, blob->zchunks[i].z, blob->zchunks[i].zlen,
+                            off);
+        if (nwrite <= 0) {
+            P_WARNING("pwrite() failed: %s.\n", strerror(errno));
+            close(fd);
+            return;
+        }
+        if (blob->data == NULL && (size_t)nwrite != blob->zchunks[i].zlen) {
+            close(fd);
+            return;
+        }
+    }
+    /* no one can change it, including the process adopting it. */
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+              F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+        P_WARNING("fcntl(F_ADD_SEALS) failed: %s.\n", strerror(errno));
+        close(fd);
+        return;
+    }
+    seg = mmap(NULL, blob->stored, PROT_READ, MAP_SHARED, fd, 0);
+    if (seg == MAP_FAILED) {
+        P_WARNING("mmap() failed: %s.\n", strerror(errno));
+        close(fd);
+        return;
+    }
+
+    if (blob->data != NULL) {
+        safe_free(blob->data);
+        blob->data = seg;
+    } else {
+        for (i = 0, off = 0; i < blob->nzchunk; i++) {
+            safe_free(blob->zchunks[i].z);
+            blob->zchunks[i].z = seg + off;
+            off += blob->zchunks[i].zlen;
+        }
+    }
+    blob->seg = seg;
+    /* out of the range select()ed, or not handed off */
+    hifd = fcntl(fd, F_DUPFD_CLOEXEC, FD_SETSIZE);
+    close(fd);
+    blob->segfd = hifd;
+    SegmentCounter++;
+#endif
+
+    return;
+}
+
+/* free blob, counted in the budget if it's in hash. */
+static void
+blob_free(struct content_blob *blob)
+{
+    int i;
+    struct content_blob **walk;
+
+    for (walk = &BlobHash[(unsigned int)blob->sum % CONTENT_HASH];
+         *walk != NULL; walk = &(*walk)->hnext) {
+        if (*walk == blob) {
+            *walk = blob->hnext;
+            CachedBytes -= blob->stored;
+            if (blob->zchunks != NULL) {
+                RawBytes -= blob->size;
+                ZBytes -= blob->stored;
+            }
+            BlobUsed--;
+            break;
+        }
+    }
+    while (blob->pkts != NULL) pkts_free(blob, blob->pkts);
+
+    for (i = 0; i < CONTENT_ZWINDOW; i++) {
+        if (ZWindow[i].blob == blob) ZWindow[i].blob = NULL;
+    }
+    for (i = 0; blob->seg == NULL && i < blob->nzchunk; i++) {
+        if (blob->zchunks[i].z != NULL) safe_free(blob->zchunks[i].z);
+    }
+    if (blob->zchunks != NULL) safe_free(blob->zchunks);
+    if (blob->seg != NULL) {
+        munmap(blob->seg, blob->stored);
+        SegmentCounter--;
+    } else if (blob->data != NULL) {
+        safe_free(blob->data);
+    }
+    if (blob->segfd >= 0) close(blob->segfd);
+    safe_free(blob);
+
+    return;
+}
+
+/*
+ * Make need bytes free in the budget by dropping unused names, least
+ * recently used first, until their blobs are freed. Names of blobs
+ * in use or pinned are kept. Returns 0 (nothing dropped) if it can't.
+ */
+static int
+cache_trim(size_t need)
+{
+    int i;
+    size_t freeable;
+    CONTENT *walk, *lru;
+    struct content_blob *blob;
+    struct content_pkts *pkts;
+
+    if (CachedBytes + need <= Budget) return 1;
+
+    freeable = 0;
+    for (i = 0; i < CONTENT_HASH; i++) {
+        for (blob = BlobHash[i]; blob != NULL; blob = blob->hnext) {
+            if (blob->refs > 0 || blob->pinned > 0) continue;
+            freeable += blob->stored;
+            for (pkts = blob->pkts; pkts != NULL; pkts = pkts->next)
+                freeable += pkts->len;
+        }
+    }
+    if (CachedBytes - freeable + need > Budget) return 0;
+
+    while (CachedBytes + need > Budget) {
+        lru = NULL;
+        for (i = 0; i < CONTENT_HASH; i++) {
+            for (walk = ContentHash[i]; walk != NULL; walk = walk->hnext) {
+                if (walk->blob->refs == 0 && walk->blob->pinned == 0 &&
+                    (lru == NULL || walk->used < lru->used))
+                    lru = walk;
+            }
+        }
+        if (lru == NULL) return 0;
+        P_DEBUG("\"%s\" evicted.\n", lru->fname);
+        content_unlink(lru);
+        content_free(lru);
+        EvictCounter++;
+    }
+
+    return 1;
+}
+
+/*
+ * Compress data of blob into CONTENT_ZCHUNK chunks and free it.
+ * Returns 0 on failure.
+ */
+static int
+blob_zip(struct content_blob *blob)
+{
+#ifdef CONTENT_LZ4
+    int i, zlen;
+    size_t len;
+    u_int8_t *zbuf;
+    struct content_zchunk *zc;
+
+    zbuf = (u_int8_t *)safe_malloc(LZ4_compressBound(CONTENT_ZCHUNK));
+    if (zbuf == NULL) return 0;
+    blob->nzchunk = (blob->size + CONTENT_ZCHUNK - 1) / CONTENT_ZCHUNK;
+    blob->zchunks = (struct content_zchunk *)
+        safe_malloc(blob->nzchunk * sizeof(struct content_zchunk));
+    if (blob->zchunks == NULL) {
+        blob->nzchunk = 0;
+        safe_free(zbuf);
+        return 0;
+    }
+    memset(blob->zchunks, 0, blob->nzchunk * sizeof(*zc));
+
+    blob->stored = 0;
+    for (i = 0; i < blob->nzchunk; i++) {
+        zc = &blob->zchunks[i];
+        len = blob->size - (off_t)i * CONTENT_ZCHUNK;
+        if (len > CONTENT_ZCHUNK) len = CONTENT_ZCHUNK;
+        zlen = LZ4_compress_default((const char *)blob->data +
+                                    (size_t)i * CONTENT_ZCHUNK,
+                                    (char *)zbuf, len,
+                                    LZ4_compressBound(CONTENT_ZCHUNK));
+        /* kept raw if it doesn't shrink */
+        if (zlen <= 0 || (size_t)zlen >= len) zlen = len;
+        zc->z = (u_int8_t *)safe_malloc(zlen);
+        if (zc->z == NULL) {
+            safe_free(zbuf);
+            return 0;
+        }
+        memcpy(zc->z, (size_t)zlen == len ?
+               blob->data + (size_t)i * CONTENT_ZCHUNK : zbuf, zlen);
+        zc->zlen = zlen;
+        zc->len = len;
+        blob->stored += zlen;
+    }
+    safe_free(zbuf);
+    safe_free(blob->data);
+    blob->data = NULL;
+
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/* chunk index of blob in the hot window, decompressed if not there. */
+static const u_int8_t *
+blob_unzip(struct content_blob *blob, int index)
+{
+#ifdef CONTENT_LZ4
+    int i, n;
+    struct content_zslot *slot;
+    struct content_zchunk *zc;
+    struct timeval start, end;
+
+    slot = NULL;
+    for (i = 0; i < CONTENT_ZWINDOW; i++) {
+        if (ZWindow[i].blob == blob && ZWindow[i].index == index) {
+            ZWindow[i].used = ++Tick;
+            WindowHitCounter++;
+            return ZWindow[i].buf;
+        }
+        if (slot == NULL || ZWindow[i].blob == NULL ||
+            (slot->blob != NULL && ZWindow[i].used < slot->used))
+            slot = &ZWindow[i];
+    }
+
+    if (slot->buf == NULL) {
+        slot->buf = (u_int8_t *)safe_malloc(CONTENT_ZCHUNK);
+        if (slot->buf == NULL) return NULL;
+    }
+    zc = &blob->zchunks[index];
+    gettimeofday(&start, NULL);
+    if (zc->zlen == zc->len) {
+        memcpy(slot->buf, zc->z, zc->len);
+    } else {
+        n = LZ4_decompress_safe((const char *)zc->z, (char *)slot->buf,
+                                zc->zlen, CONTENT_ZCHUNK);
+        if (n < 0 || (size_t)n != zc->len) {
+            P_WARNING("LZ4_decompress_safe() failed.\n");
+            slot->blob = NULL;
+            return NULL;
+        }
+    }
+    gettimeofday(&end, NULL);
+    UnzipUsec += (end.tv_sec - start.tv_sec) * 1000000 +
+                 (end.tv_usec - start.tv_usec);
+    UnzipCounter++;
+    slot->blob = blob;
+    slot->index = index;
+    slot->used = ++Tick;
+
+    return slot->buf;
+#else
+    return NULL;
+#endif
+}
+
+/*
+ * Encode whole blob for blksize. If it can't be kept, an empty image
+ * is kept instead, so later blocks of sessions don't try again (it's
+ * forgotten when the blob is unused). NULL on malloc failure.
+ */
+static struct content_pkts *
+pkts_encode(struct content_blob *blob, size_t blksize, int rollover)
+{
+    size_t len, n;
+    u_int32_t blockn, nblock;
+    u_int8_t *walk;
+    struct tftp_pkt *tpkt;
+    struct content_pkts *pkts;
+
+    pkts = (struct content_pkts *)safe_malloc(sizeof(struct content_pkts));
+    if (pkts == NULL) return NULL;
+    memset(pkts, 0, sizeof(*pkts));
+    pkts->blksize = blksize;
+    pkts->rollover = rollover;
+    pkts->next = blob->pkts;
+    blob->pkts = pkts;
+
+    /* last one may be empty */
+    nblock = blob->size / blksize + 1;
+    len = (size_t)nblock * (TFTP_HDLEN + TFTP_DATA_HDLEN + blksize);
+    /* contents first, images aren't dropped for an image not made. */
+    if (len > Budget || cache_trim(len) == 0 ||
+        pkts_trim(CONTENT_PKT_MAX - 1) == 0 ||
+        (pkts->image = (u_int8_t *)safe_malloc(len)) == NULL) {
+        NoImageCounter++;
+        return pkts;
+    }
+    pkts->stride = TFTP_HDLEN + TFTP_DATA_HDLEN + blksize;
+    pkts->nblock = nblock;
+    pkts->len = len;
+
+    for (blockn = 1, walk = pkts->image; blockn <= nblock;
+         blockn++, walk += pkts->stride) {
+        tpkt = (struct tftp_pkt *)walk;
+        tpkt->Opcode = htons(TFTP_DATA);
+        /* same as blk_wire() in proto_tftp.c */
+        if (rollover)
+            TFTP_TO_DATA(tpkt)->BlockN =
+                htons((u_int16_t)((blockn - 1) % TFTP_BLOCK_MAX + 1));
+        else
+            TFTP_TO_DATA(tpkt)->BlockN = htons((u_int16_t)blockn);
+        n = (blockn < nblock) ? blksize :
+            blob->size - (off_t)(blockn - 1) * blksize;
+        memcpy(TFTP_TO_DATA(tpkt)->Data,
+               blob->data + (size_t)(blockn - 1) * blksize, n);
+    }
+
+    CachedBytes += len;
+    PktsUsed++;
+    EncodeCounter++;
+    P_DEBUG("%d bytes encoded, %d packets of %d bytes.\n",
+            (int)blob->size, nblock, blksize);
+
+    return pkts;
+}
+
+static void
+pkts_free(struct content_blob *blob, struct content_pkts *pkts)
+{
+    struct content_pkts **walk;
+
+    for (walk = &blob->pkts; *walk != NULL; walk = &(*walk)->next) {
+        if (*walk == pkts) {
+            *walk = pkts->next;
+            break;
+        }
+    }
+    if (pkts->image != NULL) {
+        CachedBytes -= pkts->len;
+        PktsUsed--;
+        safe_free(pkts->image);
+    }
+    safe_free(pkts);
+
+    return;
+}
+
+/* forget empty images of blob, the next session tries again. */
+static void
+pkts_forget(struct content_blob *blob)
+{
+    struct content_pkts **walk, *pkts;
+
+    walk = &blob->pkts;
+    while (*walk != NULL) {
+        pkts = *walk;
+        if (pkts->image == NULL) {
+            *walk = pkts->next;
+            safe_free(pkts);
+        } else {
+            walk = &pkts->next;
+        }
+    }
+
+    return;
+}
+
+/*
+ * Drop images of unused blobs until keep are left, least recently
+ * used first. Returns 0 if it can't.
+ */
+static int
+pkts_trim(int keep)
+{
+    int i;
+    struct content_blob *walk, *owner;
+    struct content_pkts *pkts, *lru;
+
+    while (PktsUsed > keep) {
+        lru = NULL;
+        owner = NULL;
+        for (i = 0; i < CONTENT_HASH; i++) {
+            for (walk = BlobHash[i]; walk != NULL; walk = walk->hnext) {
+                if (walk->refs > 0) continue;
+                for (pkts = walk->pkts; pkts != NULL; pkts = pkts->next) {
+                    if (pkts->image == NULL) continue;
+                    if (lru == NULL || pkts->used < lru->used) {
+                        lru = pkts;
+                        owner = walk;
+                    }
+                }
+            }
+        }
+        if (lru == NULL) return 0;
+        pkts_free(owner, lru);
+        PktsDropCounter++;
+    }
+
+    return 1;
+}
+
+/*
+ * Index record of blob (struct content_rec, chunks, names, and data
+ * unless it has a segment) into buf. Returns length, or 0 if it isn't
+ * sent.
+ */
+static size_t
+rec_pack(struct content_blob *blob, u_int8_t *buf, size_t size)
+{
+    int i;
+    size_t len, n;
+    u_int32_t zc[2];
+    CONTENT *walk;
+    struct content_rec rec;
+    struct content_rec_name name;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.sum = blob->sum;
+    rec.size = blob->size;
+    rec.stored = blob->stored;
+    rec.nzchunk = (blob->data == NULL) ? blob->nzchunk : 0;
+    rec.segment = (blob->segfd >= 0);
+
+    len = sizeof(rec);
+    for (i = 0; i < rec.nzchunk; i++) {
+        if (len + sizeof(zc) > size) return 0;
+        zc[0] = blob->zchunks[i].zlen;
+        zc[1] = blob->zchunks[i].len;
+        memcpy(buf + len, zc, sizeof(zc));
+        len += sizeof(zc);
+    }
+
+    for (i = 0; i < CONTENT_HASH; i++) {
+        for (walk = ContentHash[i]; walk != NULL; walk = walk->hnext) {
+            if (walk->blob != blob) continue;
+            memset(&name, 0, sizeof(name));
+            name.dev = walk->dev;
+            name.ino = walk->ino;
+            name.mtime = walk->mtime;
+            name.size = walk->size;
+            name.len = strlen(walk->fname) + 1;
+            if (len + sizeof(name) + name.len > size) return 0;
+            memcpy(buf + len, &name, sizeof(name));
+            memcpy(buf + len + sizeof(name), walk->fname, name.len);
+            len += sizeof(name) + name.len;
+            rec.nname++;
+        }
+    }
+    if (rec.nname == 0) return 0; /* only stale names */
+
+    if (rec.segment == 0) {
+        if (len + blob->stored > size) return 0;
+        if (blob->data != NULL) {
+            memcpy(buf + len, blob->data, blob->stored);
+        } else {
+            for (i = 0, n = 0; i < blob->nzchunk; i++) {
+                memcpy(buf + len + n, blob->zchunks[i].z,
+                       blob->zchunks[i].zlen);
+                n += blob->zchunks[i].zlen;
+            }
+        }
+        len += blob->stored;
+    }
+    memcpy(buf, &rec, sizeof(rec));
+
+    return len;
+}
+
+/*
+ * Cache blob and names of record in buf, data from memfd fd (not
+ * taken) or the record. Returns 1 if adopted, 0 if not.
+ */
+static int
+rec_adopt(const u_int8_t *buf, size_t len, int fd)
+{
+    int i;
+    size_t off, zlen, raw;
+    u_int32_t zc[2];
+    u_int8_t *seg;
+    struct stat st;
+    struct content_rec rec;
+    struct content_rec_name name;
+    struct content_blob *blob;
+
+    memcpy(&rec, buf, sizeof(rec));
+    off = sizeof(rec);
+    if (rec.size <= 0 || rec.stored == 0 || rec.nname < 0 ||
+        rec.nzchunk < 0 || rec.segment != (fd >= 0))
+        return 0;
+#ifndef CONTENT_LZ4
+    if (rec.nzchunk > 0) return 0;
+#endif
+    if (rec.nzchunk > 0 &&
+        rec.nzchunk != (rec.size + CONTENT_ZCHUNK - 1) / CONTENT_ZCHUNK)
+        return 0;
+    if (rec.nzchunk == 0 && rec.stored != (size_t)rec.size) return 0;
+    /* the budget may be smaller than before */
+    if (CachedBytes + rec.stored > Budget) {
+        SkipCounter++;
+        return 0;
+    }
+
+    blob = (struct content_blob *)safe_malloc(sizeof(struct content_blob));
+    if (blob == NULL) return 0;
+    memset(blob, 0, sizeof(*blob));
+    blob->sum = rec.sum;
+    blob->size = rec.size;
+    blob->stored = rec.stored;
+    blob->segfd = -1;
+
+    if (rec.nzchunk > 0) {
+        blob->zchunks = (struct content_zchunk *)
+            safe_malloc(rec.nzchunk * sizeof(struct content_zchunk));
+        if (blob->zchunks == NULL) {
+            blob_free(blob);
+            return 0;
+        }
+        memset(blob->zchunks, 0, rec.nzchunk * sizeof(struct content_zchunk));
+        blob->nzchunk = rec.nzchunk;
+        for (i = 0, zlen = 0, raw = 0; i < rec.nzchunk; i++) {
+            if (off + sizeof(zc) > len) break;
+            memcpy(zc, buf + off, sizeof(zc));
+            off += sizeof(zc);
+            blob->zchunks[i].zlen = zc[0];
+            blob->zchunks[i].len = zc[1];
+            zlen += zc[0];
+            raw += zc[1];
+            if (zc[0] == 0 || zc[1] == 0 || zc[1] > CONTENT_ZCHUNK) break;
+        }
+        if (i < rec.nzchunk || zlen != rec.stored || raw != (size_t)rec.size) {
+            blob_free(blob);
+            return 0;
+        }
+    }
+
+    /* names are checked by stat() when requested, as others */
+    for (i = 0; i < rec.nname; i++) {
+        if (off + sizeof(name) > len) break;
+        memcpy(&name, buf + off, sizeof(name));
+        if (name.len == 0 || off + sizeof(name) + name.len > len ||
+            buf[off + sizeof(name) + name.len - 1] != '\0')
+            break;
+        off += sizeof(name) + name.len;
+    }
+    if (i < rec.nname || (fd < 0 && off + rec.stored != len) ||
+        (fd >= 0 && off != len)) {
+        blob_free(blob);
+        return 0;
+    }
+
+    if (fd >= 0) {
+        if (fstat(fd, &st) < 0 || st.st_size < (off_t)rec.stored) {
+            blob_free(blob);
+            return 0;
+        }
+        seg = mmap(NULL, rec.stored, PROT_READ, MAP_SHARED, fd, 0);
+        if (seg == MAP_FAILED) {
+            P_WARNING("mmap() failed: %s.\n", strerror(errno));
+            blob_free(blob);
+            return 0;
+        }
+        blob->seg = seg;
+        blob->segfd = fcntl(fd, F_DUPFD_CLOEXEC, FD_SETSIZE);
+        SegmentCounter++;
+    } else {
+        seg = (u_int8_t *)safe_malloc(rec.stored);
+        if (seg == NULL) {
+            blob_free(blob);
+            return 0;
+        }
+        memcpy(seg, buf + off, rec.stored);
+    }
+    if (rec.nzchunk == 0) {
+        blob->data = seg;
+    } else {
+        for (i = 0, zlen = 0; i < rec.nzchunk; i++) {
+            if (blob->seg != NULL) {
+                blob->zchunks[i].z = seg + zlen;
+            } else {
+                blob->zchunks[i].z =
+                    (u_int8_t *)safe_malloc(blob->zchunks[i].zlen);
+                if (blob->zchunks[i].z != NULL)
+                    memcpy(blob->zchunks[i].z, seg + zlen,
+                           blob->zchunks[i].zlen);
+            }
+            zlen += blob->zchunks[i].zlen;
+        }
+        if (blob->seg == NULL) safe_free(seg);
+        for (i = 0; i < rec.nzchunk; i++) {
+            if (blob->zchunks[i].z == NULL) {
+                blob_free(blob);
+                return 0;
+            }
+        }
+    }
+    blob_link(blob);
+
+    for (i = 0, off = sizeof(rec) + rec.nzchunk * sizeof(zc);
+         i < rec.nname; i++) {
+        memcpy(&name, buf + off, sizeof(name));
+        memset(&st, 0, sizeof(st));
+        st.st_dev = name.dev;
+        st.st_ino = name.ino;
+        st.st_mtime = name.mtime;
+        st.st_size = name.size;
+        content_new((const char *)buf + off + sizeof(name), &st, blob);
+        off += sizeof(name) + name.len;
+    }
+    if (blob->nname == 0) {
+        blob_free(blob);
+        return 0;
+    }
+    AdoptCounter++;
+    AdoptBytes += blob->stored;
+
+    return 1;
+}
@@ -0,0 +1,161 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __CONTENT_H__
+#define __CONTENT_H__
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef __CONTENT_PRIVATE__
+typedef struct __tftp_content CONTENT;
+
+struct __tftp_content {
+    /* content structure is protected. Only content.c can read actual value. */
+    char *__dummy[0];
+};
+#endif
+
+int content_init(size_t budget, int compress);
+CONTENT *content_open(const char *fname);
+void content_close(CONTENT *content);
+ssize_t content_read(CONTENT *content, off_t offset, void *buf, size_t len);
+ssize_t content_map(CONTENT *content, off_t offset, size_t len,
+                    const u_int8_t **data);
+ssize_t content_packet(CONTENT *content, size_t blksize, int rollover,
+                       u_int32_t blockn, const u_int8_t **pkt);
+off_t content_pin(const char *fname);
+int content_want(const char *fname, struct stat *st);
+int content_load(const char *fname, struct stat *st, u_int8_t *buf);
+int content_insert(const char *fname, struct stat *st, u_int8_t *data);
+off_t content_get_size(CONTENT *content);
+int content_export(int sock);
+int content_import(int sock);
+void content_report(void);
+
+enum content_params {
+    CONTENT_FILE_MAX = 64 * 1024 * 1024, /* max bytes of a file cached */
+    CONTENT_HASH = 256,                  /* size of hash tables */
+    CONTENT_PKT_MAX = 16,                /* max packet images (top-N) */
+    CONTENT_ZCHUNK = 64 * 1024,          /* bytes compressed at a time */
+    CONTENT_ZWINDOW = 8,                 /* chunks kept decompressed */
+    CONTENT_SEG_MIN = 16 * 1024,         /* smaller blobs stay on heap */
+    CONTENT_REC_MAX = 128 * 1024,        /* max bytes of a handoff record */
+};
+
+/*
+ * NOTE:
+ *
+ * - Content cache (-c)
+ *     Whole files are kept in memory up to the budget given by -c,
+ *   keyed by the requested name. A session of a cached file reads
+ *   no disk: stream_open() takes the content before opening the
+ *   file, and blocks are sent from it without copy (stream_map()).
+ *     An entry is checked against the directory index (dirindex.h,
+ *   kept current by inotify) or stat() when the index is not used,
+ *   and is valid only while device, inode, mtime and size are same.
+ *   A stale entry is dropped (after its last session).
+ *     A file is loaded only if it is a regular file not larger than
+ *   CONTENT_FILE_MAX and the budget can be made free by dropping
+ *   unused entries, least recently used first. A file which would
+ *   need entries in use to be dropped is not cached (Skip), so one
+ *   big file doesn't flush many small hot ones while they are sent.
+ *
+ * - Deduplication
+ *     Entries are names; the data is kept in a blob shared by all
+ *   names of the same bytes (copies of a file under other paths). A
+ *   name whose device, inode, mtime and size are same as a cached one
+ *   (hard link) takes its blob without reading the file. Otherwise the
+ *   file is read and hashed once (64bit FNV-1a), and a blob of the
+ *   same hash and size is taken if the bytes compare equal; only a
+ *   new blob is counted in the budget. Packet images and compressed
+ *   chunks belong to the blob, so they are shared too.
+ *     A blob is freed with its last name. Eviction drops unused names
+ *   (least recently used first) of blobs no session reads. Bytes the
+ *   names would hold without sharing are reported as Saved.
+ *
+ * - Packet image
+ *     The first session of a cached file with a block size encodes
+ *   the whole file as DATA packets (header and data) laid out one
+ *   after another, stride TFTP_HDLEN + TFTP_DATA_HDLEN + blksize, and
+ *   the image is kept with the content. Block k of any later session
+ *   with the same block size and rollover is a pointer into the image,
+ *   sent by one sendmsg() without copy or encoding. A file of a
+ *   multiple of blksize has an empty last packet.
+ *     Images are counted in the budget. At most CONTENT_PKT_MAX images
+ *   are kept; beyond that, the least recently used image of an unused
+ *   content is dropped first (after the budget is made free by
+ *   dropping contents). If there is none, or the budget can't be made
+ *   free, the sessions send from the content as before, and the image
+ *   is not tried again (NoImage) until the content is unused.
+ *
+ * - Compressed content (-C)
+ *     With -C (and LZ4 found by configure), a file is loaded, then
+ *   compressed by LZ4 in CONTENT_ZCHUNK chunks, and only the chunks
+ *   are kept (a chunk which doesn't shrink is kept as is), so the
+ *   budget holds more files. The budget is checked by compressed
+ *   size. content_read() decompresses a chunk into the hot window of
+ *   CONTENT_ZWINDOW chunks shared by all sessions (LRU), so sessions
+ *   going together decompress a chunk once. Compressed contents are
+ *   read by copy: no stream_map() slices and no packet images, which
+ *   would need the whole file decompressed.
+ *     The ratio (compressed / raw) and average time to decompress a
+ *   chunk are reported.
+ *
+ * - Handoff (-H)
+ *     A blob of CONTENT_SEG_MIN bytes or more is kept in a memfd
+ *   segment (sealed, mapped read only) instead of heap, and the memfd
+ *   is kept open above the descriptors select()ed. content_export()
+ *   sends each blob as one record on a SOCK_SEQPACKET socket: the
+ *   sum, sizes, chunk table and names with their attributes, and the
+ *   memfd attached by SCM_RIGHTS (a small blob is sent in the record),
+ *   then an empty record. content_import() maps the segments of the
+ *   records as they are, so the new process starts with the cache of
+ *   the old one without reading or copying a file. Names adopted are
+ *   checked when requested as others, so a file changed meanwhile is
+ *   dropped then. Blobs not fitting in the new budget are skipped.
+ *   Packet images are not sent; they are encoded again on demand.
+ */
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* __CONTENT_H__ */
@@ -42,12 +42,25 @@
 extern "C" {
 #endif /* __cplusplus */
 
+#define DEBUG_ASCII
+#define DEBUG_CLIENT
+#define DEBUG_CONG
+#define DEBUG_CONTENT
+#define DEBUG_DIRINDEX
+#define DEBUG_DUPREQ
+#define DEBUG_HANDOFF
+#define DEBUG_MCAST
+#define DEBUG_NEGCACHE
 #define DEBUG_PKT_BUFF
+#define DEBUG_PREFETCH
 #define DEBUG_PROTO_TFTP
 #define DEBUG_PROTO_UDP
+#define DEBUG_STREAM
 #define DEBUG_TASK
 #define DEBUG_TFTPD
 #define DEBUG_TIMER
+#define DEBUG_UPLOAD
+#define DEBUG_WARM
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,1003 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#if HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#  include <sys/inotify.h>
+#  define DIRINDEX_INOTIFY
+#endif
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_LIBPTHREAD)
+#  include <pthread.h>
+#  define DIRINDEX_PTHREAD
+#endif
+
+#include "dirindex.h"
+#include "util.h"
+#include "debug.h"
+
+#ifndef DEBUG_DIRINDEX
+#  undef P_DEBUG
+#  define P_DEBUG(fmt...) /* null */
+#endif
+
+#ifdef DIRINDEX_INOTIFY
+#  define DIRINDEX_EVMASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+                           IN_MOVED_TO | IN_CLOSE_WRITE | IN_ATTRIB | \
+                           IN_MODIFY | IN_ONLYDIR)
+#endif
+
+#ifdef DIRINDEX_PTHREAD
+#  define WALK_LOCK(ctx)      pthread_mutex_lock(&(ctx)->lock)
+#  define WALK_UNLOCK(ctx)    pthread_mutex_unlock(&(ctx)->lock)
+#  define WALK_WAIT(ctx)      pthread_cond_wait(&(ctx)->cond, &(ctx)->lock)
+#  define WALK_BROADCAST(ctx) pthread_cond_broadcast(&(ctx)->cond)
+#else
+#  define WALK_LOCK(ctx)      /* null */
+#  define WALK_UNLOCK(ctx)    /* null */
+#  define WALK_WAIT(ctx)      /* null */
+#  define WALK_BROADCAST(ctx) /* null */
+#endif
+
+/*
+ * Memory of the index is allocated by threads of the walk, so plain
+ * malloc() is used instead of safe_malloc() (whose counter isn't
+ * thread safe).
+ */
+struct dirindex_ent {
+    char *path;                     /* relative to root, "" is root */
+    unsigned int hash;
+    mode_t mode;                    /* stat() of the name (links followed) */
+    off_t size;
+    time_t mtime;
+    dev_t dev;
+    ino_t ino;
+    int opaque;                     /* directory not walked (link, EACCES) */
+    struct dirindex_ent *hnext;     /* hash chain, or list of a walk */
+    struct dirindex_ent *parent;    /* directory, NULL if root or unlinked */
+    struct dirindex_ent *child;     /* names in the directory */
+    struct dirindex_ent *snext;     /* siblings in the parent */
+    struct dirindex_ent **sprev;
+};
+
+struct dirindex_watch {
+    int wd;
+    char *path;                     /* directory watched */
+    struct dirindex_watch *next;
+};
+
+/* directory to be read by a walk */
+struct walk_job {
+    char *path;
+    struct walk_job *next;
+};
+
+/* result of a thread of a walk */
+struct walk_out {
+    struct dirindex_ent *ents;      /* names found */
+    struct dirindex_watch *watches; /* directories watched */
+    int ndir;                       /* directories read */
+    int err;                        /* errno of failed watch, 0 if none */
+};
+
+/* state of a walk shared by threads */
+struct walk_ctx {
+#ifdef DIRINDEX_PTHREAD
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+    struct walk_job *queue;         /* directories not read yet */
+    int busy;                       /* threads reading a directory */
+};
+
+struct walk_arg {
+    struct walk_ctx *ctx;
+    struct walk_out out;
+};
+
+/*
+ * file scope variables
+ */
+static int Enabled = 0;             /* index is complete and watched */
+static int Rooted = 0;              /* chroot()ed, "/name" is "name" */
+static int NotifyFd = -1;
+static struct dirindex_ent **Hash = NULL;
+static unsigned int HashSize = 0;
+static int EntUsed = 0;
+static int DirUsed = 0;
+static struct dirindex_watch *Watches[DIRINDEX_HASH_MIN];
+
+static unsigned int HitCounter = 0;
+static unsigned int MissCounter = 0;
+static unsigned int UnknownCounter = 0;
+static unsigned int EventCounter = 0;
+static unsigned int RescanCounter = 0;
+static unsigned int RebuildCounter = 0;
+
+/* forward declarations of private functions */
+static unsigned int path_hash(const char *path);
+static char *path_join(const char *dir, const char *name);
+static int path_normalize(const char *fname, char *buf, size_t size);
+static struct dirindex_ent *ent_new(const char *path, struct stat *st);
+static struct dirindex_ent *ent_find(const char *path);
+static struct dirindex_ent *ent_put(struct dirindex_ent *ent, int merge);
+static void ent_link(struct dirindex_ent *ent);
+static void ent_del(struct dirindex_ent *ent);
+static void ent_del_tree(const char *path);
+static void ent_refresh(const char *path, int walk);
+static void index_clear(void);
+static int index_walk(const char *path, int nthread);
+static void *walk_thread(void *arg);
+static void walk_dir(const char *path, struct walk_out *out,
+                     struct walk_job **subdirs);
+static struct dirindex_watch *watch_find(int wd);
+static void watch_put(struct dirindex_watch *watch);
+static void watch_del_tree(const char *path);
+static void notify_drain(void);
+
+/*
+ * Exported functions
+ */
+
+/*
+ * Walk the current directory (root) and watch it. Returns 1 if the
+ * index is usable.
+ */
+int
+dirindex_build(int rooted)
+{
+    int nthread, err;
+    long msec;
+    struct stat st;
+    struct timeval start, end;
+    struct dirindex_ent *root;
+
+    Rooted = rooted;
+    Enabled = 0;
+#ifndef DIRINDEX_INOTIFY
+    P_WARNING("inotify is not available. Directory index not used.\n");
+    return 0;
+#else
+    if (NotifyFd < 0) {
+        NotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (NotifyFd < 0) {
+            P_WARNING("inotify_init1() failed: %s. "
+                      "Directory index not used.\n", strerror(errno));
+            return 0;
+        }
+    }
+    index_clear();
+
+    nthread = 1;
+#ifdef DIRINDEX_PTHREAD
+    nthread = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthread < 1) nthread = 1;
+    if (nthread > DIRINDEX_THREADS) nthread = DIRINDEX_THREADS;
+#endif
+
+    gettimeofday(&start, NULL);
+    if (stat(".", &st) < 0) {
+        P_WARNING("stat() failed: %s.\n", strerror(errno));
+        return 0;
+    }
+    root = ent_new("", &st);
+    if (root == NULL) return 0;
+    ent_put(root, 0);
+    err = index_walk("", nthread);
+    gettimeofday(&end, NULL);
+    if (err != 0) {
+        P_WARNING("Unable to watch directory: %s. "
+                  "Directory index not used.\n", strerror(err));
+        index_clear();
+        return 0;
+    }
+    Enabled = 1;
+
+    msec = (end.tv_sec - start.tv_sec) * 1000 +
+           (end.tv_usec - start.tv_usec) / 1000;
+    P_INFO("Directory index: %d names in %d directories, "
+           "%ld [ms] by %d threads.\n", EntUsed, DirUsed, msec, nthread);
+
+    return 1;
+#endif
+}
+
+/*
+ * stat() by the index. Returns 1 with st set if the name exists, 0
+ * if it doesn't, or -1 if the index can't tell (ask the file system).
+ */
+int
+dirindex_stat(const char *fname, struct stat *st)
+{
+    char path[PATH_MAX];
+    char *slash;
+    struct dirindex_ent *ent;
+
+    if (Enabled == 0) return -1;
+    notify_drain();
+    if (Enabled == 0) return -1;
+
+    if (path_normalize(fname, path, sizeof(path)) == 0) {
+        UnknownCounter++;
+        return -1;
+    }
+    ent = ent_find(path);
+    if (ent != NULL) {
+        memset(st, 0, sizeof(*st));
+        st->st_mode = ent->mode;
+        st->st_size = ent->size;
+        st->st_mtime = ent->mtime;
+        st->st_dev = ent->dev;
+        st->st_ino = ent->ino;
+        HitCounter++;
+        return 1;
+    }
+
+    /* missing if the nearest directory in the index was walked */
+    while (path[0] != '\0') {
+        slash = strrchr(path, '/');
+        if (slash != NULL) *slash = '\0';
+        else path[0] = '\0';
+        ent = ent_find(path);
+        if (ent == NULL) continue;
+        if (S_ISDIR(ent->mode) && ent->opaque == 0) {
+            MissCounter++;
+            return 0;
+        }
+        break;
+    }
+    UnknownCounter++;
+
+    return -1;
+}
+
+void
+dirindex_report(void)
+{
+    if (Enabled == 0) return;
+
+    P_INFO("--- directory index statics ---\n");
+    P_INFO(" Entry    Counter = %d\n", EntUsed);
+    P_INFO(" Dir      Counter = %d\n", DirUsed);
+    P_INFO(" Hit      Counter = %d\n", HitCounter);
+    P_INFO(" Miss     Counter = %d\n", MissCounter);
+    P_INFO(" Unknown  Counter = %d\n", UnknownCounter);
+    P_INFO(" Event    Counter = %d\n", EventCounter);
+    P_INFO(" Rescan   Counter = %d\n", RescanCounter);
+    P_INFO(" Rebuild  Counter = %d\n", RebuildCounter);
+
+    return;
+}
+
+/*
+ * Private functions
+ */
+static unsigned int
+path_hash(const char *path)
+{
+    unsigned int h;
+    const unsigned char *p;
+
+    for (h = 0, p = (const unsigned char *)path; *p != '\0'; p++)
+        h = h * 31 + *p;
+
+    return h;
+}
+
+/* "dir/name" by malloc(), "name" if dir is root. */
+static char *
+path_join(const char *dir, const char *name)
+{
+    size_t dlen;
+    char *path;
+
+    dlen = strlen(dir);
+    path = (char *)malloc(dlen + strlen(name) + 2);
+    if (path == NULL) return NULL;
+    if (dlen == 0) {
+        strcpy(path, name);
+    } else {
+        memcpy(path, dir, dlen);
+        path[dlen] = '/';
+        strcpy(path + dlen + 1, name);
+    }
+
+    return path;
+}
+
+/* requested name to key of the index. 0 if the index can't answer. */
+static int
+path_normalize(const char *fname, char *buf, size_t size)
+{
+    const char *comp, *end;
+    size_t len;
+
+    if (fname[0] == '/') {
+        if (Rooted == 0) return 0;
+        while (*fname == '/') fname++;
+    }
+    len = strlen(fname);
+    if (len >= size) return 0;
+
+    /* "", ".", ".." components make other names for same file */
+    for (comp = fname; *comp != '\0'; comp = end + 1) {
+        end = strchr(comp, '/');
+        if (end == NULL) end = comp + strlen(comp);
+        if (end == comp) return 0;
+        if (end - comp == 1 && comp[0] == '.') return 0;
+        if (end - comp == 2 && comp[0] == '.' && comp[1] == '.') return 0;
+        if (*end == '\0') break;
+    }
+    memcpy(buf, fname, len + 1);
+
+    return 1;
+}
+
+static struct dirindex_ent *
+ent_new(const char *path, struct stat *st)
+{
+    struct dirindex_ent *ent;
+
+    ent = (struct dirindex_ent *)malloc(sizeof(struct dirindex_ent));
+    if (ent == NULL) return NULL;
+    ent->path = strdup(path);
+    if (ent->path == NULL) {
+        free(ent);
+        return NULL;
+    }
+    ent->hash = path_hash(path);
+    ent->mode = st->st_mode;
+    ent->size = st->st_size;
+    ent->mtime = st->st_mtime;
+    ent->dev = st->st_dev;
+    ent->ino = st->st_ino;
+    ent->opaque = 0;
+    ent->hnext = NULL;
+    ent->parent = NULL;
+    ent->child = NULL;
+    ent->snext = NULL;
+    ent->sprev = NULL;
+
+    return ent;
+}
+
+static struct dirindex_ent *
+ent_find(const char *path)
+{
+    unsigned int h;
+    struct dirindex_ent *ent;
+
+    if (HashSize == 0) return NULL;
+    h = path_hash(path);
+    for (ent = Hash[h & (HashSize - 1)]; ent != NULL; ent = ent->hnext) {
+        if (ent->hash == h && strcmp(ent->path, path) == 0) return ent;
+    }
+
+    return NULL;
+}
+
+/*
+ * Insert ent, or update the entry of the same path by it (ent is
+ * freed). merge keeps opaque flag set by the walk of the directory.
+ * Returns the entry in the index, or NULL.
+ */
+static struct dirindex_ent *
+ent_put(struct dirindex_ent *ent, int merge)
+{
+    unsigned int i, size;
+    struct dirindex_ent **table, *walk, *next, *old;
+
+    old = ent_find(ent->path);
+    if (old != NULL) {
+        if (S_ISDIR(old->mode) && !S_ISDIR(ent->mode)) DirUsed--;
+        if (!S_ISDIR(old->mode) && S_ISDIR(ent->mode)) DirUsed++;
+        old->mode = ent->mode;
+        old->size = ent->size;
+        old->mtime = ent->mtime;
+        old->dev = ent->dev;
+        old->ino = ent->ino;
+        old->opaque = merge ? (old->opaque | ent->opaque) : ent->opaque;
+        free(ent->path);
+        free(ent);
+        return old;
+    }
+
+    /* keep chains short. buckets are power of 2. */
+    if (EntUsed >= HashSize) {
+        size = (HashSize == 0) ? DIRINDEX_HASH_MIN : HashSize * 2;
+        table = (struct dirindex_ent **)calloc(size, sizeof(*table));
+        if (table == NULL) {
+            if (HashSize == 0) {
+                free(ent->path);
+                free(ent);
+                return NULL;
+            }
+        } else {
+            for (i = 0; i < HashSize; i++) {
+                for (walk = Hash[i]; walk != NULL; walk = next) {
+                    next = walk->hnext;
+                    walk->hnext = table[walk->hash & (size - 1)];
+                    table[walk->hash & (size - 1)] = walk;
+                }
+            }
+            free(Hash);
+            Hash = table;
+            HashSize = size;
+        }
+    }
+    ent->hnext = Hash[ent->hash & (HashSize - 1)];
+    Hash[ent->hash & (HashSize - 1)] = ent;
+    EntUsed++;
+    if (S_ISDIR(ent->mode)) DirUsed++;
+    ent_link(ent);
+
+    return ent;
+}
+
+/*
+ * Add ent to names of its directory, if the directory is in the index
+ * (a walk merges names before their directory may be, see index_walk()).
+ */
+static void
+ent_link(struct dirindex_ent *ent)
+{
+    char *slash;
+    struct dirindex_ent *parent;
+
+    if (ent->parent != NULL || ent->path[0] == '\0') return;
+
+    slash = strrchr(ent->path, '/');
+    if (slash == NULL) {
+        parent = ent_find("");
+    } else {
+        *slash = '\0';
+        parent = ent_find(ent->path);
+        *slash = '/';
+    }
+    if (parent == NULL) return;
+
+    ent->parent = parent;
+    ent->snext = parent->child;
+    if (parent->child != NULL) parent->child->sprev = &ent->snext;
+    parent->child = ent;
+    ent->sprev = &parent->child;
+
+    return;
+}
+
+/* drop ent and names under it. */
+static void
+ent_del(struct dirindex_ent *ent)
+{
+    struct dirindex_ent **walk;
+
+    while (ent->child != NULL) ent_del(ent->child);
+
+    if (ent->sprev != NULL) {
+        *ent->sprev = ent->snext;
+        if (ent->snext != NULL) ent->snext->sprev = ent->sprev;
+    }
+    for (walk = &Hash[ent->hash & (HashSize - 1)]; *walk != NULL;
+         walk = &(*walk)->hnext) {
+        if (*walk == ent) {
+            *walk = ent->hnext;
+            break;
+        }
+    }
+    if (S_ISDIR(ent->mode)) DirUsed--;
+    EntUsed--;
+    free(ent->path);
+    free(ent);
+
+    return;
+}
+
+/*
+ * drop path and names under it. A file is one probe, only a directory
+ * walks its names (and watches).
+ */
+static void
+ent_del_tree(const char *path)
+{
+    int dir;
+    struct dirindex_ent *ent;
+
+    ent = ent_find(path);
+    if (ent == NULL) return;
+    dir = S_ISDIR(ent->mode);
+    ent_del(ent);
+    if (dir) watch_del_tree(path);
+
+    return;
+}
+
+/* stat() path again. walk it if it's a new directory. */
+static void
+ent_refresh(const char *path, int walk)
+{
+    int link, opaque;
+    struct stat st;
+    struct dirindex_ent *ent;
+
+    /* directory unreadable at the walk may be readable now */
+    ent = ent_find(path);
+    opaque = (ent != NULL && ent->opaque);
+
+    if (lstat(path, &st) < 0) {
+        ent_del_tree(path);
+        return;
+    }
+    link = S_ISLNK(st.st_mode);
+    if (link && stat(path, &st) < 0) {
+        /* dangling link is missing for stat() too */
+        ent_del_tree(path);
+        return;
+    }
+    ent = ent_new(path, &st);
+    if (ent == NULL) {
+        P_WARNING("malloc() failed. Directory index not used.\n");
+        Enabled = 0;
+        return;
+    }
+    ent->opaque = (link && S_ISDIR(st.st_mode));
+    ent_put(ent, 0);
+
+    if ((walk || opaque) && S_ISDIR(st.st_mode) && link == 0) {
+        RescanCounter++;
+        if (index_walk(path, 1) != 0) {
+            P_WARNING("Unable to watch \"%s\". "
+                      "Directory index not used.\n", path);
+            Enabled = 0;
+        }
+    }
+
+    return;
+}
+
+static void
+index_clear(void)
+{
+    unsigned int i;
+    struct dirindex_ent *ent, *next;
+    struct dirindex_watch *watch, *wnext;
+
+    for (i = 0; i < HashSize; i++) {
+        for (ent = Hash[i]; ent != NULL; ent = next) {
+            next = ent->hnext;
+            free(ent->path);
+            free(ent);
+        }
+    }
+    free(Hash);
+    Hash = NULL;
+    HashSize = 0;
+    EntUsed = 0;
+    DirUsed = 0;
+
+    for (i = 0; i < DIRINDEX_HASH_MIN; i++) {
+        for (watch = Watches[i]; watch != NULL; watch = wnext) {
+            wnext = watch->next;
+            free(watch->path);
+            free(watch);
+        }
+        Watches[i] = NULL;
+    }
+
+    return;
+}
+
+/*
+ * Walk directory path (already in the index) by nthread threads, and
+ * put the names found. Returns errno of a failed watch, or 0.
+ */
+static int
+index_walk(const char *path, int nthread)
+{
+    int i, n, err;
+    struct walk_ctx ctx;
+    struct walk_arg args[DIRINDEX_THREADS];
+    struct walk_job *job;
+    struct dirindex_ent *ent, *next, **put;
+    struct dirindex_watch *watch, *wnext;
+#ifdef DIRINDEX_PTHREAD
+    pthread_t tids[DIRINDEX_THREADS];
+#endif
+
+    job = (struct walk_job *)malloc(sizeof(struct walk_job));
+    if (job == NULL) return ENOMEM;
+    job->path = strdup(path);
+    if (job->path == NULL) {
+        free(job);
+        return ENOMEM;
+    }
+    job->next = NULL;
+    ctx.queue = job;
+    ctx.busy = 0;
+    memset(args, 0, sizeof(args));
+    for (i = 0; i < nthread; i++) args[i].ctx = &ctx;
+
+#ifdef DIRINDEX_PTHREAD
+    pthread_mutex_init(&ctx.lock, NULL);
+    pthread_cond_init(&ctx.cond, NULL);
+    for (i = 1; i < nthread; i++) {
+        if (pthread_create(&tids[i], NULL, walk_thread, &args[i]) != 0) {
+            P_WARNING("pthread_create() failed.\n");
+            break;
+        }
+    }
+    nthread = i;
+    walk_thread(&args[0]);
+    for (i = 1; i < nthread; i++) pthread_join(tids[i], NULL);
+    pthread_cond_destroy(&ctx.cond);
+    pthread_mutex_destroy(&ctx.lock);
+#else
+    nthread = 1;
+    walk_thread(&args[0]);
+#endif
+
+    /* merge results of threads */
+    for (i = 0, n = 0; i < nthread; i++) {
+        for (ent = args[i].out.ents; ent != NULL; ent = ent->hnext) n++;
+    }
+    put = (struct dirindex_ent **)malloc((n + 1) * sizeof(*put));
+    err = (put == NULL) ? ENOMEM : 0;
+    for (i = 0, n = 0; i < nthread; i++) {
+        for (ent = args[i].out.ents; ent != NULL; ent = next) {
+            next = ent->hnext;
+            ent = ent_put(ent, 1);
+            if (put != NULL && ent != NULL) put[n++] = ent;
+        }
+        for (watch = args[i].out.watches; watch != NULL; watch = wnext) {
+            wnext = watch->next;
+            watch_put(watch);
+        }
+        if (args[i].out.err != 0) err = args[i].out.err;
+    }
+    /* names put before their directory */
+    if (put != NULL) {
+        for (i = 0; i < n; i++) ent_link(put[i]);
+        free(put);
+    }
+
+    return err;
+}
+
+static void *
+walk_thread(void *arg)
+{
+    struct walk_arg *wa;
+    struct walk_ctx *ctx;
+    struct walk_job *job, *subdirs;
+
+    wa = (struct walk_arg *)arg;
+    ctx = wa->ctx;
+    for (;;) {
+        WALK_LOCK(ctx);
+        while (ctx->queue == NULL && ctx->busy > 0) WALK_WAIT(ctx);
+        if (ctx->queue == NULL) {
+            /* nothing to read, and nobody will find more. */
+            WALK_UNLOCK(ctx);
+            break;
+        }
+        job = ctx->queue;
+        ctx->queue = job->next;
+        ctx->busy++;
+        WALK_UNLOCK(ctx);
+
+        subdirs = NULL;
+        walk_dir(job->path, &wa->out, &subdirs);
+        free(job->path);
+        free(job);
+
+        WALK_LOCK(ctx);
+        while (subdirs != NULL) {
+            job = subdirs;
+            subdirs = job->next;
+            job->next = ctx->queue;
+            ctx->queue = job;
+        }
+        ctx->busy--;
+        WALK_BROADCAST(ctx);
+        WALK_UNLOCK(ctx);
+    }
+
+    return NULL;
+}
+
+/* watch, then read one directory. subdirectories go to subdirs. */
+static void
+walk_dir(const char *path, struct walk_out *out, struct walk_job **subdirs)
+{
+#ifdef DIRINDEX_INOTIFY
+    int wd, dfd, link;
+    DIR *dir;
+    struct dirent *de;
+    struct stat st;
+    struct dirindex_ent *ent;
+    struct dirindex_watch *watch;
+    struct walk_job *job;
+    const char *dname;
+
+    dname = (path[0] == '\0') ? "." : path;
+
+    /* watch first, names made while reading are told by events. */
+    wd = inotify_add_watch(NotifyFd, dname, DIRINDEX_EVMASK);
+    if (wd < 0) {
+        if (errno != ENOENT) out->err = errno;
+        return;
+    }
+    watch = (struct dirindex_watch *)malloc(sizeof(struct dirindex_watch));
+    if (watch == NULL || (watch->path = strdup(path)) == NULL) {
+        free(watch);
+        out->err = ENOMEM;
+        return;
+    }
+    watch->wd = wd;
+    watch->next = out->watches;
+    out->watches = watch;
+
+    dir = opendir(dname);
+    if (dir == NULL) {
+        /* names under it are asked to the file system */
+        if (stat(dname, &st) == 0 && (ent = ent_new(path, &st)) != NULL) {
+            ent->opaque = 1;
+            ent->hnext = out->ents;
+            out->ents = ent;
+        }
+        return;
+    }
+    out->ndir++;
+    dfd = dirfd(dir);
+    while ((de = readdir(dir)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+        if (fstatat(dfd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0) continue;
+        link = S_ISLNK(st.st_mode);
+        if (link && fstatat(dfd, de->d_name, &st, 0) < 0) continue;
+
+        ent = (struct dirindex_ent *)malloc(sizeof(struct dirindex_ent));
+        if (ent == NULL) {
+            out->err = ENOMEM;
+            break;
+        }
+        ent->path = path_join(path, de->d_name);
+        if (ent->path == NULL) {
+            free(ent);
+            out->err = ENOMEM;
+            break;
+        }
+        ent->hash = path_hash(ent->path);
+        ent->mode = st.st_mode;
+        ent->size = st.st_size;
+        ent->mtime = st.st_mtime;
+        ent->dev = st.st_dev;
+        ent->ino = st.st_ino;
+        ent->opaque = (link && S_ISDIR(st.st_mode));
+        ent->parent = NULL;
+        ent->child = NULL;
+        ent->snext = NULL;
+        ent->sprev = NULL;
+        ent->hnext = out->ents;
+        out->ents = ent;
+
+        if (S_ISDIR(st.st_mode) && link == 0) {
+            job = (struct walk_job *)malloc(sizeof(struct walk_job));
+            if (job == NULL) {
+                out->err = ENOMEM;
+                break;
+            }
+            job->path = strdup(ent->path);
+            if (job->path == NULL) {
+                free(job);
+                out->err = ENOMEM;
+                break;
+            }
+            job->next = *subdirs;
+            *subdirs = job;
+        }
+    }
+    closedir(dir);
+#endif
+
+    return;
+}
+
+static struct dirindex_watch *
+watch_find(int wd)
+{
+    struct dirindex_watch *watch;
+
+    for (watch = Watches[(unsigned int)wd % DIRINDEX_HASH_MIN];
+         watch != NULL; watch = watch->next) {
+        if (watch->wd == wd) return watch;
+    }
+
+    return NULL;
+}
+
+/* same directory watched again has same wd. path may be new. */
+static void
+watch_put(struct dirindex_watch *watch)
+{
+    struct dirindex_watch *old;
+
+    old = watch_find(watch->wd);
+    if (old != NULL) {
+        free(old->path);
+        old->path = watch->path;
+        free(watch);
+        return;
+    }
+    watch->next = Watches[(unsigned int)watch->wd % DIRINDEX_HASH_MIN];
+    Watches[(unsigned int)watch->wd % DIRINDEX_HASH_MIN] = watch;
+
+    return;
+}
+
+/* stop watching path and directories under it (removed or moved out). */
+static void
+watch_del_tree(const char *path)
+{
+    unsigned int i;
+    size_t len;
+    struct dirindex_watch **walk, *watch;
+
+    len = strlen(path);
+    for (i = 0; i < DIRINDEX_HASH_MIN; i++) {
+        walk = &Watches[i];
+        while (*walk != NULL) {
+            watch = *walk;
+            if (strncmp(watch->path, path, len) == 0 &&
+                (watch->path[len] == '\0' || watch->path[len] == '/')) {
+                *walk = watch->next;
+#ifdef DIRINDEX_INOTIFY
+                inotify_rm_watch(NotifyFd, watch->wd);
+#endif
+                free(watch->path);
+                free(watch);
+            } else {
+                walk = &watch->next;
+            }
+        }
+    }
+
+    return;
+}
+
+/* apply changes told by inotify. */
+static void
+notify_drain(void)
+{
+#ifdef DIRINDEX_INOTIFY
+    union {
+        struct inotify_event ev;    /* for alignment */
+        char buf[DIRINDEX_EVBUF];
+    } u;
+    int rebuild, i, nmod;
+    ssize_t nread;
+    char *walk, *path;
+    char *mod[DIRINDEX_MODIFY_MAX]; /* names written, stat()ed once */
+    struct inotify_event *ev;
+    struct dirindex_watch *watch;
+
+    rebuild = 0;
+    nmod = 0;
+    for (;;) {
+        nread = read(NotifyFd, u.buf, sizeof(u.buf));
+        if (nread <= 0) break;
+        for (walk = u.buf; walk < u.buf + nread;
+             walk += sizeof(struct inotify_event) + ev->len) {
+            ev = (struct inotify_event *)walk;
+            EventCounter++;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                rebuild = 1;
+                continue;
+            }
+            if (rebuild) continue;
+            watch = watch_find(ev->wd);
+            if (watch == NULL) continue;
+            if (ev->mask & IN_IGNORED) {
+                /* the directory is gone, its entry is dropped by parent */
+                watch_del_tree(watch->path);
+                continue;
+            }
+            if (ev->len == 0 || ev->name[0] == '\0') continue;
+
+            path = path_join(watch->path, ev->name);
+            if (path == NULL) {
+                rebuild = 1;
+                continue;
+            }
+            P_DEBUG("event 0x%x on \"%s\".\n", ev->mask, path);
+            if (ev->mask == IN_MODIFY) {
+                /* a writer makes one per write(), refreshed at the end */
+                for (i = 0; i < nmod; i++) {
+                    if (strcmp(mod[i], path) == 0) break;
+                }
+                if (i < nmod) {
+                    free(path);
+                    continue;
+                }
+                if (nmod == DIRINDEX_MODIFY_MAX) {
+                    for (i = 0; i < nmod; i++) {
+                        ent_refresh(mod[i], 0);
+                        free(mod[i]);
+                    }
+                    nmod = 0;
+                }
+                mod[nmod++] = path;
+                continue;
+            }
+            if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                ent_del_tree(path);
+            } else {
+                ent_refresh(path, ev->mask & (IN_CREATE | IN_MOVED_TO));
+            }
+            free(path);
+        }
+    }
+
+    /* size and mtime after the last write() seen */
+    for (i = 0; i < nmod; i++) {
+        if (rebuild == 0) ent_refresh(mod[i], 0);
+        free(mod[i]);
+    }
+
+    if (rebuild) {
+        /* events are lost, walk whole tree again. */
+        P_WARNING("inotify queue overflow. Rebuilding directory index.\n");
+        RebuildCounter++;
+        dirindex_build(Rooted);
+    }
+#endif
+
+    return;
+}
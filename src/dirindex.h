@@ -0,0 +1,92 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __DIRINDEX_H__
+#define __DIRINDEX_H__
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+int dirindex_build(int rooted);
+int dirindex_stat(const char *fname, struct stat *st);
+void dirindex_report(void);
+
+enum dirindex_params {
+    DIRINDEX_HASH_MIN = 1024,   /* initial number of hash buckets */
+    DIRINDEX_THREADS = 8,       /* max threads walking the tree */
+    DIRINDEX_EVBUF = 16384,     /* bytes of inotify events read at a time */
+    DIRINDEX_MODIFY_MAX = 64,   /* names written, coalesced per drain */
+};
+
+/*
+ * NOTE:
+ *
+ * - Directory index (-i)
+ *     The root is walked at startup and every name under it is kept
+ *   in a hash table with type, size, mtime and inode, so a request
+ *   is checked by dirindex_stat() without stat(). A name not in the
+ *   table whose directory is in the table doesn't exist. The walk
+ *   runs in up to DIRINDEX_THREADS threads (one per CPU) if pthreads
+ *   is available, and the time taken is reported.
+ *     Every directory is watched by inotify from before it is read,
+ *   so nothing made during the walk is missed. Events are read
+ *   (without blocking) before each lookup: new or changed names are
+ *   stat()ed again, removed ones are dropped with everything under
+ *   them, and new directories are walked. If the event queue
+ *   overflows, the index is built again.
+ *     Writes (IN_MODIFY) are seen too, so truncate() by name or a
+ *   writer keeping its descriptor open doesn't leave old size and
+ *   mtime in the index (content.h trusts them). A writer makes an
+ *   event per write(), so they are coalesced: a name written is
+ *   stat()ed once after all events read at a time, for up to
+ *   DIRINDEX_MODIFY_MAX names.
+ *     Names through a symbolic link to a directory, names with "."
+ *   or ".." components, and absolute names when not chroot()ed are
+ *   not answered (dirindex_stat() returns -1), and go to the file
+ *   system as before. Changes of link targets outside the root are
+ *   not seen. If a directory can't be watched (see
+ *   /proc/sys/fs/inotify/max_user_watches), the index is not used.
+ */
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* __DIRINDEX_H__ */
@@ -0,0 +1,233 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#if HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "task.h"
+#include "dupreq.h"
+#include "util.h"
+#include "debug.h"
+
+#ifndef DEBUG_DUPREQ
+#  undef P_DEBUG
+#  define P_DEBUG(fmt...) /* null */
+#endif
+
+struct dupreq_ent {
+    struct sockaddr_storage addr;   /* client address and port */
+    socklen_t addrlen;
+    char *fname;                    /* file requested */
+    unsigned int hash;
+    struct timeval stamp;           /* time of the 1st request */
+    TASK *task;                     /* session serving the request */
+    struct dupreq_ent *hnext;       /* hash chain */
+    struct dupreq_ent **hprev;      /* link pointing to this entry */
+};
+
+/*
+ * file scope variables
+ */
+static struct dupreq_ent *DupHash[DUPREQ_HASH];
+static int DupUsed = 0;
+
+static unsigned int AddCounter = 0;
+static unsigned int DupCounter = 0;
+static unsigned int ExpireCounter = 0;
+
+/* forward declarations of private functions */
+static unsigned int req_hash(struct sockaddr *caddr, socklen_t addrlen,
+                             const char *fname);
+static void ent_free(struct dupreq_ent *ent);
+
+/*
+ * Exported functions
+ */
+int
+dupreq_init(void)
+{
+    memset(DupHash, 0, sizeof(DupHash));
+    DupUsed = 0;
+
+    return 1;
+}
+
+/*
+ * Session serving the same request, or NULL if the request is new.
+ */
+TASK *
+dupreq_lookup(struct sockaddr *caddr, socklen_t addrlen, const char *fname)
+{
+    unsigned int h;
+    long age;
+    struct timeval now;
+    struct dupreq_ent *ent;
+
+    h = req_hash(caddr, addrlen, fname);
+    for (ent = DupHash[h % DUPREQ_HASH]; ent != NULL; ent = ent->hnext) {
+        if (ent->hash != h || ent->addrlen != addrlen ||
+            memcmp(&ent->addr, caddr, addrlen) != 0 ||
+            strcmp(ent->fname, fname) != 0) continue;
+
+        gettimeofday(&now, NULL);
+        age = (now.tv_sec - ent->stamp.tv_sec) * 1000 +
+              (now.tv_usec - ent->stamp.tv_usec) / 1000;
+        if (age >= DUPREQ_TTL) {
+            /* too old to be a resent request */
+            ent_free(ent);
+            ExpireCounter++;
+            return NULL;
+        }
+        DupCounter++;
+        P_DEBUG("Task %d: duplicate request (%ld [ms] later).\n",
+                task_get_id(ent->task), age);
+        return ent->task;
+    }
+
+    return NULL;
+}
+
+/*
+ * Remember the request served by task. Removed by dupreq_del().
+ */
+int
+dupreq_add(TASK *task, struct sockaddr *caddr, socklen_t addrlen,
+           const char *fname)
+{
+    struct dupreq_ent *ent, **head;
+
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+    if (task_get_dupreq(task) != NULL) return 0;
+    if (caddr == NULL || addrlen > sizeof(ent->addr)) return 0;
+
+    ent = (struct dupreq_ent *)safe_malloc(sizeof(struct dupreq_ent));
+    if (ent == NULL) {
+        P_WARNING("safe_malloc() failed.\n");
+        return 0;
+    }
+    ent->fname = (char *)safe_malloc(strlen(fname) + 1);
+    if (ent->fname == NULL) {
+        P_WARNING("safe_malloc() failed.\n");
+        safe_free(ent);
+        return 0;
+    }
+    strcpy(ent->fname, fname);
+    memcpy(&ent->addr, caddr, addrlen);
+    ent->addrlen = addrlen;
+    ent->hash = req_hash(caddr, addrlen, fname);
+    gettimeofday(&ent->stamp, NULL);
+    ent->task = task;
+    head = &DupHash[ent->hash % DUPREQ_HASH];
+    ent->hnext = *head;
+    ent->hprev = head;
+    if (*head != NULL) (*head)->hprev = &ent->hnext;
+    *head = ent;
+    task_set_dupreq(task, ent);
+    DupUsed++;
+    AddCounter++;
+
+    return 1;
+}
+
+/*
+ * Forget the request of the task. Called when the task ends.
+ */
+void
+dupreq_del(TASK *task)
+{
+    struct dupreq_ent *ent;
+
+    ent = (struct dupreq_ent *)task_get_dupreq(task);
+    if (ent != NULL) ent_free(ent);
+
+    return;
+}
+
+void
+dupreq_report(void)
+{
+    P_INFO("--- duplicate request statics ---\n");
+    P_INFO(" Entry    Counter = %d\n", DupUsed);
+    P_INFO(" Add      Counter = %d\n", AddCounter);
+    P_INFO(" Dup      Counter = %d\n", DupCounter);
+    P_INFO(" Expire   Counter = %d\n", ExpireCounter);
+
+    return;
+}
+
+/*
+ * Private functions
+ */
+static unsigned int
+req_hash(struct sockaddr *caddr, socklen_t addrlen, const char *fname)
+{
+    unsigned int h;
+    socklen_t i;
+    const u_int8_t *p;
+
+    h = 0;
+    for (i = 0, p = (const u_int8_t *)caddr; i < addrlen; i++)
+        h = h * 31 + p[i];
+    for (p = (const u_int8_t *)fname; *p != '\0'; p++)
+        h = h * 31 + *p;
+
+    return h;
+}
+
+/* unlink from the chain and from the task */
+static void
+ent_free(struct dupreq_ent *ent)
+{
+    *ent->hprev = ent->hnext;
+    if (ent->hnext != NULL) ent->hnext->hprev = ent->hprev;
+    task_set_dupreq(ent->task, NULL);
+    safe_free(ent->fname);
+    safe_free(ent);
+    DupUsed--;
+
+    return;
+}
@@ -0,0 +1,83 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __DUPREQ_H__
+#define __DUPREQ_H__
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "task.h"
+
+int dupreq_init(void);
+TASK *dupreq_lookup(struct sockaddr *caddr, socklen_t addrlen,
+                    const char *fname);
+int dupreq_add(TASK *task, struct sockaddr *caddr, socklen_t addrlen,
+               const char *fname);
+void dupreq_del(TASK *task);
+void dupreq_report(void);
+
+enum dupreq_params {
+    DUPREQ_HASH = 64,       /* number of hash buckets */
+    DUPREQ_TTL = 5000,      /* [ms] request is duplicate within this */
+};
+
+/*
+ * NOTE:
+ *
+ * - Duplicate request
+ *     A client resends RRQ when the first DATA (or OACK) is late.
+ *   Requests are remembered by client address, port and file name
+ *   while the session lives, up to DUPREQ_TTL. Same request again
+ *   doesn't make a new session: if the first block is not acked yet,
+ *   the session sends it once more (as a retransmit, no RTT sample),
+ *   otherwise the request is dropped. A request after DUPREQ_TTL, or
+ *   after the session ended, is a new one.
+ *     The task keeps its entry (task_get_dupreq()), so the entry is
+ *   unlinked without a search when the task ends. A file of one
+ *   window is already filled (TASK_TYPE_CWAIT) when its 1st block is
+ *   sent, and is resent in the same way.
+ */
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* __DUPREQ_H__ */
@@ -0,0 +1,438 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * fec_test: check x-fec parity rebuilds lost blocks (see proto_tftp.h).
+ *
+ *   usage: fec_test [-p port] [-b blksize] [-w window] [-k group]
+ *                   [-s seed] file reference
+ *
+ * Reads file from the server on the loopback address with windowsize
+ * and x-fec. Packets pass a shim which drops one DATA block of every
+ * parity group on its first transmission. Every lost block must be
+ * rebuilt from PARITY without being resent, and the result must be
+ * the same as reference (the file under the root of the server).
+ */
+#if HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "proto_tftp.h"
+#include "test_client.h"
+
+enum fec_test_params {
+    FT_TIMEOUT = 1,             /* seconds to wait for a packet */
+    FT_RETRY = 5,               /* timeouts in a row before giving up */
+    FT_PKTMAX = 65536,          /* max packet received */
+};
+
+static int option(int ch, const char *arg);
+static int request(const char *file, size_t blksize, unsigned int window,
+                   unsigned int group);
+static int oack_input(const u_int8_t *pkt, ssize_t len);
+static ssize_t shim_recv(u_int8_t *pkt, size_t size);
+static void data_input(const u_int8_t *pkt, ssize_t len);
+static void parity_input(const u_int8_t *pkt, ssize_t len);
+
+static int Sock;
+static struct sockaddr_in Server;   /* transfer ID once OACK is received */
+static int TidSet = 0;
+static size_t Blksize;
+static unsigned int Window, Group;
+static u_int32_t Nblock;            /* blocks the reference makes */
+static u_int32_t Last = 0;          /* last (short) block, 0 if unknown */
+static u_int8_t *Buf;               /* blocks received, Blksize each */
+static size_t *Len;                 /* length of block */
+static char *Have;                  /* block is received or rebuilt */
+static char *Dropped;               /* block is dropped by the shim */
+static unsigned int *Victim;        /* block of the group to drop */
+
+static unsigned int DropCounter = 0;
+static unsigned int RebuildCounter = 0;
+static unsigned int ResentCounter = 0;
+static unsigned int ParityCounter = 0;
+
+int
+main(int argc, char *argv[])
+{
+    int timeouts;
+    u_int16_t opcode;
+    u_int32_t done, lastack, g, n;
+    size_t size;
+    ssize_t len;
+    u_int8_t *ref, *pkt;
+    struct test_args args;
+
+    Window = 16;
+    Group = 4;
+    srandom(1);
+    if (test_getopt(argc, argv, "w:k:s:", "[-w window] [-k group] [-s seed]",
+                    option, &args) == 0) {
+        return 1;
+    }
+    Blksize = args.blksize;
+    ref = test_load(args.ref, &size);
+    if (ref == NULL) return 1;
+
+    Sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (Sock < 0) {
+        perror("socket()");
+        return 1;
+    }
+    memset(&Server, 0, sizeof(Server));
+    Server.sin_family = AF_INET;
+    Server.sin_port = htons(args.port);
+    Server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (request(args.file, Blksize, Window, Group) == 0) return 1;
+
+    /* blksize and group may be negotiated down */
+    pkt = (u_int8_t *)malloc(FT_PKTMAX);
+    if (pkt == NULL) {
+        fprintf(stderr, "malloc() failed.\n");
+        return 1;
+    }
+    for (timeouts = 0; TidSet == 0; ) {
+        len = shim_recv(pkt, FT_PKTMAX);
+        if (len < 0) {
+            if (++timeouts > FT_RETRY) {
+                fprintf(stderr, "no answer from the server.\n");
+                return 1;
+            }
+            request(args.file, Blksize, Window, Group);
+            continue;
+        }
+        if (oack_input(pkt, len) == 0) return 1;
+    }
+
+    Nblock = test_nblock(size, Blksize);
+    if (Nblock == 0) return 1;
+    Buf = (u_int8_t *)calloc(Nblock, Blksize);
+    Len = (size_t *)calloc(Nblock + 1, sizeof(size_t));
+    Have = (char *)calloc(Nblock + 1, 1);
+    Dropped = (char *)calloc(Nblock + 1, 1);
+    Victim = (unsigned int *)calloc(Nblock / Group + 1, sizeof(unsigned int));
+    if (Buf == NULL || Len == NULL || Have == NULL || Dropped == NULL ||
+        Victim == NULL) {
+        fprintf(stderr, "calloc() failed.\n");
+        return 1;
+    }
+    for (g = 0; g * Group < Nblock; g++) {
+        /* the last group may be shorter */
+        n = (Nblock - g * Group < Group) ? Nblock - g * Group : Group;
+        Victim[g] = g * Group + 1 + random() % n;
+    }
+
+    /* ack a window at once, a gap holds the ack until it is rebuilt */
+    test_ack(Sock, &Server, 0);
+    done = lastack = 0;
+    timeouts = 0;
+    while (Last == 0 || done < Last) {
+        len = shim_recv(pkt, FT_PKTMAX);
+        if (len < 0) {
+            if (++timeouts > FT_RETRY) {
+                fprintf(stderr, "transfer stalled at block %lu.\n",
+                        (unsigned long)done);
+                return 1;
+            }
+            test_ack(Sock, &Server, (u_int16_t)done);
+            lastack = done;
+            continue;
+        }
+        if (len < (ssize_t)TFTP_HDLEN) continue; /* dropped */
+        timeouts = 0;
+        memcpy(&opcode, pkt, sizeof(opcode));
+        switch (ntohs(opcode)) {
+            case TFTP_DATA:
+                data_input(pkt, len);
+                break;
+            case TFTP_PARITY:
+                parity_input(pkt, len);
+                break;
+            case TFTP_ERROR:
+                fprintf(stderr, "error from the server: %s\n",
+                        (char *)pkt + TFTP_HDLEN + TFTP_ERR_HDLEN);
+                return 1;
+            default:
+                break;
+        }
+        while (done < Nblock && Have[done + 1]) done++;
+        if (done - lastack >= Window || (Last != 0 && done == Last)) {
+            test_ack(Sock, &Server, (u_int16_t)done);
+            lastack = done;
+        }
+    }
+
+    printf("blocks %lu, dropped %u, rebuilt %u, resent %u, parity %u\n",
+           (unsigned long)Last, DropCounter, RebuildCounter, ResentCounter,
+           ParityCounter);
+    if ((Last - 1) * Blksize + Len[Last] != size ||
+        memcmp(Buf, ref, size) != 0) {
+        fprintf(stderr, "file differs from the reference.\n");
+        return 1;
+    }
+    if (DropCounter == 0 || RebuildCounter != DropCounter ||
+        ResentCounter != 0) {
+        fprintf(stderr, "lost blocks are not rebuilt by parity.\n");
+        return 1;
+    }
+    printf("check: ok\n");
+
+    return 0;
+}
+
+/* options of fec_test (see test_client.h) */
+static int
+option(int ch, const char *arg)
+{
+    switch (ch) {
+        case 'w': Window = (unsigned int)atoi(arg); return Window > 0;
+        case 'k': Group = (unsigned int)atoi(arg); return Group > 0;
+        case 's': srandom((unsigned int)atoi(arg)); return 1;
+        default: return 0;
+    }
+}
+
+/* RRQ with windowsize and x-fec (and blksize, if not 512). */
+static int
+request(const char *file, size_t blksize, unsigned int window,
+        unsigned int group)
+{
+    char wstr[16], gstr[16], bstr[16];
+    const char *opts[7];
+    int n;
+
+    snprintf(wstr, sizeof(wstr), "%u", window);
+    snprintf(gstr, sizeof(gstr), "%u", group);
+    snprintf(bstr, sizeof(bstr), "%lu", (unsigned long)blksize);
+    n = 0;
+    opts[n++] = "windowsize";
+    opts[n++] = wstr;
+    opts[n++] = "x-fec";
+    opts[n++] = gstr;
+    if (blksize != TFTP_DATA_MAX_SIZE) {
+        opts[n++] = "blksize";
+        opts[n++] = bstr;
+    }
+    opts[n] = NULL;
+
+    return test_rrq(Sock, &Server, file, opts);
+}
+
+/* take options the server acknowledged. x-fec must be there. */
+static int
+oack_input(const u_int8_t *pkt, ssize_t len)
+{
+    u_int16_t opcode;
+    const char *name, *value, *end;
+    int fec = 0;
+
+    memcpy(&opcode, pkt, sizeof(opcode));
+    if (ntohs(opcode) == TFTP_ERROR) {
+        fprintf(stderr, "error from the server: %s\n",
+                (char *)pkt + TFTP_HDLEN + TFTP_ERR_HDLEN);
+        return 0;
+    }
+    if (ntohs(opcode) != TFTP_OACK) {
+        fprintf(stderr, "x-fec not acknowledged (opcode %d).\n",
+                ntohs(opcode));
+        return 0;
+    }
+
+    end = (const char *)pkt + len;
+    for (name = (const char *)pkt + TFTP_HDLEN; name < end;
+         name = value + strlen(value) + 1) {
+        value = name + strlen(name) + 1;
+        if (value >= end) break;
+        if (strcasecmp(name, "blksize") == 0) {
+            Blksize = (size_t)atol(value);
+        } else if (strcasecmp(name, "windowsize") == 0) {
+            Window = (unsigned int)atoi(value);
+        } else if (strcasecmp(name, "x-fec") == 0) {
+            Group = (unsigned int)atoi(value);
+            fec = 1;
+        }
+    }
+    if (fec == 0 || Group == 0) {
+        fprintf(stderr, "x-fec not acknowledged.\n");
+        return 0;
+    }
+    /* groups must not cross the ack of a window */
+    if (Window % Group != 0) {
+        fprintf(stderr, "window %u is not a multiple of group %u.\n",
+                Window, Group);
+        return 0;
+    }
+    printf("blksize %lu, window %u, group %u\n", (unsigned long)Blksize,
+           Window, Group);
+
+    return 1;
+}
+
+/*
+ * Loss injecting shim between the socket and the client. Returns
+ * length of the packet, 0 if it is dropped (or not from the server),
+ * or -1 on timeout.
+ */
+static ssize_t
+shim_recv(u_int8_t *pkt, size_t size)
+{
+    ssize_t len;
+    u_int16_t opcode, blockn;
+    fd_set fds;
+    struct timeval tv;
+    struct sockaddr_in from;
+    socklen_t fromlen;
+
+    FD_ZERO(&fds);
+    FD_SET(Sock, &fds);
+    tv.tv_sec = FT_TIMEOUT;
+    tv.tv_usec = 0;
+    if (select(Sock + 1, &fds, NULL, NULL, &tv) <= 0) return -1;
+
+    fromlen = sizeof(from);
+    len = recvfrom(Sock, pkt, size, 0, (struct sockaddr *)&from, &fromlen);
+    if (len < (ssize_t)TFTP_HDLEN) return 0;
+    if (TidSet == 0) {
+        Server.sin_port = from.sin_port;
+        TidSet = 1;
+        return len;
+    }
+    if (from.sin_port != Server.sin_port) return 0;
+
+    memcpy(&opcode, pkt, sizeof(opcode));
+    if (ntohs(opcode) != TFTP_DATA ||
+        len < (ssize_t)(TFTP_HDLEN + TFTP_DATA_HDLEN)) return len;
+    memcpy(&blockn, pkt + TFTP_HDLEN, sizeof(blockn));
+    blockn = ntohs(blockn);
+    if (blockn == 0 || blockn > Nblock || Dropped[blockn]) return len;
+    if (Victim[(blockn - 1) / Group] != blockn) return len;
+
+    Dropped[blockn] = 1;
+    DropCounter++;
+
+    return 0;
+}
+
+static void
+data_input(const u_int8_t *pkt, ssize_t len)
+{
+    u_int16_t blockn;
+    size_t n;
+
+    if (len < (ssize_t)(TFTP_HDLEN + TFTP_DATA_HDLEN)) return;
+    memcpy(&blockn, pkt + TFTP_HDLEN, sizeof(blockn));
+    blockn = ntohs(blockn);
+    n = len - TFTP_HDLEN - TFTP_DATA_HDLEN;
+    if (blockn == 0 || blockn > Nblock || n > Blksize) return;
+
+    if (Dropped[blockn]) ResentCounter++;
+    if (Have[blockn]) return;
+    memcpy(Buf + (size_t)(blockn - 1) * Blksize,
+           pkt + TFTP_HDLEN + TFTP_DATA_HDLEN, n);
+    Len[blockn] = n;
+    Have[blockn] = 1;
+    if (n < Blksize) Last = blockn;
+
+    return;
+}
+
+/* rebuild the block lost in the group, if only one is. */
+static void
+parity_input(const u_int8_t *pkt, ssize_t len)
+{
+    u_int16_t first, count, lenxor;
+    u_int32_t blockn, lost;
+    size_t n, i, plen;
+    int nlost;
+    const u_int8_t *data;
+    u_int8_t *dst;
+
+    if (len < (ssize_t)(TFTP_HDLEN + TFTP_PARITY_HDLEN)) return;
+    ParityCounter++;
+    memcpy(&first, pkt + TFTP_HDLEN, sizeof(first));
+    memcpy(&count, pkt + TFTP_HDLEN + 2, sizeof(count));
+    memcpy(&lenxor, pkt + TFTP_HDLEN + 4, sizeof(lenxor));
+    first = ntohs(first);
+    count = ntohs(count);
+    lenxor = ntohs(lenxor);
+    data = pkt + TFTP_HDLEN + TFTP_PARITY_HDLEN;
+    plen = len - TFTP_HDLEN - TFTP_PARITY_HDLEN;
+    if (first == 0 || count == 0 || first + count - 1 > Nblock ||
+        plen > Blksize) return;
+
+    nlost = 0;
+    lost = 0;
+    for (blockn = first; blockn < (u_int32_t)first + count; blockn++) {
+        if (Have[blockn] == 0) {
+            nlost++;
+            lost = blockn;
+        }
+    }
+    if (nlost != 1) return; /* nothing to do, or left to retransmit */
+
+    dst = Buf + (size_t)(lost - 1) * Blksize;
+    memcpy(dst, data, plen);
+    n = lenxor;
+    for (blockn = first; blockn < (u_int32_t)first + count; blockn++) {
+        if (blockn == lost) continue;
+        for (i = 0; i < Len[blockn]; i++)
+            dst[i] ^= Buf[(size_t)(blockn - 1) * Blksize + i];
+        n ^= Len[blockn];
+    }
+    if (n > plen) {
+        fprintf(stderr, "broken parity of block %u-%u.\n",
+                first, first + count - 1);
+        return;
+    }
+    Len[lost] = n;
+    Have[lost] = 1;
+    if (n < Blksize) Last = lost;
+    RebuildCounter++;
+
+    return;
+}
@@ -52,6 +52,25 @@ extern "C" {
 GLOBAL char *TFTP_Address;
 GLOBAL char *TFTP_Port;
 
+/* Default retransmit parameters (per session values are in TASK) */
+GLOBAL long TFTP_Retrans_Init;  /* initial retrans interval [us] */
+GLOBAL int TFTP_Retrans_Max;    /* max retransmit packet */
+GLOBAL long TFTP_Rto_Min;       /* lower bound of adaptive interval [us] */
+GLOBAL long TFTP_Rto_Max;       /* upper bound of adaptive interval [us] */
+
+/* Default block number after 65535 (0 or 1), -1 to disable rollover */
+GLOBAL int TFTP_Rollover;
+
+/* Multicast group address (NULL to disable) and port of 1st group */
+GLOBAL char *TFTP_Mcast_Addr;
+GLOBAL int TFTP_Mcast_Port;
+
+/* Write request (upload) is allowed if not 0 */
+GLOBAL int TFTP_Write;
+
+/* Files are sent from mmap()ed images if not 0 (see stream.h) */
+GLOBAL int TFTP_Mmap;
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -0,0 +1,191 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#if HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE /* struct ucred */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "handoff.h"
+#include "content.h"
+#include "warm.h"
+#include "util.h"
+#include "debug.h"
+
+#ifndef DEBUG_HANDOFF
+#  undef P_DEBUG
+#  define P_DEBUG(fmt...) /* null */
+#endif
+
+/*
+ * file scope variables
+ */
+static int ListenFd = -1;
+
+/* forward declarations of private functions */
+static int peer_ok(int sock);
+
+/*
+ * Exported functions
+ */
+/*
+ * Take over the cache of the server listening on path, if any, then
+ * listen there. MUST be called before the portal task is created.
+ */
+int
+handoff_init(const char *path)
+{
+    int sock, nadopt;
+    char c;
+    long msec;
+    struct sockaddr_un sun;
+    struct timeval start, now;
+
+    if (path == NULL) return 1;
+    if (strlen(path) >= sizeof(sun.sun_path)) {
+        P_ERROR("Handoff socket path too long: %s.\n", path);
+        return 0;
+    }
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, path);
+
+    sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        P_ERROR("socket() failed: %s.\n", strerror(errno));
+        return 0;
+    }
+    if (connect(sock, (struct sockaddr *)&sun, sizeof(sun)) == 0) {
+        P_INFO("Taking over cache from the running server...\n");
+        gettimeofday(&start, NULL);
+        nadopt = content_import(sock);
+        /* closed when the old one exits */
+        while (recv(sock, &c, sizeof(c), 0) > 0)
+            continue;
+        gettimeofday(&now, NULL);
+        msec = (now.tv_sec - start.tv_sec) * 1000 +
+               (now.tv_usec - start.tv_usec) / 1000;
+        P_INFO("%d cached files taken over in %ld [ms].\n", nadopt, msec);
+    } else {
+        P_DEBUG("No server on %s: %s.\n", path, strerror(errno));
+    }
+    close(sock);
+
+    unlink(path);
+    ListenFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (ListenFd < 0) {
+        P_ERROR("socket() failed: %s.\n", strerror(errno));
+        return 0;
+    }
+    if (bind(ListenFd, (struct sockaddr *)&sun, sizeof(sun)) < 0 ||
+        chmod(path, S_IRUSR | S_IWUSR) < 0 || listen(ListenFd, 1) < 0) {
+        P_ERROR("Can't listen on %s: %s.\n", path, strerror(errno));
+        close(ListenFd);
+        ListenFd = -1;
+        return 0;
+    }
+
+    return 1;
+}
+
+/* descriptor to be select()ed, or -1 */
+int
+handoff_fd(void)
+{
+    return ListenFd;
+}
+
+/*
+ * New server connected. Send the cache and exit, never returns unless
+ * the peer is refused.
+ */
+void
+handoff_accept(void)
+{
+    int sock, nsent;
+
+    sock = accept(ListenFd, NULL, NULL);
+    if (sock < 0) {
+        P_WARNING("accept() failed: %s.\n", strerror(errno));
+        return;
+    }
+    if (peer_ok(sock) == 0) {
+        P_WARNING("Handoff refused.\n");
+        close(sock);
+        return;
+    }
+
+    P_INFO("Handing off cache to the new server...\n");
+    warm_save();
+    nsent = content_export(sock);
+    P_INFO("%d cached files handed off. exitting..\n", nsent);
+    content_report();
+    /* UDP sockets (opened before sock) are closed first. */
+    exit(0);
+}
+
+/*
+ * Private functions
+ */
+static int
+peer_ok(int sock)
+{
+    struct ucred cred;
+    socklen_t len;
+
+    len = sizeof(cred);
+    if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) {
+        P_WARNING("getsockopt(SO_PEERCRED) failed: %s.\n", strerror(errno));
+        return 0;
+    }
+
+    return (cred.uid == 0 || cred.uid == geteuid());
+}
@@ -0,0 +1,472 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#if HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "pkt_buff.h"
+#include "task.h"
+#include "mcast.h"
+#include "proto_tftp.h"
+#include "util.h"
+#include "debug.h"
+
+#include "globals.h"
+
+#ifndef DEBUG_MCAST
+#  undef P_DEBUG
+#  define P_DEBUG(fmt...) /* null */
+#endif
+
+struct mcast_member {
+    struct sockaddr_in addr;        /* unicast address of the client */
+    unsigned int opts;              /* options to be acknowledged */
+    int done;                       /* 1 after being master, or left */
+};
+
+struct mcast_group {
+    TASK *task;                     /* task of the group, NULL if unused */
+    char *fname;                    /* file name requested */
+    size_t blksize;                 /* block size of the group */
+    struct sockaddr_in gaddr;       /* multicast address and port */
+    struct mcast_member *members;   /* MCAST_MEMBER_MAX entries */
+    int nmember;                    /* number of members joined */
+    int master;                     /* index of master, -1 if none */
+    int handoff;                    /* 1 while master's 1st ACK not seen */
+};
+
+/*
+ * file scope variables
+ */
+static struct mcast_group GroupTable[MCAST_GROUP_MAX];
+static int GroupUsed = 0;
+
+static unsigned int GroupCounter = 0;
+static unsigned int JoinCounter = 0;
+static unsigned int MasterCounter = 0;
+static unsigned int DropCounter = 0;
+static unsigned int FullCounter = 0;
+
+/* forward declarations of private functions */
+static struct mcast_group *grp_lookup(TASK *task);
+static struct mcast_group *grp_create(const char *fname, size_t blksize,
+                                      struct sockaddr *laddr,
+                                      socklen_t addrlen);
+static int member_lookup(struct mcast_group *grp, struct sockaddr *caddr);
+static int oack_send(struct mcast_group *grp, int idx);
+
+/*
+ * Exported functions
+ */
+int
+mcast_init(void)
+{
+    memset(GroupTable, 0, sizeof(GroupTable));
+    GroupUsed = 0;
+
+    return 1;
+}
+
+/*
+ * Move the client of task into the group of the file. The group is
+ * created if not found. task is not used after this, the caller
+ * closes it.
+ */
+int
+mcast_join(TASK *task, const char *fname, struct sockaddr *laddr,
+           socklen_t addrlen)
+{
+    int i, idx;
+    struct sockaddr *caddr;
+    struct mcast_group *grp;
+    struct mcast_member *mem;
+
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+    caddr = task_get_caddr(task);
+    if (caddr == NULL || caddr->sa_family != AF_INET) {
+        P_WARNING("Task %d: multicast is IPv4 only.\n", task_get_id(task));
+        return 0;
+    }
+
+    /* find the group of the file */
+    grp = NULL;
+    for (i = 0; i < MCAST_GROUP_MAX; i++) {
+        if (GroupTable[i].task != NULL &&
+            GroupTable[i].blksize == task_get_blksize(task) &&
+            strcmp(GroupTable[i].fname, fname) == 0) {
+            grp = &GroupTable[i];
+            break;
+        }
+    }
+    if (grp == NULL) {
+        grp = grp_create(fname, task_get_blksize(task), laddr, addrlen);
+        if (grp == NULL) return 0;
+    }
+
+    idx = member_lookup(grp, caddr);
+    if (idx < 0) {
+        if (grp->nmember >= MCAST_MEMBER_MAX) {
+            P_INFO("Task %d: multicast group is full.\n",
+                   task_get_id(grp->task));
+            FullCounter++;
+            return 0;
+        }
+        idx = grp->nmember++;
+        JoinCounter++;
+    }
+    /* request again (OACK lost?) is same as new one. */
+    mem = &grp->members[idx];
+    memcpy(&mem->addr, caddr, sizeof(mem->addr));
+    mem->opts = task_get_opts(task) & (TFTP_OPTF_BLKSIZE | TFTP_OPTF_TSIZE);
+    mem->done = 0;
+    P_INFO("Task %d: client %s joined multicast group %s:%d.\n",
+           task_get_id(grp->task),
+           strsockaddr(caddr, sizeof(struct sockaddr_in)),
+           strin_addr(&grp->gaddr.sin_addr), ntohs(grp->gaddr.sin_port));
+
+    if (grp->master < 0) {
+        /* 1st member (or all left), transfer starts by its ACK. */
+        grp->master = idx;
+        grp->handoff = 1;
+        MasterCounter++;
+        task_set_state(grp->task, TASK_ST_SEND);
+        oack_send(grp, idx);
+        task_set_state(grp->task, TASK_ST_WACK);
+        return 1;
+    }
+
+    return oack_send(grp, idx);
+}
+
+/* free the group of task. called by task_join(). */
+int
+mcast_leave(TASK *task)
+{
+    struct mcast_group *grp;
+
+    grp = grp_lookup(task);
+    if (grp == NULL) return 0;
+
+    P_DEBUG("Task %d: multicast group closed.\n", task_get_id(task));
+    safe_free(grp->fname);
+    safe_free(grp->members);
+    memset(grp, 0, sizeof(*grp));
+    GroupUsed--;
+
+    return 1;
+}
+
+int
+mcast_is_group(TASK *task)
+{
+    return grp_lookup(task) != NULL;
+}
+
+int
+mcast_is_master(TASK *task, struct sockaddr *caddr)
+{
+    struct mcast_group *grp;
+
+    grp = grp_lookup(task);
+    if (grp == NULL || grp->master < 0) return 0;
+
+    return member_lookup(grp, caddr) == grp->master;
+}
+
+int
+mcast_get_handoff(TASK *task)
+{
+    struct mcast_group *grp;
+
+    grp = grp_lookup(task);
+    if (grp == NULL) return 0;
+
+    return grp->handoff;
+}
+
+int
+mcast_set_handoff(TASK *task, int handoff)
+{
+    struct mcast_group *grp;
+
+    grp = grp_lookup(task);
+    if (grp == NULL) return 0;
+    grp->handoff = handoff;
+
+    return 1;
+}
+
+/*
+ * Current master is done (has whole file, or timed out). Pick the next
+ * member as master. Returns 0 if no member is left.
+ */
+int
+mcast_next(TASK *task)
+{
+    int i, idx;
+    struct mcast_group *grp;
+
+    grp = grp_lookup(task);
+    if (grp == NULL) return 0;
+
+    if (grp->master >= 0) grp->members[grp->master].done = 1;
+
+    /* next one in order of join */
+    for (i = 1; i <= grp->nmember; i++) {
+        idx = (grp->master + i) % grp->nmember;
+        if (grp->members[idx].done == 0) break;
+    }
+    if (grp->nmember == 0 || i > grp->nmember) {
+        grp->master = -1;
+        return 0;
+    }
+
+    grp->master = idx;
+    grp->handoff = 1;
+    MasterCounter++;
+    P_INFO("Task %d: client %s is new master.\n", task_get_id(task),
+           strsockaddr((struct sockaddr *)&grp->members[idx].addr,
+                       sizeof(struct sockaddr_in)));
+
+    return 1;
+}
+
+/* client left the group by ERROR, or didn't answer. */
+int
+mcast_drop(TASK *task, struct sockaddr *caddr)
+{
+    int idx;
+    struct mcast_group *grp;
+
+    grp = grp_lookup(task);
+    if (grp == NULL) return 0;
+
+    idx = member_lookup(grp, caddr);
+    if (idx < 0) return 0;
+    grp->members[idx].done = 1;
+    DropCounter++;
+
+    return 1;
+}
+
+/* send OACK (mc=1) to master */
+int
+mcast_oack(TASK *task)
+{
+    struct mcast_group *grp;
+
+    grp = grp_lookup(task);
+    if (grp == NULL || grp->master < 0) return 0;
+
+    return oack_send(grp, grp->master);
+}
+
+/* set destination of packet to the group address, if task is a group */
+int
+mcast_setaddr(TASK *task, struct pkt_buff *pkb)
+{
+    struct mcast_group *grp;
+
+    grp = grp_lookup(task);
+    if (grp == NULL) return 0;
+
+    return pkb_setaddr(pkb, (struct sockaddr *)&grp->gaddr,
+                       sizeof(grp->gaddr));
+}
+
+void
+mcast_report(void)
+{
+    P_INFO("--- multicast statics ---\n");
+    P_INFO(" Entry    Counter = %d\n", GroupUsed);
+    P_INFO(" Group    Counter = %d\n", GroupCounter);
+    P_INFO(" Join     Counter = %d\n", JoinCounter);
+    P_INFO(" Master   Counter = %d\n", MasterCounter);
+    P_INFO(" Drop     Counter = %d\n", DropCounter);
+    P_INFO(" Full     Counter = %d\n", FullCounter);
+
+    return;
+}
+
+/*
+ * Private functions
+ */
+static struct mcast_group *
+grp_lookup(TASK *task)
+{
+    int i;
+
+    if (task == NULL || GroupUsed == 0) return NULL;
+    for (i = 0; i < MCAST_GROUP_MAX; i++) {
+        if (GroupTable[i].task == task) return &GroupTable[i];
+    }
+
+    return NULL;
+}
+
+static struct mcast_group *
+grp_create(const char *fname, size_t blksize, struct sockaddr *laddr,
+           socklen_t addrlen)
+{
+    int i;
+    STREAM *stream;
+    struct mcast_group *grp;
+
+    for (i = 0; i < MCAST_GROUP_MAX; i++) {
+        if (GroupTable[i].task == NULL) break;
+    }
+    if (i == MCAST_GROUP_MAX) {
+        P_INFO("Too many multicast groups.\n");
+        FullCounter++;
+        return NULL;
+    }
+    grp = &GroupTable[i];
+
+    grp->fname = (char *)safe_malloc(strlen(fname) + 1);
+    grp->members = (struct mcast_member *)
+        safe_malloc(sizeof(struct mcast_member) * MCAST_MEMBER_MAX);
+    stream = stream_open(fname, STREAM_MODE_OCTET);
+    if (grp->fname == NULL || grp->members == NULL || stream == NULL) {
+        P_WARNING("Unable to create multicast group.\n");
+        goto Error;
+    }
+    strcpy(grp->fname, fname);
+
+    /* group socket isn't connected (caddr == NULL) */
+    grp->task = task_create(TASK_TYPE_READ, laddr, NULL, addrlen);
+    if (grp->task == NULL) {
+        P_WARNING("task_create() failed.\n");
+        goto Error;
+    }
+    task_set_stream(grp->task, stream);
+    task_set_fsize(grp->task, stream_get_size(stream));
+    if (task_set_blksize(grp->task, blksize) == 0) {
+        P_WARNING("task_set_blksize() failed.\n");
+        task_join(grp->task, TASK_EXIT_ERROR); /* stream is closed here */
+        grp->task = NULL;
+        stream = NULL;
+        goto Error;
+    }
+
+    grp->blksize = blksize;
+    grp->gaddr.sin_family = AF_INET;
+    grp->gaddr.sin_addr.s_addr = inet_addr(TFTP_Mcast_Addr);
+    grp->gaddr.sin_port = htons(TFTP_Mcast_Port + i);
+    grp->nmember = 0;
+    grp->master = -1;
+    grp->handoff = 0;
+    GroupUsed++;
+    GroupCounter++;
+    P_INFO("Task %d: multicast group %s:%d created for \"%s\".\n",
+           task_get_id(grp->task), strin_addr(&grp->gaddr.sin_addr),
+           TFTP_Mcast_Port + i, fname);
+
+    return grp;
+
+Error:
+    if (stream != NULL) stream_close(stream);
+    safe_free(grp->fname);
+    safe_free(grp->members);
+    memset(grp, 0, sizeof(*grp));
+    return NULL;
+}
+
+static int
+member_lookup(struct mcast_group *grp, struct sockaddr *caddr)
+{
+    int i;
+    struct sockaddr_in *sin;
+
+    if (caddr == NULL || caddr->sa_family != AF_INET) return -1;
+    sin = (struct sockaddr_in *)caddr;
+    for (i = 0; i < grp->nmember; i++) {
+        if (grp->members[i].addr.sin_addr.s_addr == sin->sin_addr.s_addr &&
+            grp->members[i].addr.sin_port == sin->sin_port)
+            return i;
+    }
+
+    return -1;
+}
+
+/* RFC2090 Page 3: OACK tells "addr,port,mc" of the group */
+static int
+oack_send(struct mcast_group *grp, int idx)
+{
+    int len;
+    char oack[MCAST_OACK_MAX];
+    struct mcast_member *mem;
+    struct pkt_buff *pkb;
+    struct tftp_pkt *tpkt;
+
+    mem = &grp->members[idx];
+    tpkt = (struct tftp_pkt *)oack;
+    tpkt->Opcode = htons(TFTP_OACK);
+    len = TFTP_HDLEN + TFTP_OACK_HDLEN;
+    len += snprintf(oack + len, sizeof(oack) - len, "multicast%c%s,%d,%d",
+                    '\0', inet_ntoa(grp->gaddr.sin_addr),
+                    ntohs(grp->gaddr.sin_port), idx == grp->master) + 1;
+    if (mem->opts & TFTP_OPTF_BLKSIZE) {
+        len += snprintf(oack + len, sizeof(oack) - len, "blksize%c%lu",
+                        '\0', (unsigned long)grp->blksize) + 1;
+    }
+    if (mem->opts & TFTP_OPTF_TSIZE) {
+        len += snprintf(oack + len, sizeof(oack) - len, "tsize%c%lld",
+                        '\0', (long long)task_get_fsize(grp->task)) + 1;
+    }
+
+    pkb = pkb_alloc(len);
+    if (pkb == NULL) {
+        P_WARNING("pkb_alloc() failed.\n");
+        return 0;
+    }
+    memcpy(pkb->payload, oack, len);
+    pkb_setaddr(pkb, (struct sockaddr *)&mem->addr, sizeof(mem->addr));
+
+    return tftp_output(task_get_sockfd(grp->task), pkb);
+}
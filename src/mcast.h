@@ -0,0 +1,101 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __MCAST_H__
+#define __MCAST_H__
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "pkt_buff.h"
+#include "task.h"
+
+int mcast_init(void);
+int mcast_join(TASK *task, const char *fname, struct sockaddr *laddr,
+               socklen_t addrlen);
+int mcast_leave(TASK *task);
+int mcast_is_group(TASK *task);
+int mcast_is_master(TASK *task, struct sockaddr *caddr);
+int mcast_get_handoff(TASK *task);
+int mcast_set_handoff(TASK *task, int handoff);
+int mcast_next(TASK *task);
+int mcast_drop(TASK *task, struct sockaddr *caddr);
+int mcast_oack(TASK *task);
+int mcast_setaddr(TASK *task, struct pkt_buff *pkb);
+void mcast_report(void);
+
+enum mcast_params {
+    MCAST_GROUP_MAX = 8,        /* number of groups at a time */
+    MCAST_MEMBER_MAX = 512,     /* number of clients in a group */
+    MCAST_PORT = 1758,          /* default port of 1st group */
+    MCAST_TTL = 1,              /* multicast TTL */
+    MCAST_OACK_MAX = 128,       /* max length of OACK to members */
+};
+
+/*
+ * NOTE:
+ *
+ * - Multicast option (RFC2090)
+ *     Multicast is enabled by -g (group address) and -G (port). A read
+ *   request with "multicast" option joins the group of the same file
+ *   and blksize, or creates a new one. Each group has its own socket
+ *   (not connected) and sends DATA to the multicast address, port
+ *   TFTP_Mcast_Port + index of the group.
+ *     One member is the master client (mc=1 in OACK) and only its ACKs
+ *   move the transfer. Others (mc=0) receive what is sent to the
+ *   group. When the master has the whole file, or doesn't answer, the
+ *   next member is made master by OACK, and its first ACK tells the
+ *   last block it has, the group continues from there. The group ends
+ *   when every member has been master.
+ *     The transfer of a group is lock-step, so windowsize and x-fec
+ *   are not acknowledged with multicast.
+ *     mcast_test ("make mcast_test") runs a master and listeners
+ *   joining late on the loopback address, and checks every one of
+ *   them is made master and gets the blocks it missed.
+ *
+ * [References]
+ *   RFC2090 TFTP Multicast Option
+ */
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* __MCAST_H__ */
@@ -0,0 +1,418 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * mcast_test: check master handoff and gap fill of RFC2090 multicast
+ * (see mcast.h).
+ *
+ *   usage: mcast_test [-p port] [-b blksize] [-n listeners]
+ *                     [-i interval] [-d delay] file reference
+ *
+ * Starts a master client and then n listeners on the loopback
+ * address, one every interval [ms], as processes of their own. Each
+ * requests file with "multicast", receives the group on 127.0.0.1
+ * and acks (after delay [us]) only while it is the master. Listeners
+ * joining late miss the first blocks, and must get them when they
+ * are made master. Every client must be master once and end with
+ * the same bytes as reference, and at least one listener must have
+ * missed blocks. The server is run with -g (group address).
+ */
+#if HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "proto_tftp.h"
+#include "test_client.h"
+
+enum mcast_test_params {
+    MT_TIMEOUT = 1,             /* seconds to wait for a packet */
+    MT_IDLE = 30,               /* timeouts in a row before giving up */
+    MT_PKTMAX = 65536,          /* max packet received */
+    MT_LISTENER_MAX = 64,       /* max listeners */
+};
+
+/* exit status of a client */
+enum mcast_test_status {
+    MT_OK = 0,                  /* has the file, missed nothing */
+    MT_FAIL = 1,
+    MT_FILLED = 2,              /* has the file, missed blocks filled */
+};
+
+static int option(int ch, const char *arg);
+static int client(int id, const char *file, int port, size_t blksize,
+                  long delay);
+static int request(const char *file, int port, size_t blksize);
+static int oack_input(const u_int8_t *pkt, ssize_t len);
+static int group_join(struct in_addr addr, int port);
+static u_int16_t data_input(const u_int8_t *pkt, ssize_t len);
+static u_int32_t contig(void);
+
+/* state of a client (each one is a process) */
+static int Sock = -1;               /* unicast, to the server */
+static int Group = -1;              /* bound to the group address */
+static struct sockaddr_in Server;   /* group task, once OACK is received */
+static int Master = 0;              /* 1 while mc=1 */
+static int Nmaster = 0;             /* times made master */
+static size_t Blksize;
+static u_int32_t Nblock;            /* blocks the reference makes */
+static u_int32_t Last = 0;          /* last (short) block, 0 if unknown */
+static u_int32_t First = 0;         /* 1st block seen from the group */
+static u_int8_t *Ref, *Buf;         /* reference, and blocks received */
+static size_t RefSize;
+static size_t *Len;                 /* length of block */
+static char *Have;                  /* block is received */
+static int Nlistener = 3;
+static int Interval = 50;           /* [ms] */
+static long Delay = 1000;           /* [us] */
+
+int
+main(int argc, char *argv[])
+{
+    int i, status, failed, filled;
+    pid_t pid[MT_LISTENER_MAX + 1];
+    struct test_args args;
+
+    if (test_getopt(argc, argv, "n:i:d:",
+                    "[-n listeners] [-i interval] [-d delay]",
+                    option, &args) == 0) {
+        return 1;
+    }
+    Blksize = args.blksize;
+    Ref = test_load(args.ref, &RefSize);
+    if (Ref == NULL) return 1;
+    Nblock = test_nblock(RefSize, Blksize);
+    if (Nblock == 0) return 1;
+
+    /* master first, then listeners */
+    for (i = 0; i <= Nlistener; i++) {
+        if (i > 0) usleep(Interval * 1000);
+        fflush(stdout);
+        pid[i] = fork();
+        if (pid[i] < 0) {
+            perror("fork()");
+            return 1;
+        }
+        if (pid[i] == 0)
+            exit(client(i, args.file, args.port, Blksize, Delay));
+    }
+
+    failed = filled = 0;
+    for (i = 0; i <= Nlistener; i++) {
+        if (waitpid(pid[i], &status, 0) < 0 || !WIFEXITED(status) ||
+            WEXITSTATUS(status) == MT_FAIL) {
+            failed++;
+        } else if (WEXITSTATUS(status) == MT_FILLED) {
+            filled++;
+        }
+    }
+    if (failed > 0) {
+        fprintf(stderr, "%d of %d clients failed.\n", failed,
+                Nlistener + 1);
+        return 1;
+    }
+    if (filled == 0) {
+        fprintf(stderr, "no client missed blocks, gap fill is not checked "
+                "(larger file or delay?).\n");
+        return 1;
+    }
+    printf("check: ok\n");
+
+    return 0;
+}
+
+/* options of mcast_test (see test_client.h) */
+static int
+option(int ch, const char *arg)
+{
+    switch (ch) {
+        case 'n':
+            Nlistener = atoi(arg);
+            return Nlistener >= 1 && Nlistener <= MT_LISTENER_MAX;
+        case 'i': Interval = atoi(arg); return Interval >= 0;
+        case 'd': Delay = atol(arg); return Delay >= 0;
+        default: return 0;
+    }
+}
+
+/* one client. returns exit status (enum mcast_test_status). */
+static int
+client(int id, const char *file, int port, size_t blksize, long delay)
+{
+    int timeouts, nfds, acked;
+    ssize_t len;
+    u_int16_t opcode, blockn;
+    u_int8_t *pkt;
+    fd_set fds;
+    struct timeval tv;
+    struct sockaddr_in from;
+    socklen_t fromlen;
+
+    pkt = (u_int8_t *)malloc(MT_PKTMAX);
+    Buf = (u_int8_t *)calloc(Nblock, Blksize);
+    Len = (size_t *)calloc(Nblock + 1, sizeof(size_t));
+    Have = (char *)calloc(Nblock + 1, 1);
+    if (pkt == NULL || Buf == NULL || Len == NULL || Have == NULL) {
+        fprintf(stderr, "client %d: calloc() failed.\n", id);
+        return MT_FAIL;
+    }
+    if (request(file, port, blksize) == 0) return MT_FAIL;
+
+    /* done when the file is complete and acked as master */
+    acked = 0;
+    for (timeouts = 0; acked == 0 || Last == 0 || contig() != Last; ) {
+        FD_ZERO(&fds);
+        FD_SET(Sock, &fds);
+        nfds = Sock;
+        if (Group >= 0) {
+            FD_SET(Group, &fds);
+            if (Group > nfds) nfds = Group;
+        }
+        tv.tv_sec = MT_TIMEOUT;
+        tv.tv_usec = 0;
+        if (select(nfds + 1, &fds, NULL, NULL, &tv) <= 0) {
+            if (++timeouts > MT_IDLE) {
+                fprintf(stderr, "client %d: stalled at block %lu.\n", id,
+                        (unsigned long)contig());
+                return MT_FAIL;
+            }
+            if (Server.sin_port == 0) request(file, port, blksize);
+            continue;
+        }
+        timeouts = 0;
+
+        if (Group >= 0 && FD_ISSET(Group, &fds)) {
+            len = recv(Group, pkt, MT_PKTMAX, 0);
+            blockn = data_input(pkt, len);
+            if (Master && blockn > 0) {
+                /* lock-step. a block beyond a gap acks the gap */
+                if (delay > 0) usleep(delay);
+                test_ack(Sock, &Server,
+                         blockn <= contig() ? blockn : (u_int16_t)contig());
+                if (Last != 0 && blockn == Last && contig() == Last)
+                    acked = 1;
+            }
+        }
+        if (FD_ISSET(Sock, &fds)) {
+            fromlen = sizeof(from);
+            len = recvfrom(Sock, pkt, MT_PKTMAX, 0,
+                           (struct sockaddr *)&from, &fromlen);
+            if (len < (ssize_t)TFTP_HDLEN) continue;
+            memcpy(&opcode, pkt, sizeof(opcode));
+            if (ntohs(opcode) == TFTP_ERROR) {
+                fprintf(stderr, "client %d: error from the server: %s\n",
+                        id, (char *)pkt + TFTP_HDLEN + TFTP_ERR_HDLEN);
+                return MT_FAIL;
+            }
+            if (ntohs(opcode) != TFTP_OACK) continue;
+            Server = from;
+            if (oack_input(pkt, len) == 0) return MT_FAIL;
+            if (Master) {
+                /* 1st ACK of master tells the last block it has */
+                test_ack(Sock, &Server, (u_int16_t)contig());
+                if (Last != 0 && contig() == Last) acked = 1;
+            }
+        }
+    }
+
+    if ((Last - 1) * Blksize + Len[Last] != RefSize ||
+        memcmp(Buf, Ref, RefSize) != 0) {
+        fprintf(stderr, "client %d: file differs from the reference.\n", id);
+        return MT_FAIL;
+    }
+    if (Nmaster == 0) {
+        fprintf(stderr, "client %d: never made master.\n", id);
+        return MT_FAIL;
+    }
+    printf("client %d: ok, master %d time(s), %lu blocks missed at join\n",
+           id, Nmaster, (unsigned long)(First > 0 ? First - 1 : 0));
+
+    return (First > 1) ? MT_FILLED : MT_OK;
+}
+
+/* RRQ with multicast and blksize */
+static int
+request(const char *file, int port, size_t blksize)
+{
+    char bstr[16];
+    const char *opts[5];
+    struct sockaddr_in sin;
+
+    if (Sock < 0) {
+        Sock = socket(AF_INET, SOCK_DGRAM, 0);
+        if (Sock < 0) {
+            perror("socket()");
+            return 0;
+        }
+    }
+    snprintf(bstr, sizeof(bstr), "%lu", (unsigned long)blksize);
+    opts[0] = "multicast";
+    opts[1] = "";
+    opts[2] = "blksize";
+    opts[3] = bstr;
+    opts[4] = NULL;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    return test_rrq(Sock, &sin, file, opts);
+}
+
+/* RFC2090: "multicast" is "addr,port,mc". join the group once. */
+static int
+oack_input(const u_int8_t *pkt, ssize_t len)
+{
+    const char *name, *value, *end;
+    char addr[32];
+    int gport, mc;
+    struct in_addr in;
+
+    mc = -1;
+    end = (const char *)pkt + len;
+    for (name = (const char *)pkt + TFTP_HDLEN; name < end;
+         name = value + strlen(value) + 1) {
+        value = name + strlen(name) + 1;
+        if (value >= end) break;
+        if (strcasecmp(name, "blksize") == 0 &&
+            (size_t)atol(value) != Blksize) {
+            fprintf(stderr, "blksize %s is acknowledged, not %lu.\n", value,
+                    (unsigned long)Blksize);
+            return 0;
+        }
+        if (strcasecmp(name, "multicast") == 0 &&
+            sscanf(value, "%31[^,],%d,%d", addr, &gport, &mc) != 3) {
+            fprintf(stderr, "broken multicast option \"%s\".\n", value);
+            return 0;
+        }
+    }
+    if (mc < 0) {
+        fprintf(stderr, "multicast not acknowledged (server without -g?).\n");
+        return 0;
+    }
+    if (Group < 0) {
+        if (inet_aton(addr, &in) == 0 || group_join(in, gport) == 0)
+            return 0;
+    }
+    Master = (mc == 1);
+    if (Master) Nmaster++;
+
+    return 1;
+}
+
+/* receive the group on the loopback interface */
+static int
+group_join(struct in_addr addr, int port)
+{
+    int on = 1;
+    struct sockaddr_in sin;
+    struct ip_mreq mreq;
+
+    Group = socket(AF_INET, SOCK_DGRAM, 0);
+    if (Group < 0) {
+        perror("socket()");
+        return 0;
+    }
+    /* every client of the host binds the same port */
+    setsockopt(Group, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr = addr;
+    if (bind(Group, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+        perror("bind()");
+        return 0;
+    }
+    mreq.imr_multiaddr = addr;
+    mreq.imr_interface.s_addr = htonl(INADDR_LOOPBACK);
+    if (setsockopt(Group, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq,
+                   sizeof(mreq)) < 0) {
+        perror("IP_ADD_MEMBERSHIP");
+        return 0;
+    }
+
+    return 1;
+}
+
+/* DATA from the group. returns the block number, or 0 if not DATA */
+static u_int16_t
+data_input(const u_int8_t *pkt, ssize_t len)
+{
+    u_int16_t opcode, blockn;
+    size_t n;
+
+    if (len < (ssize_t)(TFTP_HDLEN + TFTP_DATA_HDLEN)) return 0;
+    memcpy(&opcode, pkt, sizeof(opcode));
+    if (ntohs(opcode) != TFTP_DATA) return 0;
+    memcpy(&blockn, pkt + TFTP_HDLEN, sizeof(blockn));
+    blockn = ntohs(blockn);
+    n = len - TFTP_HDLEN - TFTP_DATA_HDLEN;
+    if (blockn == 0 || blockn > Nblock || n > Blksize) return 0;
+
+    if (First == 0) First = blockn;
+    if (Have[blockn]) return blockn;
+    memcpy(Buf + (size_t)(blockn - 1) * Blksize,
+           pkt + TFTP_HDLEN + TFTP_DATA_HDLEN, n);
+    Len[blockn] = n;
+    Have[blockn] = 1;
+    if (n < Blksize) Last = blockn;
+
+    return blockn;
+}
+
+/* blocks received from the 1st one without a gap */
+static u_int32_t
+contig(void)
+{
+    u_int32_t n;
+
+    for (n = 0; n < Nblock && Have[n + 1]; n++) ;
+
+    return n;
+}
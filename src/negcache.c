@@ -0,0 +1,370 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#if HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#  include <sys/inotify.h>
+#  define NEG_INOTIFY
+#endif
+
+#include "negcache.h"
+#include "util.h"
+#include "debug.h"
+
+#ifndef DEBUG_NEGCACHE
+#  undef P_DEBUG
+#  define P_DEBUG(fmt...) /* null */
+#endif
+
+#ifdef NEG_INOTIFY
+/* something may appear in the directory */
+#  define NEG_EVMASK (IN_CREATE | IN_MOVED_TO | IN_DELETE_SELF | \
+                      IN_MOVE_SELF | IN_ONLYDIR)
+#endif
+
+struct neg_ent {
+    char *fname;                    /* name not found */
+    unsigned int hash;
+    time_t expire;                  /* forgotten at this time */
+    int wd;                         /* watch of the directory, -1 if none */
+    struct neg_ent *hnext;          /* hash chain */
+    struct neg_ent *prev;           /* age list (newer) */
+    struct neg_ent *next;           /* age list (older) */
+};
+
+/*
+ * file scope variables
+ */
+static struct neg_ent *NegHash[NEG_HASH];
+static struct neg_ent *AgeHead = NULL;  /* newest */
+static struct neg_ent *AgeTail = NULL;  /* oldest */
+static int NegUsed = 0;
+static int NotifyFd = -1;
+
+static unsigned int HitCounter = 0;
+static unsigned int MissCounter = 0;
+static unsigned int AddCounter = 0;
+static unsigned int ExpireCounter = 0;
+static unsigned int FlushCounter = 0;
+static unsigned int EvictCounter = 0;
+
+/* forward declarations of private functions */
+static unsigned int name_hash(const char *fname);
+static struct neg_ent *ent_lookup(const char *fname, unsigned int hash);
+static void ent_free(struct neg_ent *ent);
+static int watch_dir(const char *fname);
+static void notify_drain(void);
+static void flush_wd(int wd);
+
+/*
+ * Exported functions
+ */
+int
+negcache_init(void)
+{
+    memset(NegHash, 0, sizeof(NegHash));
+    AgeHead = NULL;
+    AgeTail = NULL;
+    NegUsed = 0;
+
+#ifdef NEG_INOTIFY
+    NotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (NotifyFd < 0) {
+        P_WARNING("inotify_init1() failed: %s. "
+                  "Missing names are forgotten only by time.\n",
+                  strerror(errno));
+    }
+#endif
+
+    return 1;
+}
+
+/*
+ * Returns 1 if fname is known to be missing. No file system call.
+ */
+int
+negcache_lookup(const char *fname)
+{
+    struct timeval now;
+    struct neg_ent *ent;
+
+    if (NegUsed > 0) notify_drain();
+
+    ent = ent_lookup(fname, name_hash(fname));
+    if (ent != NULL) {
+        gettimeofday(&now, NULL);
+        if (now.tv_sec < ent->expire) {
+            HitCounter++;
+            return 1;
+        }
+        ent_free(ent);
+        ExpireCounter++;
+    }
+    MissCounter++;
+
+    return 0;
+}
+
+/*
+ * Remember fname is missing. Call after stat() failed with ENOENT.
+ */
+int
+negcache_add(const char *fname)
+{
+    unsigned int h;
+    struct timeval now;
+    struct neg_ent *ent;
+
+    h = name_hash(fname);
+    if (ent_lookup(fname, h) != NULL) return 1;
+    if (NegUsed >= NEG_MAX) {
+        ent_free(AgeTail);
+        EvictCounter++;
+    }
+
+    ent = (struct neg_ent *)safe_malloc(sizeof(struct neg_ent));
+    if (ent == NULL) {
+        P_WARNING("safe_malloc() failed.\n");
+        return 0;
+    }
+    ent->fname = (char *)safe_malloc(strlen(fname) + 1);
+    if (ent->fname == NULL) {
+        P_WARNING("safe_malloc() failed.\n");
+        safe_free(ent);
+        return 0;
+    }
+    strcpy(ent->fname, fname);
+    ent->hash = h;
+    gettimeofday(&now, NULL);
+    ent->expire = now.tv_sec + NEG_TTL;
+    ent->wd = watch_dir(fname);
+
+    ent->hnext = NegHash[h % NEG_HASH];
+    NegHash[h % NEG_HASH] = ent;
+    ent->prev = NULL;
+    ent->next = AgeHead;
+    if (AgeHead != NULL) AgeHead->prev = ent;
+    AgeHead = ent;
+    if (AgeTail == NULL) AgeTail = ent;
+    NegUsed++;
+    AddCounter++;
+    P_DEBUG("\"%s\" is missing. (watch %d)\n", fname, ent->wd);
+
+    return 1;
+}
+
+/*
+ * fname was made by this process (e.g. upload).
+ */
+void
+negcache_forget(const char *fname)
+{
+    struct neg_ent *ent;
+
+    ent = ent_lookup(fname, name_hash(fname));
+    if (ent != NULL) ent_free(ent);
+
+    return;
+}
+
+void
+negcache_report(void)
+{
+    unsigned int total;
+
+    total = HitCounter + MissCounter;
+    P_INFO("--- negative cache statics ---\n");
+    P_INFO(" Entry    Counter = %d\n", NegUsed);
+    P_INFO(" Hit      Counter = %d\n", HitCounter);
+    P_INFO(" Miss     Counter = %d\n", MissCounter);
+    P_INFO(" Hit      Rate    = %d%%\n",
+           total > 0 ? (int)(HitCounter * 100ULL / total) : 0);
+    P_INFO(" Add      Counter = %d\n", AddCounter);
+    P_INFO(" Expire   Counter = %d\n", ExpireCounter);
+    P_INFO(" Flush    Counter = %d\n", FlushCounter);
+    P_INFO(" Evict    Counter = %d\n", EvictCounter);
+
+    return;
+}
+
+/*
+ * Private functions
+ */
+static unsigned int
+name_hash(const char *fname)
+{
+    unsigned int h;
+    const unsigned char *p;
+
+    for (h = 0, p = (const unsigned char *)fname; *p != '\0'; p++)
+        h = h * 31 + *p;
+
+    return h;
+}
+
+static struct neg_ent *
+ent_lookup(const char *fname, unsigned int hash)
+{
+    struct neg_ent *ent;
+
+    for (ent = NegHash[hash % NEG_HASH]; ent != NULL; ent = ent->hnext) {
+        if (ent->hash == hash && strcmp(ent->fname, fname) == 0) return ent;
+    }
+
+    return NULL;
+}
+
+static void
+ent_free(struct neg_ent *ent)
+{
+    struct neg_ent **walk;
+
+    for (walk = &NegHash[ent->hash % NEG_HASH]; *walk != NULL;
+         walk = &(*walk)->hnext) {
+        if (*walk == ent) {
+            *walk = ent->hnext;
+            break;
+        }
+    }
+    if (ent->prev != NULL) ent->prev->next = ent->next;
+    else AgeHead = ent->next;
+    if (ent->next != NULL) ent->next->prev = ent->prev;
+    else AgeTail = ent->prev;
+
+    safe_free(ent->fname);
+    safe_free(ent);
+    NegUsed--;
+
+    return;
+}
+
+/* watch the deepest existing directory of fname. -1 if none. */
+static int
+watch_dir(const char *fname)
+{
+#ifdef NEG_INOTIFY
+    int wd;
+    char dir[PATH_MAX];
+    char *slash;
+
+    if (NotifyFd < 0 || strlen(fname) >= sizeof(dir)) return -1;
+    strcpy(dir, fname);
+    for (;;) {
+        slash = strrchr(dir, '/');
+        if (slash == NULL) {
+            if (strcmp(dir, ".") == 0) return -1;
+            strcpy(dir, ".");
+        } else if (slash == dir) {
+            if (dir[1] == '\0') return -1;
+            dir[1] = '\0';  /* "/" */
+        } else {
+            *slash = '\0';
+        }
+
+        wd = inotify_add_watch(NotifyFd, dir, NEG_EVMASK);
+        if (wd >= 0) return wd;
+        if (errno != ENOENT && errno != ENOTDIR) {
+            P_WARNING("inotify_add_watch() failed: %s.\n", strerror(errno));
+            return -1;
+        }
+    }
+#else
+    return -1;
+#endif
+}
+
+/* read events queued, and forget names under the directories. */
+static void
+notify_drain(void)
+{
+#ifdef NEG_INOTIFY
+    union {
+        struct inotify_event ev;    /* for alignment */
+        char buf[NEG_EVBUF];
+    } u;
+    ssize_t nread;
+    char *walk;
+    struct inotify_event *ev;
+
+    if (NotifyFd < 0) return;
+    for (;;) {
+        nread = read(NotifyFd, u.buf, sizeof(u.buf));
+        if (nread <= 0) break;
+        for (walk = u.buf; walk < u.buf + nread;
+             walk += sizeof(struct inotify_event) + ev->len) {
+            ev = (struct inotify_event *)walk;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                /* events lost. nothing can be trusted. */
+                P_DEBUG("inotify queue overflow.\n");
+                flush_wd(-1);
+            } else {
+                flush_wd(ev->wd);
+            }
+        }
+    }
+#endif
+
+    return;
+}
+
+/* forget names watched by wd. all names if wd is -1. */
+static void
+flush_wd(int wd)
+{
+    struct neg_ent *ent, *next;
+
+    for (ent = AgeHead; ent != NULL; ent = next) {
+        next = ent->next;
+        if (wd == -1 || ent->wd == wd) {
+            ent_free(ent);
+            FlushCounter++;
+        }
+    }
+
+    return;
+}
@@ -0,0 +1,80 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __NEGCACHE_H__
+#define __NEGCACHE_H__
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+int negcache_init(void);
+int negcache_lookup(const char *fname);
+int negcache_add(const char *fname);
+void negcache_forget(const char *fname);
+void negcache_report(void);
+
+enum negcache_params {
+    NEG_MAX = 4096,         /* number of names remembered */
+    NEG_HASH = 256,         /* number of hash buckets */
+    NEG_TTL = 30,           /* [s] name is forgotten after this */
+    NEG_EVBUF = 4096,       /* bytes of inotify events read at a time */
+};
+
+/*
+ * NOTE:
+ *
+ * - Negative lookup cache
+ *     PXE clients ask for many names which don't exist before the
+ *   one which does (pxelinux.cfg/01-<MAC>, hex IP prefixes, default).
+ *   A name found missing by check_filest() is remembered, and asked
+ *   again within NEG_TTL it's answered "not found" without stat().
+ *     The deepest existing directory of the name is watched by
+ *   inotify. A file or directory created or moved in, or the
+ *   directory itself removed, forgets the names under it. Events are
+ *   read (without blocking) just before each lookup, so the cache
+ *   never answers for a name made before the request. Without
+ *   inotify (or when its queue overflows) names live only NEG_TTL,
+ *   or until forgotten by uploads.
+ *     At most NEG_MAX names are remembered, the oldest one is
+ *   forgotten first.
+ */
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* __NEGCACHE_H__ */
@@ -76,6 +76,8 @@ pkb_alloc(size_t size)
         return NULL;
     }
     pkb->size = size;
+    pkb->ext = NULL;
+    pkb->extlen = 0;
     /* Don't forget memset.
        TCPv2 pp731-731:
        ... ifa_ifwithaddr does a binary comparison of the entire structure...
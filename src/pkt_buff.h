@@ -52,11 +52,12 @@ struct pkt_buff {
     socklen_t addrlen;          /* length of sockaddr structure */
     struct sockaddr *laddr;     /* sockaddr for local address */
     struct sockaddr *caddr;     /* sockaddr for client if not connect()'ed */
+    const void *ext;            /* sent after payload without copy, or NULL */
+    size_t extlen;              /* bytes of ext */
 
     u_int8_t payload[0];        /* data gram body */
 };
-#define PKB_HDLEN (sizeof(size_t) + sizeof(socklen_t) + \
-                    sizeof(struct sockaddr *))
+#define PKB_HDLEN (sizeof(struct pkt_buff))
 
 /* exported functions */
 struct pkt_buff *pkb_alloc(size_t size);
@@ -0,0 +1,572 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#if HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_LIBPTHREAD)
+#  include <pthread.h>
+#  define PREFETCH_PTHREAD
+#endif
+
+#include "prefetch.h"
+#include "content.h"
+#include "util.h"
+#include "debug.h"
+
+#ifndef DEBUG_PREFETCH
+#  undef P_DEBUG
+#  define P_DEBUG(fmt...) /* null */
+#endif
+
+/* next name of a name */
+struct prefetch_next {
+    char *fname;                    /* NULL if empty */
+    unsigned int count;
+};
+
+/* name with transitions learned */
+struct prefetch_node {
+    char *fname;
+    unsigned int hash;
+    unsigned int total;             /* transitions from this name */
+    struct prefetch_next next[PREFETCH_NEXT];
+    struct prefetch_node *hnext;    /* hash chain */
+};
+
+/* client followed */
+struct prefetch_client {
+    int family;                     /* 0 if empty */
+    u_int8_t addr[PREFETCH_ADDRLEN];
+    char *last;                     /* last name read */
+    time_t when;                    /* of last read */
+    char *predicted[PREFETCH_FANOUT];
+};
+
+enum prefetch_job_state {
+    JOB_FREE,
+    JOB_QUEUED,                     /* waiting for the worker */
+    JOB_RUNNING,                    /* read by the worker */
+    JOB_DONE,                       /* waiting for prefetch_done() */
+};
+
+/* file read by the worker */
+struct prefetch_job {
+    int state;
+    int ok;                         /* read successfully */
+    char *fname;
+    struct stat st;
+    u_int8_t *buf;                  /* st.st_size bytes */
+};
+
+/*
+ * file scope variables
+ */
+static int Learn = 0;               /* 0 if disabled */
+static int Fetch = 0;               /* 0 if predicted only (-F) */
+static struct prefetch_node *NodeHash[PREFETCH_HASH];
+static int NodeUsed = 0;
+static struct prefetch_client Clients[PREFETCH_CLIENTS];
+static struct prefetch_job Jobs[PREFETCH_QUEUE];
+static int WakeFds[2] = {-1, -1};   /* worker -> main loop */
+#ifdef PREFETCH_PTHREAD
+static pthread_mutex_t JobLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t JobCond = PTHREAD_COND_INITIALIZER;
+#endif
+
+static unsigned int TransCounter = 0;
+static unsigned int PredictCounter = 0;
+static unsigned int CorrectCounter = 0;
+static unsigned int FullCounter = 0;
+static unsigned int FetchCounter = 0;
+static unsigned long long FetchBytes = 0;
+static unsigned int CachedCounter = 0;
+static unsigned int ReadyCounter = 0;
+static unsigned int DropCounter = 0;
+static unsigned int FailCounter = 0;
+
+/* forward declarations of private functions */
+static unsigned int name_hash(const char *fname);
+static char *name_dup(const char *fname);
+static int addr_key(struct sockaddr *sa, u_int8_t addr[]);
+static struct prefetch_client *client_get(struct sockaddr *caddr);
+static struct prefetch_node *node_get(const char *fname, int add);
+static void node_learn(const char *from, const char *to);
+static int node_predict(const char *fname, struct prefetch_client *client);
+static void fetch(const char *fname);
+#ifdef PREFETCH_PTHREAD
+static void *worker(void *arg);
+#endif
+
+/*
+ * Exported functions
+ */
+/*
+ * learn: follow clients and predict (the content cache is enabled).
+ * fetch: read predicted files.
+ */
+int
+prefetch_init(int learn, int fetch)
+{
+#ifdef PREFETCH_PTHREAD
+    pthread_t tid;
+#endif
+
+    memset(NodeHash, 0, sizeof(NodeHash));
+    memset(Clients, 0, sizeof(Clients));
+    memset(Jobs, 0, sizeof(Jobs));
+    Learn = learn;
+    Fetch = 0;
+    if (Learn == 0 || fetch == 0) return 1;
+
+#ifdef PREFETCH_PTHREAD
+    if (pipe(WakeFds) < 0) {
+        P_WARNING("pipe() failed: %s. Prefetch disabled.\n", strerror(errno));
+        return 1;
+    }
+    fcntl(WakeFds[0], F_SETFL, O_NONBLOCK);
+    fcntl(WakeFds[1], F_SETFL, O_NONBLOCK);
+    fcntl(WakeFds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(WakeFds[1], F_SETFD, FD_CLOEXEC);
+    if (pthread_create(&tid, NULL, worker, NULL) != 0) {
+        P_WARNING("pthread_create() failed. Prefetch disabled.\n");
+        close(WakeFds[0]);
+        close(WakeFds[1]);
+        WakeFds[0] = WakeFds[1] = -1;
+        return 1;
+    }
+    pthread_detach(tid);
+    Fetch = 1;
+#else
+    P_WARNING("No threads. Files are predicted, but not prefetched.\n");
+#endif
+
+    return 1;
+}
+
+/* RRQ of fname (opened) from caddr. */
+void
+prefetch_request(struct sockaddr *caddr, const char *fname)
+{
+    int i;
+    time_t now;
+    struct prefetch_client *client;
+
+    if (Learn == 0) return;
+    client = client_get(caddr);
+    if (client == NULL) return;
+
+    now = time(NULL);
+    if (client->last != NULL && now - client->when <= PREFETCH_GAP) {
+        TransCounter++;
+        for (i = 0; i < PREFETCH_FANOUT; i++) {
+            if (client->predicted[i] != NULL &&
+                strcmp(client->predicted[i], fname) == 0) {
+                CorrectCounter++;
+                break;
+            }
+        }
+        node_learn(client->last, fname);
+    }
+
+    if (client->last != NULL) safe_free(client->last);
+    client->last = name_dup(fname);
+    client->when = now;
+    node_predict(fname, client);
+
+    return;
+}
+
+/* descriptor to be select()ed, or -1 */
+int
+prefetch_fd(void)
+{
+    return WakeFds[0];
+}
+
+/* worker finished reads. cache them. */
+void
+prefetch_done(void)
+{
+#ifdef PREFETCH_PTHREAD
+    int i;
+    char c[PREFETCH_QUEUE];
+    struct prefetch_job job;
+
+    while (read(WakeFds[0], c, sizeof(c)) > 0)
+        continue;
+
+    for (i = 0; i < PREFETCH_QUEUE; i++) {
+        pthread_mutex_lock(&JobLock);
+        if (Jobs[i].state != JOB_DONE) {
+            pthread_mutex_unlock(&JobLock);
+            continue;
+        }
+        job = Jobs[i];
+        Jobs[i].state = JOB_FREE;
+        pthread_mutex_unlock(&JobLock);
+
+        if (job.ok == 0) {
+            P_DEBUG("\"%s\" not prefetched.\n", job.fname);
+            safe_free(job.buf);
+            FailCounter++;
+        } else if (content_insert(job.fname, &job.st, job.buf)) {
+            P_DEBUG("\"%s\" prefetched.\n", job.fname);
+            CachedCounter++;
+        }
+        safe_free(job.fname);
+    }
+#endif
+
+    return;
+}
+
+void
+prefetch_report(void)
+{
+    if (Learn == 0) return;
+
+    P_INFO("--- prefetch statics ---\n");
+    P_INFO(" Node     Counter = %d\n", NodeUsed);
+    P_INFO(" Full     Counter = %d\n", FullCounter);
+    P_INFO(" Trans    Counter = %d\n", TransCounter);
+    P_INFO(" Predict  Counter = %d\n", PredictCounter);
+    P_INFO(" Correct  Counter = %d\n", CorrectCounter);
+    P_INFO(" Precision [%%]    = %d\n",
+           PredictCounter ? CorrectCounter * 100 / PredictCounter : 0);
+    P_INFO(" Recall [%%]       = %d\n",
+           TransCounter ? CorrectCounter * 100 / TransCounter : 0);
+    P_INFO(" Fetch    Counter = %d%s\n", FetchCounter,
+           Fetch ? "" : " (disabled)");
+    P_INFO(" Fetch    Bytes   = %llu\n", FetchBytes);
+    P_INFO(" Cached   Counter = %d\n", CachedCounter);
+    P_INFO(" Ready    Counter = %d\n", ReadyCounter);
+    P_INFO(" Drop     Counter = %d\n", DropCounter);
+    P_INFO(" Fail     Counter = %d\n", FailCounter);
+
+    return;
+}
+
+/*
+ * Private functions
+ */
+static unsigned int
+name_hash(const char *fname)
+{
+    unsigned int h;
+    const unsigned char *p;
+
+    for (h = 0, p = (const unsigned char *)fname; *p != '\0'; p++)
+        h = h * 31 + *p;
+
+    return h;
+}
+
+static char *
+name_dup(const char *fname)
+{
+    char *p;
+
+    p = (char *)safe_malloc(strlen(fname) + 1);
+    if (p != NULL) strcpy(p, fname);
+
+    return p;
+}
+
+/* same as client.c */
+static int
+addr_key(struct sockaddr *sa, u_int8_t addr[])
+{
+    memset(addr, 0, PREFETCH_ADDRLEN);
+    if (sa == NULL) return 0;
+
+    switch (sa->sa_family) {
+        case AF_INET:
+            memcpy(addr, &((struct sockaddr_in *)sa)->sin_addr,
+                   sizeof(struct in_addr));
+            break;
+#ifdef AF_INET6
+        case AF_INET6:
+            memcpy(addr, &((struct sockaddr_in6 *)sa)->sin6_addr,
+                   sizeof(struct in6_addr));
+            break;
+#endif
+        default:
+            return 0;
+    }
+
+    return sa->sa_family;
+}
+
+/* client of caddr. the least recently seen one is reused if full. */
+static struct prefetch_client *
+client_get(struct sockaddr *caddr)
+{
+    int i, family;
+    u_int8_t addr[PREFETCH_ADDRLEN];
+    struct prefetch_client *client, *lru;
+
+    family = addr_key(caddr, addr);
+    if (family == 0) return NULL;
+
+    lru = NULL;
+    for (i = 0; i < PREFETCH_CLIENTS; i++) {
+        client = &Clients[i];
+        if (client->family == family &&
+            memcmp(client->addr, addr, PREFETCH_ADDRLEN) == 0)
+            return client;
+        if (lru == NULL || client->family == 0 ||
+            (lru->family != 0 && client->when < lru->when))
+            lru = client;
+    }
+
+    if (lru->last != NULL) safe_free(lru->last);
+    for (i = 0; i < PREFETCH_FANOUT; i++) {
+        if (lru->predicted[i] != NULL) safe_free(lru->predicted[i]);
+    }
+    memset(lru, 0, sizeof(*lru));
+    lru->family = family;
+    memcpy(lru->addr, addr, PREFETCH_ADDRLEN);
+
+    return lru;
+}
+
+/* node of fname, added if add and not full. */
+static struct prefetch_node *
+node_get(const char *fname, int add)
+{
+    unsigned int h;
+    struct prefetch_node *node;
+
+    h = name_hash(fname);
+    for (node = NodeHash[h % PREFETCH_HASH]; node != NULL;
+         node = node->hnext) {
+        if (node->hash == h && strcmp(node->fname, fname) == 0) return node;
+    }
+    if (add == 0) return NULL;
+    if (NodeUsed >= PREFETCH_NODES) {
+        FullCounter++;
+        return NULL;
+    }
+
+    node = (struct prefetch_node *)safe_malloc(sizeof(struct prefetch_node));
+    if (node == NULL) return NULL;
+    memset(node, 0, sizeof(*node));
+    node->fname = name_dup(fname);
+    if (node->fname == NULL) {
+        safe_free(node);
+        return NULL;
+    }
+    node->hash = h;
+    node->hnext = NodeHash[h % PREFETCH_HASH];
+    NodeHash[h % PREFETCH_HASH] = node;
+    NodeUsed++;
+
+    return node;
+}
+
+/* count transition from -> to. */
+static void
+node_learn(const char *from, const char *to)
+{
+    int i;
+    struct prefetch_next *next, *min;
+    struct prefetch_node *node;
+
+    node = node_get(from, 1);
+    if (node == NULL) return;
+    node->total++;
+
+    min = NULL;
+    for (i = 0; i < PREFETCH_NEXT; i++) {
+        next = &node->next[i];
+        if (next->fname != NULL && strcmp(next->fname, to) == 0) {
+            next->count++;
+            return;
+        }
+        if (min == NULL || next->count < min->count) min = next;
+    }
+
+    /* new one replaces the least counted */
+    if (min->fname != NULL) safe_free(min->fname);
+    min->fname = name_dup(to);
+    min->count = (min->fname != NULL);
+
+    return;
+}
+
+/* predict (and fetch) next names of fname for client. */
+static int
+node_predict(const char *fname, struct prefetch_client *client)
+{
+    int i, j, n;
+    struct prefetch_next *best;
+    struct prefetch_node *node;
+    int taken[PREFETCH_NEXT];
+
+    for (i = 0; i < PREFETCH_FANOUT; i++) {
+        if (client->predicted[i] != NULL) safe_free(client->predicted[i]);
+        client->predicted[i] = NULL;
+    }
+    node = node_get(fname, 0);
+    if (node == NULL) return 0;
+
+    memset(taken, 0, sizeof(taken));
+    for (n = 0; n < PREFETCH_FANOUT; n++) {
+        best = NULL;
+        for (i = 0, j = -1; i < PREFETCH_NEXT; i++) {
+            if (taken[i] || node->next[i].fname == NULL ||
+                node->next[i].count < PREFETCH_MIN_COUNT ||
+                node->next[i].count * 100 < node->total * PREFETCH_MIN_PROB)
+                continue;
+            if (best == NULL || node->next[i].count > best->count) {
+                best = &node->next[i];
+                j = i;
+            }
+        }
+        if (best == NULL) break;
+        taken[j] = 1;
+        client->predicted[n] = name_dup(best->fname);
+        PredictCounter++;
+        if (Fetch) fetch(best->fname);
+    }
+
+    return n;
+}
+
+/* queue read of fname unless cached or being read. */
+static void
+fetch(const char *fname)
+{
+#ifdef PREFETCH_PTHREAD
+    int i;
+    struct stat st;
+    struct prefetch_job *job;
+
+    job = NULL;
+    pthread_mutex_lock(&JobLock);
+    for (i = 0; i < PREFETCH_QUEUE; i++) {
+        if (Jobs[i].state == JOB_FREE) {
+            if (job == NULL) job = &Jobs[i];
+        } else if (strcmp(Jobs[i].fname, fname) == 0) {
+            pthread_mutex_unlock(&JobLock);
+            return;
+        }
+    }
+    pthread_mutex_unlock(&JobLock);
+
+    if (content_want(fname, &st) == 0) {
+        ReadyCounter++;
+        return;
+    }
+    if (job == NULL) {
+        DropCounter++;
+        return;
+    }
+
+    /* only main loop allocates, see util.c */
+    job->fname = name_dup(fname);
+    job->buf = (u_int8_t *)safe_malloc(st.st_size);
+    if (job->fname == NULL || job->buf == NULL) {
+        if (job->fname != NULL) safe_free(job->fname);
+        if (job->buf != NULL) safe_free(job->buf);
+        return;
+    }
+    job->st = st;
+    job->ok = 0;
+    FetchCounter++;
+    FetchBytes += st.st_size;
+
+    pthread_mutex_lock(&JobLock);
+    job->state = JOB_QUEUED;
+    pthread_cond_signal(&JobCond);
+    pthread_mutex_unlock(&JobLock);
+#endif
+
+    return;
+}
+
+#ifdef PREFETCH_PTHREAD
+/* reads queued files. */
+static void *
+worker(void *arg)
+{
+    int i, ok;
+    struct prefetch_job *job;
+
+    for (;;) {
+        pthread_mutex_lock(&JobLock);
+        for (;;) {
+            for (i = 0, job = NULL; i < PREFETCH_QUEUE; i++) {
+                if (Jobs[i].state == JOB_QUEUED) {
+                    job = &Jobs[i];
+                    break;
+                }
+            }
+            if (job != NULL) break;
+            pthread_cond_wait(&JobCond, &JobLock);
+        }
+        job->state = JOB_RUNNING;
+        pthread_mutex_unlock(&JobLock);
+
+        /* job is not touched by main loop while running */
+        ok = content_load(job->fname, &job->st, job->buf);
+
+        pthread_mutex_lock(&JobLock);
+        job->ok = ok;
+        job->state = JOB_DONE;
+        pthread_mutex_unlock(&JobLock);
+        /* nothing lost if the pipe is full, main loop is woken */
+        (void)write(WakeFds[1], "", 1);
+    }
+
+    return NULL;
+}
+#endif
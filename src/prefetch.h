@@ -0,0 +1,93 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __PREFETCH_H__
+#define __PREFETCH_H__
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+int prefetch_init(int learn, int fetch);
+void prefetch_request(struct sockaddr *caddr, const char *fname);
+int prefetch_fd(void);
+void prefetch_done(void);
+void prefetch_report(void);
+
+enum prefetch_params {
+    PREFETCH_NODES = 1024,  /* names with transitions learned */
+    PREFETCH_HASH = 256,    /* number of hash buckets */
+    PREFETCH_NEXT = 4,      /* next names remembered per name */
+    PREFETCH_FANOUT = 2,    /* max names predicted per request */
+    PREFETCH_MIN_COUNT = 2, /* transitions seen before predicted */
+    PREFETCH_MIN_PROB = 30, /* [%] of transitions from the name */
+    PREFETCH_CLIENTS = 256, /* clients followed */
+    PREFETCH_ADDRLEN = 16,  /* length of address (enough for IPv6) */
+    PREFETCH_GAP = 30,      /* [s] longer pause starts a new sequence */
+    PREFETCH_QUEUE = 4,     /* files read at a time */
+};
+
+/*
+ * NOTE:
+ *
+ * - Predictive prefetch (-c, disabled by -F)
+ *     A PXE client asks for files in a fixed order (pxelinux.0,
+ *   ldlinux.c32, pxelinux.cfg/..., kernel, initrd). For each client
+ *   (by address) the last name read is kept, and a read of the next
+ *   name within PREFETCH_GAP counts a transition between the two.
+ *   For each name, up to PREFETCH_NEXT next names are counted; a new
+ *   one replaces the least counted.
+ *     On an RRQ, the next names of the name seen PREFETCH_MIN_COUNT
+ *   times and in PREFETCH_MIN_PROB % of its transitions or more are
+ *   predicted (most counted first, up to PREFETCH_FANOUT), and those
+ *   not cached yet are read into the content cache (content.h) by a
+ *   worker thread, so the read is off the main loop. The main loop
+ *   wakes by a pipe when a read is done and caches the data. At most
+ *   PREFETCH_QUEUE reads are in flight; more predictions are dropped.
+ *     Precision (predictions followed by the client / predictions)
+ *   and recall (transitions predicted / transitions) are reported.
+ *   With -F, or without threads, names are still predicted and
+ *   scored, but nothing is read.
+ */
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* __PREFETCH_H__ */
@@ -45,17 +45,29 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <netinet/in.h>
 
 #include "pkt_buff.h"
 #include "proto_udp.h"
 #include "proto_tftp.h"
 #include "task.h"
+#include "timer.h"
+#include "client.h"
+#include "cong.h"
+#include "dirindex.h"
+#include "mcast.h"
+#include "dupreq.h"
+#include "negcache.h"
+#include "prefetch.h"
 #include "util.h"
 #include "debug.h"
 
+#include "globals.h"
+
 #ifndef DEBUG_PROTO_TFTP
 #  undef P_DEBUG
 #  define P_DEBUG(fmt...) /* null */
@@ -73,12 +85,25 @@ static const char *err_msgs[] = {
     "Unknown transfer ID.",
     "File already exists.",
     "No such user.",
+    "Option negotiation failed.",
 };
 
+/* error packets encoded by tftp_init(), indexed by error code */
+static struct {
+    size_t len;
+    u_int8_t data[TFTP_ERR_PKTMAX];
+} ErrPkts[TFTP_ENONE];
+
 static unsigned int AcceptCounter = 0;
 static unsigned int RejectCounter = 0;
 static unsigned int RetransCounter = 0;
 static unsigned int TimeoutCounter = 0;
+static unsigned int OackCounter = 0;
+static unsigned int RollbackCounter = 0;
+static unsigned int PaceCounter = 0;
+static unsigned int ClampCounter = 0;
+static unsigned int ParityCounter = 0;
+static unsigned int ReplyCounter = 0;
 
 /*
  * Constatns.
@@ -102,21 +127,94 @@ enum buffer_params {
  */
 static struct tftp_req_str *parse_req(struct pkt_buff *pkb);
 static int rrq_input(TASK *task, struct pkt_buff *pkb);
+static int rrq_dup(TASK *task);
+static int rrq_check(char *fname, const char *mode);
+static int wrq_input(TASK *task, struct pkt_buff *pkb);
 static int ack_input(TASK *task, struct pkt_buff *pkb);
+static int data_input(TASK *task, struct pkt_buff *pkb);
+static int error_input(TASK *task, struct pkt_buff *pkb);
 static int error_output(TASK *task, u_int16_t errcode);
+static int error_reply(struct pkt_buff *pkb, u_int16_t errcode);
+static int oack_output(TASK *task);
 static int data_output(TASK *task);
-static int check_filest(char *fname);
+static int ack_output(TASK *task, u_int32_t blockn);
+static int window_output(TASK *task);
+static int block_output(TASK *task, u_int32_t blockn);
+static int parity_output(TASK *task, u_int32_t blockn);
+static u_int16_t blk_wire(TASK *task, u_int32_t blockn);
+static int mcast_resume(TASK *task, u_int16_t received);
+static int mcast_handover(TASK *task);
+static int opt_negotiate(TASK *task, struct tftp_req_str *reqs);
+static int opt_multicast(TASK *task, const char *value, char *reply);
+static int opt_blksize(TASK *task, const char *value, char *reply);
+static int opt_windowsize(TASK *task, const char *value, char *reply);
+static int opt_tsize(TASK *task, const char *value, char *reply);
+static int opt_timeout(TASK *task, const char *value, char *reply);
+static int opt_utimeout(TASK *task, const char *value, char *reply);
+static int opt_rollover(TASK *task, const char *value, char *reply);
+static int opt_fec(TASK *task, const char *value, char *reply);
+static long opt_atol(const char *value, long min, long max);
+static char *scan_str(char *walk, char *end);
+static int check_filest(char *fname, off_t *size);
+static int check_writable(const char *fname);
+static int check_fname(const char *fname);
 static int check_pktlen(int pkt_type, int size);
 
+/*
+ * Option handlers (RFC2347).
+ *   A handler returns 1 and writes the value to be acknowledged into
+ *   `reply' if the option is accepted. Otherwise the option is not
+ *   included in OACK. Handlers are called in the order of this table,
+ *   so a handler can see the result of the ones above.
+ */
+static const struct {
+    const char *name;
+    unsigned int flag;
+    int (*handler)(TASK *task, const char *value, char *reply);
+} opt_table[] = {
+    { "multicast",  TFTP_OPTF_MULTICAST,  opt_multicast },  /* RFC2090 */
+    { "blksize",    TFTP_OPTF_BLKSIZE,    opt_blksize },    /* RFC2348 */
+    { "windowsize", TFTP_OPTF_WINDOWSIZE, opt_windowsize }, /* RFC7440 */
+    { "tsize",      TFTP_OPTF_TSIZE,      opt_tsize },      /* RFC2349 */
+    { "timeout",    TFTP_OPTF_TIMEOUT,    opt_timeout },    /* RFC2349 */
+    { "utimeout",   TFTP_OPTF_UTIMEOUT,   opt_utimeout },   /* tftp-hpa */
+    { "rollover",   TFTP_OPTF_ROLLOVER,   opt_rollover },   /* tftp-hpa */
+    { "x-fec",      TFTP_OPTF_FEC,        opt_fec },        /* experimental */
+    { NULL, 0, NULL },
+};
+
 /*
  * Exported functions
  */
+int
+tftp_init(void)
+{
+    int i;
+    size_t msglen;
+    struct tftp_pkt *tpkt;
+    struct tftp_err *terr;
+
+    /* error packets are always same, encode them once. */
+    for (i = 0; i < TFTP_ENONE; i++) {
+        msglen = strlen(err_msgs[i]) + 1;
+        tpkt = (struct tftp_pkt *)ErrPkts[i].data;
+        terr = TFTP_TO_ERR(tpkt);
+        tpkt->Opcode = htons(TFTP_ERROR);
+        terr->ErrorCode = htons(i);
+        memcpy(terr->ErrMsg, err_msgs[i], msglen);
+        ErrPkts[i].len = TFTP_HDLEN + TFTP_ERR_HDLEN + msglen;
+    }
+
+    return 1;
+}
+
 int
 tftp_input(TASK *task, struct pkt_buff *pkb)
 {
     int size_ok, task_ok, retval;
-    int opcode;
-    TASK *new_task;
+    int opcode, errcode;
+    char *fname, *mode, *end;
+    TASK *new_task, *dup_task;
     struct tftp_pkt *tpkt;
     struct sockaddr *caddr;
     struct sockaddr *daddr;
@@ -159,11 +257,34 @@ tftp_input(TASK *task, struct pkt_buff *pkb)
         case TFTP_RRQ:
             P_INFO("Task %d: Read request received from interface %s.\n",
                    task_get_id(task), strsockaddr(daddr, addrlen));
+            /* broken request is told by parse_req() later */
+            end = (char *)pkb->payload + pkb->size;
+            fname = (char *)pkb->payload + TFTP_HDLEN;
+            mode = scan_str(fname, end);
+            if (mode == NULL || scan_str(mode, end) == NULL) fname = NULL;
+            dup_task = (fname != NULL) ?
+                       dupreq_lookup(caddr, addrlen, fname) : NULL;
+            if (dup_task != NULL) {
+                rrq_dup(dup_task);
+                pkb_free(pkb);
+                retval = 1;
+                break;
+            }
+            errcode = (fname != NULL) ? rrq_check(fname, mode) : TFTP_ENONE;
+            if (errcode != TFTP_ENONE) {
+                /* no task for the request rejected */
+                error_reply(pkb, errcode);
+                RejectCounter++;
+                pkb_free(pkb);
+                retval = 1;
+                break;
+            }
             new_task = task_create(TASK_TYPE_READ, daddr, caddr, addrlen);
             if (new_task == NULL) {
                 P_WARNING("task_new() failed.\n");
                 break;
             }
+            if (fname != NULL) dupreq_add(new_task, caddr, addrlen, fname);
             task_ok = rrq_input(new_task, pkb);
             if (task_ok == 0) {
                 P_WARNING("unable to start new task.\n");
@@ -172,10 +293,25 @@ tftp_input(TASK *task, struct pkt_buff *pkb)
             retval = 1;
             break;
         case TFTP_WRQ:
-            P_DEBUG("Opcode is WRQ.\n");
+            P_INFO("Task %d: Write request received from interface %s.\n",
+                   task_get_id(task), strsockaddr(daddr, addrlen));
+            new_task = task_create(TASK_TYPE_WRITE, daddr, caddr, addrlen);
+            if (new_task == NULL) {
+                P_WARNING("task_new() failed.\n");
+                break;
+            }
+            task_ok = wrq_input(new_task, pkb);
+            if (task_ok == 0) {
+                P_WARNING("unable to start new task.\n");
+                break;
+            }
+            retval = 1;
             break;
         case TFTP_DATA:
             P_DEBUG("Opcode is DATA.\n");
+            if (task_get_type(task) == TASK_TYPE_PORTAL) break;
+            data_input(task, pkb);
+            retval = 1;
             break;
         case TFTP_ACK:
             P_DEBUG("Opcode is ACK.\n");
@@ -184,6 +320,9 @@ tftp_input(TASK *task, struct pkt_buff *pkb)
             break;
         case TFTP_ERROR:
             P_DEBUG("Opcode is ERROR.\n");
+            if (task_get_type(task) == TASK_TYPE_PORTAL) break;
+            error_input(task, pkb);
+            retval = 1;
             break;
         default:
             P_DEBUG("Unknown Opcode %d.\n", opcode);
@@ -223,9 +362,7 @@ int
 tftp_retrans(TASK *task)
 {
     int send_ok;
-    int type, state, retc, rbufsize;
-    struct pkt_buff *pkb;
-    unsigned char *rbuf;
+    int type, state, retc, rmax;
     long interval;
 
     /* error check */
@@ -238,8 +375,7 @@ tftp_retrans(TASK *task)
     type = task_get_type(task);
     state = task_get_state(task);
     retc = task_get_rcounter(task);
-    rbuf = task_get_rbuf(task);
-    rbufsize = task_get_rbufsize(task);
+    rmax = task_get_rmax(task);
     interval = task_get_rinterval(task);
 
     /* consistency check */
@@ -253,26 +389,56 @@ tftp_retrans(TASK *task)
                   task_get_id(task));
         return 0;
     }
-    if (retc >= RETRANS_MAX) {
+    if (type == TASK_TYPE_WRITE && task_get_upload(task) == NULL) {
+        /* last ACK is not asked again, done. */
+        task_join(task, TASK_EXIT_NORMAL);
+        return 1;
+    }
+    if (retc >= rmax && mcast_is_group(task)) {
+        /* RFC2090: master doesn't answer, the group goes on without it. */
+        P_INFO("Task %d: Timeout of master client.\n", task_get_sockfd(task));
+        TimeoutCounter++;
+        return mcast_handover(task);
+    }
+    if (retc >= rmax) {
         P_WARNING("Task %d: Timeout during transfer.\n", task_get_sockfd(task));
         TimeoutCounter++;
         task_join(task, TASK_EXIT_ERROR);
         return 0;
     }
 
-    /* set up packet buffer */
-    pkb = pkb_alloc(rbufsize);
-    memcpy(pkb->payload, rbuf, pkb->size);
-
-    /* output */
-    send_ok = tftp_output(task_get_sockfd(task), pkb);
-    if (send_ok == 0) {
-        P_WARNING("tftp_output() failed.\n");
-        return 0;
+    if (type == TASK_TYPE_WRITE) {
+        /* resend last ACK (or OACK). RFC7440: sender rolls back to it. */
+        send_ok = block_output(task, 0);
+        if (send_ok == 0) {
+            P_WARNING("block_output() failed.\n");
+            return 0;
+        }
+    } else if (mcast_get_handoff(task)) {
+        /* new master hasn't acked OACK yet */
+        send_ok = mcast_oack(task);
+        if (send_ok == 0) {
+            P_WARNING("mcast_oack() failed.\n");
+            return 0;
+        }
+        OackCounter++;
+    } else {
+        /*
+         * RFC7440: roll back to the oldest block not acked, resend window.
+         * cwnd is 1 after timeout, so the rest of window is paced.
+         */
+        cong_timeout(task);
+        task_set_sendn(task, task_get_blockn(task));
+        task_set_burst(task, 0);
+        send_ok = window_output(task);
+        if (send_ok == 0) {
+            P_WARNING("window_output() failed.\n");
+            return 0;
+        }
     }
 
     /* renew timer parameter */
-    interval *= RETRANS_BACKOFF_FACTOR;
+    interval *= task_get_rbackoff(task);
     task_set_rinterval(task, interval);
     task_inc_rcounter(task);
 
@@ -283,6 +449,38 @@ tftp_retrans(TASK *task)
     return 1;
 }
 
+/*
+ * Pacing timer expired. Send next burst of the window.
+ */
+int
+tftp_pace(TASK *task)
+{
+    int output_ok;
+    struct timeval tv;
+
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+    if (task_get_state(task) != TASK_ST_WACK) {
+        P_DEBUG("Task %d: not in wait state. pacing ignored.\n",
+                task_get_id(task));
+        return 1;
+    }
+
+    task_set_burst(task, 0);
+    output_ok = window_output(task);
+
+    /* client acks after the last block of window, count RTO from here. */
+    if (task_get_burst(task) > 0) {
+        gettimeofday(&tv, NULL);
+        task_set_rsec(task, tv.tv_sec);
+        task_set_rusec(task, tv.tv_usec);
+    }
+
+    return output_ok;
+}
+
 void
 tftp_report(void)
 {
@@ -291,6 +489,12 @@ tftp_report(void)
     P_INFO(" Reject   Counter = %d\n", RejectCounter);
     P_INFO(" Retrans  Counter = %d\n", RetransCounter);
     P_INFO(" Timeout  Counter = %d\n", TimeoutCounter);
+    P_INFO(" OAck     Counter = %d\n", OackCounter);
+    P_INFO(" Rollback Counter = %d\n", RollbackCounter);
+    P_INFO(" Pace     Counter = %d\n", PaceCounter);
+    P_INFO(" Clamp    Counter = %d\n", ClampCounter);
+    P_INFO(" Parity   Counter = %d\n", ParityCounter);
+    P_INFO(" Reply    Counter = %d\n", ReplyCounter);
 
     return;
 }
@@ -302,9 +506,10 @@ static int
 rrq_input(TASK *task, struct pkt_buff *pkb)
 {
     int send_ok;
-    int state, errcode, filest;
+    int state, errcode, nopts;
+    off_t fsize;
     struct tftp_req_str *reqs;
-    FILE *file = NULL;
+    STREAM *stream = NULL;
 
     P_DEBUG("Task id is %d.\n", task_get_id(task));
 
@@ -331,60 +536,283 @@ rrq_input(TASK *task, struct pkt_buff *pkb)
            task_get_id(task), reqs->Filename,
            strsockaddr(pkb->caddr, pkb->addrlen));
 
-    /* setup task */
+    /* setup task. mode and file are checked by the portal (rrq_check()) */
     errcode = TFTP_ENONE; /* TFTP_ENONE = no error */
-    if (strncasecmp("octet", reqs->Mode, reqs->mode_len) != 0) {
-        P_WARNING("Only \"octet\" transfer mode is supported.\n");
-        /* XXX: netascii MUST supported. */
-        errcode = TFTP_EILLEGAL;
-        goto Check_Done;
+    nopts = 0;
+    if (strcasecmp("netascii", reqs->Mode) == 0) {
+        task_set_mode(task, TFTP_MODE_NETASCII);
+    } else {
+        task_set_mode(task, TFTP_MODE_OCTET);
     }
-    filest = check_filest(reqs->Filename);
-    if (filest != FILE_ST_OK) {
-        switch (filest) {
-            case FILE_ST_TOOBIG:
-                P_INFO("Task %d: Read request rejected. File too big.\n",
-                        task_get_id(task));
-                errcode = TFTP_EILLEGAL;
-                break;
-            case FILE_ST_EACCES:
+    stream = stream_open(reqs->Filename,
+                         task_get_mode(task) == TFTP_MODE_NETASCII ?
+                         STREAM_MODE_NETASCII : STREAM_MODE_OCTET);
+    if (stream == NULL) {
+        switch(errno) {
+            case EACCES:
                 P_INFO("Task %d: Read request rejected. Access denied.\n",
-                        task_get_id(task));
-                errcode = TFTP_ENDEF;
+                       task_get_id(task));
+                errcode = TFTP_EACCES;
                 break;
-            case FILE_ST_ENOENT:
+            case ENOENT:
                 P_INFO("Task %d: Read request rejected. File not found.\n",
-                        task_get_id(task));
+                       task_get_id(task));
                 errcode = TFTP_ENOENT;
                 break;
-            case FILE_ST_EREG:
-                P_INFO("Task %d: Read request rejected. File isn't regular file.\n",
-                        task_get_id(task));
+            case EFBIG:
+                P_INFO("Task %d: Read request rejected. File too big.\n",
+                       task_get_id(task));
                 errcode = TFTP_EILLEGAL;
                 break;
             default:
                 P_INFO("Task %d: Read request rejected. Unknown error.\n",
-                       task_get_id(task)); 
+                       task_get_id(task));
                 errcode = TFTP_ENDEF;
                 break;
         }
         goto Check_Done;
     }
-    file = fopen(reqs->Filename, "r");
-    if (file == NULL) {
+    /* learn the order of files, read the next ones (see prefetch.h) */
+    prefetch_request(pkb->caddr, reqs->Filename);
+    /* netascii image is larger than the file */
+    fsize = stream_get_size(stream);
+    task_set_fsize(task, fsize);
+    client_seed(task); /* options in the request override this */
+    nopts = opt_negotiate(task, reqs);
+    if (fsize > TFTP_FILE_ROLL_SIZE(task_get_blksize(task)) ||
+        (task_get_rollover(task) < 0 &&
+         fsize > TFTP_FILE_NOROLL_SIZE(task_get_blksize(task)))) {
+        P_INFO("Task %d: Read request rejected. File too big.\n",
+                task_get_id(task));
+        errcode = TFTP_EILLEGAL;
+        goto Check_Done;
+    }
+    if (task_get_opts(task) & TFTP_OPTF_MULTICAST) {
+        /* RFC2090: the group of the file serves the client. */
+        stream_close(stream);
+        stream = NULL;
+        if (mcast_join(task, reqs->Filename, pkb->laddr, pkb->addrlen) == 0) {
+            P_INFO("Task %d: Read request rejected. Unable to join group.\n",
+                   task_get_id(task));
+            errcode = TFTP_EOPTION;
+            goto Check_Done;
+        }
+        safe_free(reqs);
+        pkb_free(pkb);
+        task_join(task, TASK_EXIT_NORMAL);
+        AcceptCounter++;
+        return 1;
+    }
+Check_Done:
+    safe_free(reqs);
+    pkb_free(pkb);
+    if (errcode != TFTP_ENONE) {
+        if (stream != NULL) stream_close(stream);
+        send_ok = error_output(task, errcode);
+        if (send_ok == 0) {
+            P_WARNING("error_output() failed.\n");
+            task_join(task, TASK_EXIT_ERROR);
+            return 0;
+        }
+        /* error task is a valid task. */
+        RejectCounter++;
+        return 1;
+    }
+    task_set_stream(task, stream);
+
+    if (nopts > 0) {
+        /* From RFC2347 Page 3: Ack for OACK is ACK with block 0 */
+        send_ok = oack_output(task);
+    } else {
+        /* From RFC1350 Page4: Ack for RRQ is 1st data packet */
+        send_ok = data_output(task);
+    }
+    if (send_ok == 0) {
+        P_WARNING("data_output() failed. cannot initialize connection.\n");
+        task_join(task, TASK_EXIT_ERROR);
+        return 0;
+    }
+
+    AcceptCounter++;
+    P_INFO("Task %d: Request accepted.\n", task_get_id(task));
+
+    return 1;
+}
+
+/*
+ * RRQ resent by the client of the task (see dupreq.h). Send the 1st
+ * block again if it is not acked yet.
+ */
+static int
+rrq_dup(TASK *task)
+{
+    int send_ok;
+    u_int32_t first;
+
+    /* a file of one window is filled (CWAIT) with its 1st block */
+    if (task_get_type(task) != TASK_TYPE_READ &&
+        task_get_type(task) != TASK_TYPE_CWAIT) return 0;
+
+    /* OACK is block 0 if options are acknowledged */
+    first = (task_get_opts(task) != 0) ? 0 : 1;
+    if (task_get_blockn(task) != first || task_get_sendn(task) <= first)
+        return 0;
+
+    task_stamp_rbuf(task, first, 0);
+    send_ok = block_output(task, first);
+    if (send_ok == 0) {
+        P_WARNING("block_output() failed.\n");
+        return 0;
+    }
+    P_DEBUG("Task %d: block %d resent for duplicate request.\n",
+            task_get_id(task), first);
+
+    return 1;
+}
+
+/*
+ * Check mode and file of RRQ. Returns error code to answer, or
+ * TFTP_ENONE. Called without task for the stateless error reply.
+ */
+static int
+rrq_check(char *fname, const char *mode)
+{
+    int filest;
+    off_t fsize;
+
+    if (strcasecmp("octet", mode) != 0 && strcasecmp("netascii", mode) != 0) {
+        P_INFO("Read request rejected. Mode \"%s\" not supported.\n", mode);
+        return TFTP_EILLEGAL;
+    }
+    filest = check_filest(fname, &fsize);
+    switch (filest) {
+        case FILE_ST_OK:
+            return TFTP_ENONE;
+        case FILE_ST_TOOBIG:
+            P_INFO("Read request rejected. File too big.\n");
+            return TFTP_EILLEGAL;
+        case FILE_ST_EACCES:
+            P_INFO("Read request rejected. Access denied.\n");
+            return TFTP_ENDEF;
+        case FILE_ST_ENOENT:
+            P_INFO("Read request rejected. File not found.\n");
+            return TFTP_ENOENT;
+        case FILE_ST_EREG:
+            P_INFO("Read request rejected. File isn't regular file.\n");
+            return TFTP_EILLEGAL;
+        default:
+            P_INFO("Read request rejected. Unknown error.\n");
+            return TFTP_ENDEF;
+    }
+}
+
+static int
+wrq_input(TASK *task, struct pkt_buff *pkb)
+{
+    int send_ok;
+    int state, errcode, filest, nopts;
+    off_t fsize;
+    struct tftp_req_str *reqs;
+    UPLOAD *upload = NULL;
+
+    P_DEBUG("Task id is %d.\n", task_get_id(task));
+
+    /* initialize variables */
+    state = task_get_state(task);
+
+    /* check consistency */
+    if (state != TASK_ST_INIT) {
+        P_WARNING("Task %d is not a new task. BUG?\n", task_get_id(task));
+        pkb_free(pkb);
+        task_join(task, TASK_EXIT_ERROR);
+        return 0;
+    }
+
+    /* parse request */
+    reqs = parse_req(pkb);
+    if (reqs == NULL) {
+        P_WARNING("parse_req() failed.\n");
+        pkb_free(pkb);
+        task_join(task, TASK_EXIT_ERROR);
+        return 0;
+    }
+    P_INFO("Task %d: file=\"%s\" client addr=%s.\n",
+           task_get_id(task), reqs->Filename,
+           strsockaddr(pkb->caddr, pkb->addrlen));
+
+    /* setup task */
+    errcode = TFTP_ENONE; /* TFTP_ENONE = no error */
+    nopts = 0;
+    if (TFTP_Write == 0) {
+        P_INFO("Task %d: Write request rejected. Upload not allowed.\n",
+               task_get_id(task));
+        errcode = TFTP_EACCES;
+        goto Check_Done;
+    }
+    if (strcasecmp(reqs->Mode, "octet") != 0) {
+        P_WARNING("Only \"octet\" transfer mode is supported.\n");
+        errcode = TFTP_EILLEGAL;
+        goto Check_Done;
+    }
+    if (check_fname(reqs->Filename) == 0) {
+        P_INFO("Task %d: Write request rejected. Bad file name.\n",
+               task_get_id(task));
+        errcode = TFTP_EACCES;
+        goto Check_Done;
+    }
+    filest = check_filest(reqs->Filename, &fsize);
+    if (filest != FILE_ST_OK && filest != FILE_ST_ENOENT &&
+        filest != FILE_ST_TOOBIG) {
+        /* existing regular file is replaced, others are not. */
+        P_INFO("Task %d: Write request rejected. Access denied.\n",
+               task_get_id(task));
+        errcode = TFTP_EACCES;
+        goto Check_Done;
+    }
+    if (filest != FILE_ST_ENOENT && check_writable(reqs->Filename) == 0) {
+        /* only world writable file is replaced (see upload.h) */
+        P_INFO("Task %d: Write request rejected. File exists.\n",
+               task_get_id(task));
+        errcode = TFTP_EACCES;
+        goto Check_Done;
+    }
+    client_seed(task); /* options in the request override this */
+    nopts = opt_negotiate(task, reqs);
+    task_set_blockn(task, 1); /* next DATA expected */
+    fsize = task_get_fsize(task); /* tsize told by client, or 0 */
+    if (fsize > TFTP_FILE_ROLL_SIZE(task_get_blksize(task)) ||
+        (task_get_rollover(task) < 0 &&
+         fsize > TFTP_FILE_NOROLL_SIZE(task_get_blksize(task)))) {
+        P_INFO("Task %d: Write request rejected. File too big.\n",
+                task_get_id(task));
+        errcode = TFTP_ENOSPC;
+        goto Check_Done;
+    }
+    upload = upload_open(reqs->Filename, fsize);
+    if (upload == NULL) {
         switch(errno) {
             case EACCES:
-                P_INFO("Task %d: Read request rejected. Access denied.\n",
+            case EPERM:
+            case EROFS:
+                P_INFO("Task %d: Write request rejected. Access denied.\n",
                        task_get_id(task));
                 errcode = TFTP_EACCES;
                 break;
             case ENOENT:
-                P_INFO("Task %d: Read request rejected. File not found.\n",
+            case ENOTDIR:
+                P_INFO("Task %d: Write request rejected. No directory.\n",
                        task_get_id(task));
                 errcode = TFTP_ENOENT;
                 break;
+            case ENOSPC:
+            case EDQUOT:
+            case EFBIG:
+                P_INFO("Task %d: Write request rejected. Disk full.\n",
+                       task_get_id(task));
+                errcode = TFTP_ENOSPC;
+                break;
             default:
-                P_INFO("Task %d: Read request rejected. Unknown error.\n",
+                P_INFO("Task %d: Write request rejected. Unknown error.\n",
                        task_get_id(task));
                 errcode = TFTP_ENDEF;
                 break;
@@ -405,12 +833,17 @@ Check_Done:
         RejectCounter++;
         return 1;
     }
-    task_set_file(task, file);
-
-    /* From RFC1350 Page4: Ack for RRQ is 1st data packet */
-    send_ok = data_output(task);
+    task_set_upload(task, upload);
+
+    if (nopts > 0) {
+        /* RFC2347 Page 3: client sends DATA 1 for OACK */
+        send_ok = oack_output(task);
+    } else {
+        /* From RFC1350 Page 4: Ack for WRQ is ACK with block 0 */
+        send_ok = ack_output(task, 0);
+    }
     if (send_ok == 0) {
-        P_WARNING("data_output() failed. cannot initialize connection.\n");
+        P_WARNING("ack_output() failed. cannot initialize connection.\n");
         task_join(task, TASK_EXIT_ERROR);
         return 0;
     }
@@ -425,8 +858,9 @@ static int
 ack_input(TASK *task, struct pkt_buff *pkb)
 {
     int send_ok;
-    int type, state, retval;
-    u_int16_t expect, received;
+    int type, state;
+    u_int16_t received;
+    u_int32_t expect, sendn, inflight, acked;
     struct tftp_pkt *tpkt;
     struct tftp_ack *apkt;
 
@@ -437,9 +871,24 @@ ack_input(TASK *task, struct pkt_buff *pkb)
     state = task_get_state(task);
     tpkt = PKB_TO_TFTP(pkb);
     apkt = TFTP_TO_ACK(tpkt);
-    expect = task_get_blockn(task); /* XXX */
+    expect = task_get_blockn(task);
+    sendn = task_get_sendn(task);
     received = ntohs(apkt->BlockN);
-    P_DEBUG("Ack: Received Block = %d, Wait Ack = %d.\n", received, expect);
+    inflight = sendn - expect;        /* blocks sent but not acked */
+    /* blocks acked by this packet. search in [expect - 1, sendn - 1] */
+    for (acked = 0; acked <= inflight; acked++) {
+        if (blk_wire(task, expect - 1 + acked) == received) break;
+    }
+    P_DEBUG("Ack: Received Block = %d, Wait Ack = %d-%d.\n",
+            received, expect, sendn - 1);
+
+    /* RFC2090: only the master client moves the group. */
+    if (mcast_is_group(task) && mcast_is_master(task, pkb->caddr) == 0) {
+        P_DEBUG("Task %d: Ack from non-master client ignored.\n",
+                task_get_id(task));
+        pkb_free(pkb);
+        return 1;
+    }
 
     /* free received packet */
     pkb_free(pkb);
@@ -449,12 +898,28 @@ ack_input(TASK *task, struct pkt_buff *pkb)
         P_WARNING("Ack received, but task not wait for ack.\n");
         return 1;
     }
-    if (expect != received) {
+    if (type == TASK_TYPE_ERROR) {
+        task_join(task, TASK_EXIT_ERROR);
+        return 1;
+    }
+    if (mcast_get_handoff(task)) {
+        /* 1st ACK of new master tells the last block it has */
+        mcast_set_handoff(task, 0);
+        return mcast_resume(task, received);
+    }
+    if (acked > inflight) {
+        P_DEBUG("Task %d: Block number out of window. Expect %d-%d, "
+                "received %d\n", task_get_id(task), expect, sendn - 1,
+                received);
+        return 1;
+    }
+    if (acked == 0) {
         /*
          * NOTE: Don't run retrans code when dupilicate ack received.
          *       If do so, dupilicate packet goes multiplied ....
+         *       Even if window is used, lost blocks are resent by
+         *       partial ack or by retrans timer.
          */
-        /* XXX: Ack for error packet may ignore block number? */
         P_DEBUG("Task %d: Block number mismatch. Expect %d, received %d\n",
                   task_get_id(task), expect, received);
         return 1;
@@ -463,22 +928,37 @@ ack_input(TASK *task, struct pkt_buff *pkb)
     /* OK, transaction go forward */
     switch (type) {
         case TASK_TYPE_READ:
+        case TASK_TYPE_CWAIT:
+            timer_rtt_sample(task, task_get_rbufage(task, expect - 1 + acked));
+            expect += acked;
+            task_set_blockn(task, expect);
+            cong_ack(task, acked);
+            if (type == TASK_TYPE_CWAIT && expect == task_get_filln(task)) {
+                /* last block is acked. */
+                if (mcast_is_group(task)) {
+                    mcast_handover(task);
+                    break;
+                }
+                task_join(task, TASK_EXIT_NORMAL);
+                break;
+            }
+            if (acked < inflight) {
+                /*
+                 * RFC7440: Ack in the middle of window means blocks
+                 * after it are lost. Roll back and resend from there.
+                 */
+                P_DEBUG("Task %d: Roll back to block %d.\n",
+                        task_get_id(task), expect);
+                cong_loss(task);
+                task_set_sendn(task, expect);
+                RollbackCounter++;
+            }
             P_DEBUG("Read next block from file.\n");
-            task_inc_blockn(task);
             send_ok = data_output(task);
             if (send_ok == 0) {
-                P_WARNING("tftp_send_data() failed.\n");
-                retval = 1;
+                P_WARNING("data_output() failed.\n");
             }
             break;
-        case TASK_TYPE_CWAIT:
-            task_join(task, TASK_EXIT_NORMAL);
-            retval = 0;
-            break;
-        case TASK_TYPE_ERROR:
-            task_join(task, TASK_EXIT_ERROR);
-            retval = 0;
-            break;
         default:
             P_WARNING("Task %d: Unknown task type %d. BUG?\n",
                       task_get_id(task), type);
@@ -488,43 +968,154 @@ ack_input(TASK *task, struct pkt_buff *pkb)
     return 1;
 }
 
-/* output related */
+/*
+ * DATA of WRQ. Acked when copied to write-behind buffer (see upload.h).
+ * With windowsize, ack after every window (RFC7440).
+ */
 static int
-error_output(TASK *task, u_int16_t errcode)
+data_input(TASK *task, struct pkt_buff *pkb)
 {
-    int send_ok;
-    int msglen;
-    size_t bufsize;
-    struct pkt_buff *pkb;
+    int ok;
+    size_t len;
+    u_int16_t received;
+    u_int32_t expect;
     struct tftp_pkt *tpkt;
-    struct tftp_err *terr;
-
-    P_DEBUG("Sending error 0x%02x(%s).\n", errcode, err_msgs[errcode]);
+    struct tftp_data *tdata;
+    UPLOAD *upload;
 
-    task_set_type(task, TASK_TYPE_ERROR);
-    task_set_state(task, TASK_ST_ERROR);
+    P_DEBUG("Task id is %d.\n", task_get_id(task));
 
     /* initialize variables */
-    msglen = strlen(err_msgs[errcode]) + 1;
-    bufsize = TFTP_HDLEN + TFTP_ERR_HDLEN + msglen;
-
-    /* setup packet buffer */
-    pkb = pkb_alloc(bufsize);
-    if (pkb == NULL) {
-        P_WARNING("pkb_alloc() failed.\n");
-        return 0;
-    }
     tpkt = PKB_TO_TFTP(pkb);
-    terr = TFTP_TO_ERR(tpkt);
-
-    /* encapsulation */
-    tpkt->Opcode = htons(TFTP_ERROR);
-    terr->ErrorCode = htons(errcode);
-    memcpy(terr->ErrMsg, err_msgs[errcode], msglen);
+    tdata = TFTP_TO_DATA(tpkt);
+    received = ntohs(tdata->BlockN);
+    len = pkb->size - TFTP_HDLEN - TFTP_DATA_HDLEN;
+    expect = task_get_blockn(task);
+    upload = task_get_upload(task);
 
-    /* Error packet doesn't retransmitted at this time.
-     * So rbuf set up is not required.
-     */ 
+    /* check consistency */
+    if (task_get_type(task) == TASK_TYPE_ERROR) {
+        pkb_free(pkb);
+        task_join(task, TASK_EXIT_ERROR);
+        return 1;
+    }
+    if (task_get_type(task) != TASK_TYPE_WRITE) {
+        P_WARNING("Data received, but task not for write.\n");
+        pkb_free(pkb);
+        return 1;
+    }
+    if (upload == NULL) {
+        /* last block again, our last ACK was lost. */
+        pkb_free(pkb);
+        block_output(task, 0);
+        return 1;
+    }
+    if (received != blk_wire(task, expect)) {
+        /*
+         * Duplicate (our ACK lost) or out of order (block lost).
+         * ACK the last block in order once, sender goes back there.
+         */
+        P_DEBUG("Task %d: Block number mismatch. Expect %d, received %d\n",
+                task_get_id(task), expect, received);
+        pkb_free(pkb);
+        if (task_get_burst(task) == 0) {
+            task_set_burst(task, 1);
+            ack_output(task, expect - 1);
+            RollbackCounter++;
+        }
+        return 1;
+    }
+    if (len > task_get_blksize(task)) {
+        P_WARNING("Task %d: Block too large.\n", task_get_id(task));
+        pkb_free(pkb);
+        error_output(task, TFTP_EILLEGAL);
+        return 1;
+    }
+
+    /* OK, transaction go forward */
+    ok = upload_write(upload, tdata->Data, len);
+    pkb_free(pkb);
+    if (ok == 0) {
+        error_output(task, TFTP_ENOSPC);
+        return 1;
+    }
+    task_set_blockn(task, ++expect);
+    task_set_burst(task, 0);
+
+    if (len < task_get_blksize(task)) {
+        /* last block. upload is published by upload_sync(). */
+        task_set_upload(task, NULL);
+        if (upload_commit(upload) == 0) {
+            upload_close(upload);
+            error_output(task, TFTP_ENOSPC);
+            return 1;
+        }
+        /* stay until timeout, to answer the last block sent again. */
+        return ack_output(task, expect - 1);
+    }
+    if (expect - task_get_sendn(task) >= task_get_window(task)) {
+        return ack_output(task, expect - 1);
+    }
+
+    /* client is alive, restart the timer. */
+    task_set_state(task, TASK_ST_SEND);
+    task_set_state(task, TASK_ST_WACK);
+
+    return 1;
+}
+
+static int
+error_input(TASK *task, struct pkt_buff *pkb)
+{
+    int master;
+    struct tftp_pkt *tpkt;
+    struct tftp_err *terr;
+
+    tpkt = PKB_TO_TFTP(pkb);
+    terr = TFTP_TO_ERR(tpkt);
+    P_INFO("Task %d: Error %d received from client.\n",
+           task_get_id(task), ntohs(terr->ErrorCode));
+
+    if (mcast_is_group(task)) {
+        /* RFC2090: a client leaves the group by ERROR. */
+        master = mcast_is_master(task, pkb->caddr);
+        mcast_drop(task, pkb->caddr);
+        pkb_free(pkb);
+        if (master) mcast_handover(task);
+        return 1;
+    }
+
+    pkb_free(pkb);
+
+    /* RFC1350 Page 8: Error packet terminates the transfer. */
+    task_join(task, TASK_EXIT_ERROR);
+
+    return 1;
+}
+
+/* output related */
+static int
+error_output(TASK *task, u_int16_t errcode)
+{
+    int send_ok;
+    struct pkt_buff *pkb;
+
+    P_DEBUG("Sending error 0x%02x(%s).\n", errcode, err_msgs[errcode]);
+
+    task_set_type(task, TASK_TYPE_ERROR);
+    task_set_state(task, TASK_ST_ERROR);
+
+    /* setup packet buffer */
+    pkb = pkb_alloc(ErrPkts[errcode].len);
+    if (pkb == NULL) {
+        P_WARNING("pkb_alloc() failed.\n");
+        return 0;
+    }
+    memcpy(pkb->payload, ErrPkts[errcode].data, ErrPkts[errcode].len);
+
+    /* Error packet doesn't retransmitted at this time.
+     * So rbuf set up is not required.
+     */ 
 
     /* output */
     send_ok = tftp_output(task_get_sockfd(task), pkb);
@@ -538,56 +1129,320 @@ error_output(TASK *task, u_int16_t errcode)
     return 1;
 }
 
+/*
+ * Answer the request with error, without task. The packet is sent
+ * from the shared reply socket of proto_udp.c, and no timer or file
+ * descriptor is left. The request in pkb is not freed.
+ */
+static int
+error_reply(struct pkt_buff *pkb, u_int16_t errcode)
+{
+    int send_ok;
+
+    P_DEBUG("Replying error 0x%02x(%s).\n", errcode, err_msgs[errcode]);
+
+    send_ok = udp_reply(pkb->laddr, pkb->caddr, pkb->addrlen,
+                        ErrPkts[errcode].data, ErrPkts[errcode].len);
+    if (send_ok == 0) {
+        P_WARNING("udp_reply() failed.\n");
+        return 0;
+    }
+    ReplyCounter++;
+
+    return 1;
+}
+
+static int
+oack_output(TASK *task)
+{
+    int output_ok;
+
+    task_set_state(task, TASK_ST_SEND);
+
+    /* OACK is stored as block 0 by opt_negotiate() */
+    output_ok = block_output(task, 0);
+    if (output_ok == 0) {
+        P_WARNING("block_output() failed.\n");
+        return 0;
+    }
+    task_stamp_rbuf(task, 0, 1);
+    task_set_sendn(task, 1);
+    OackCounter++;
+
+    task_set_state(task, TASK_ST_WACK);
+
+    return 1;
+}
+
 static int
 data_output(TASK *task)
 {
-    int output_ok, fread_err, rbufsize, bufsize, max;
-    char *rbuf;
-    char buf[FILE_BUFSIZE];
-    struct pkt_buff *pkb;
+    int output_ok;
+
+    task_set_state(task, TASK_ST_SEND);
+
+    /* new round trip begins */
+    task_set_burst(task, 0);
+    output_ok = window_output(task);
+
+    task_set_state(task, TASK_ST_WACK);
+
+    return output_ok;
+}
+
+/*
+ * ACK blocks up to blockn. The ACK is kept as block 0 for retransmit,
+ * and SendN is the block which starts the next window.
+ */
+static int
+ack_output(TASK *task, u_int32_t blockn)
+{
+    int output_ok;
     struct tftp_pkt *tpkt;
-    struct tftp_data *tdata;
-    FILE *fp;
+    struct tftp_ack *tack;
 
     task_set_state(task, TASK_ST_SEND);
 
+    tpkt = (struct tftp_pkt *)task_get_rbuf(task, 0);
+    tack = TFTP_TO_ACK(tpkt);
+    tpkt->Opcode = htons(TFTP_ACK);
+    tack->BlockN = htons(blk_wire(task, blockn));
+    task_set_rbufsize(task, 0, TFTP_HDLEN + TFTP_ACK_HDLEN);
+    output_ok = block_output(task, 0);
+    if (output_ok == 0) {
+        P_WARNING("block_output() failed.\n");
+    }
+    task_set_sendn(task, blockn + 1);
+
+    task_set_state(task, TASK_ST_WACK);
+
+    return output_ok;
+}
+
+/*
+ * Send blocks from SendN. Up to `window' blocks are kept in flight
+ * (RFC7440), and cwnd blocks of them are sent in a round trip.
+ * The task state is not changed here.
+ */
+static int
+window_output(TASK *task)
+{
+    int output_ok, retval, fresh;
+    ssize_t nread;
+    size_t bufsize, max;
+    unsigned int window, cwnd, burst;
+    u_int32_t blockn, sendn, filln;
+    long srtt;
+    const u_int8_t *data;
+    struct tftp_pkt *tpkt;
+    struct tftp_data *tdata;
+    STREAM *stream;
+
     /* initialize variables */
-    fp = task_get_file(task);
-    max = TFTP_DATA_MAX_SIZE;
-    bufsize = 0;
-    rbuf = task_get_rbuf(task);
-    rbufsize = 0;
-
-    /* renew retransmit buffer */
-    bufsize = fread(buf, sizeof(char), max, fp);
-    fread_err = errno;
-    P_DEBUG("read %d bytes from file.\n", bufsize);
-    if (bufsize < max) {
-        if (feof(fp) == 0) {
-            P_WARNING("fread() failed: %s.\n", strerror(fread_err));
+    stream = task_get_stream(task);
+    max = task_get_blksize(task);
+    window = task_get_window(task);
+    cwnd = task_get_cwnd(task);
+    if (cwnd > window) cwnd = window;
+    burst = task_get_burst(task);
+    blockn = task_get_blockn(task);
+    sendn = task_get_sendn(task);
+    filln = task_get_filln(task);
+    retval = 1;
+
+    while (sendn - blockn < window && burst < cwnd) {
+        /* RFC2347: nothing follows OACK until it is acked. */
+        if (blockn == 0 && sendn > 0) break;
+
+        fresh = 0;
+        if (sendn == filln) {
+            if (task_get_type(task) == TASK_TYPE_CWAIT) break; /* EOF */
+
+            /* encoded packet of hot file (see content.h) */
+            nread = stream_packet(stream, max, task_get_rollover(task),
+                                  filln, &data);
+            if (nread >= 0) {
+                bufsize = nread - TFTP_HDLEN - TFTP_DATA_HDLEN;
+                task_set_rbufsize(task, filln, nread);
+                task_set_rbufpkt(task, filln, data);
+            } else {
+                /* renew retransmit buffer */
+                tpkt = (struct tftp_pkt *)task_get_rbuf(task, filln);
+                tdata = TFTP_TO_DATA(tpkt);
+                /* slice of mmap()ed file is sent as is (see stream.h) */
+                data = NULL;
+                nread = stream_map(stream, (off_t)(filln - 1) * max, max,
+                                   &data);
+                if (nread < 0) {
+                    data = NULL;
+                    nread = stream_read(stream, (off_t)(filln - 1) * max,
+                                        tdata->Data, max);
+                }
+                if (nread < 0) {
+                    P_WARNING("stream_read() failed.\n");
+                    error_output(task, TFTP_ENDEF);
+                    retval = 0;
+                    break;
+                }
+                bufsize = nread;
+                P_DEBUG("read %d bytes from file.\n", bufsize);
+
+                /* encapsulation data */
+                tpkt->Opcode = htons(TFTP_DATA);
+                tdata->BlockN = htons(blk_wire(task, filln));
+                task_set_rbufsize(task, filln,
+                                  TFTP_HDLEN + TFTP_DATA_HDLEN + bufsize);
+                if (data != NULL) task_set_rbufext(task, filln, data);
+            }
+            if (bufsize < max) task_set_type(task, TASK_TYPE_CWAIT); /* EOF */
+            task_set_filln(task, ++filln);
+            fresh = 1;
+        }
+
+        /* output packet */
+        output_ok = block_output(task, sendn);
+        if (output_ok == 0) {
+            /* blocks not sent are left to retrans timer. */
+            P_WARNING("block_output() failed.\n");
+            retval = 0;
+            break;
+        }
+        task_stamp_rbuf(task, sendn, fresh);
+        if (fresh && task_get_fec(task) > 0 &&
+            (sendn % task_get_fec(task) == 0 ||
+             task_get_type(task) == TASK_TYPE_CWAIT)) {
+            /* last block of parity group */
+            if (parity_output(task, sendn) == 0) {
+                P_WARNING("parity_output() failed.\n");
+            }
+        }
+        task_set_sendn(task, ++sendn);
+        burst++;
+    }
+    task_set_burst(task, burst);
+
+    /* cwnd is used up, send the rest of window after a round trip. */
+    if (retval == 1 && burst >= cwnd && sendn - blockn < window &&
+        blockn != 0 &&
+        (sendn != filln || task_get_type(task) != TASK_TYPE_CWAIT)) {
+        srtt = task_get_srtt(task);
+        task_set_pace(task, srtt > 0 ? srtt : task_get_rinit(task));
+        PaceCounter++;
+    } else {
+        task_set_pace(task, 0);
+    }
+
+    return retval;
+}
+
+static int
+block_output(TASK *task, u_int32_t blockn)
+{
+    int output_ok;
+    size_t rbufsize;
+    const u_int8_t *ext;
+    struct pkt_buff *pkb;
+
+    /* set up packet buffer from retrans buffer */
+    rbufsize = task_get_rbufsize(task, blockn);
+    ext = task_get_rbufext(task, blockn);
+    if (task_get_rbufpkt(task, blockn) != NULL) {
+        /* whole packet from the image, nothing is copied */
+        pkb = pkb_alloc(0);
+        if (pkb == NULL) {
+            P_WARNING("pkb_alloc() failed.\n");
+            return 0;
+        }
+        pkb->ext = task_get_rbufpkt(task, blockn);
+        pkb->extlen = rbufsize;
+    } else if (ext != NULL) {
+        /* only header is copied, data follows from the mapping */
+        if (stream_check(task_get_stream(task)) == 0) {
+            error_output(task, TFTP_ENDEF);
+            return 0;
+        }
+        pkb = pkb_alloc(TFTP_HDLEN + TFTP_DATA_HDLEN);
+        if (pkb == NULL) {
+            P_WARNING("pkb_alloc() failed.\n");
             return 0;
         }
-        task_set_type(task, TASK_TYPE_CWAIT);
+        memcpy(pkb->payload, task_get_rbuf(task, blockn), pkb->size);
+        pkb->ext = ext;
+        pkb->extlen = rbufsize - pkb->size;
+    } else {
+        pkb = pkb_alloc(rbufsize);
+        if (pkb == NULL) {
+            P_WARNING("pkb_alloc() failed.\n");
+            return 0;
+        }
+        memcpy(pkb->payload, task_get_rbuf(task, blockn), rbufsize);
+    }
+    mcast_setaddr(task, pkb); /* group sends to multicast address */
+
+    /* output packet */
+    output_ok = tftp_output(task_get_sockfd(task), pkb);
+    if (output_ok == 0) {
+        P_WARNING("tftp_output() failed.\n");
+        return 0;
+    }
+    P_DEBUG("Task %d output block %d.\n", task_get_id(task), blockn);
+
+    return 1;
+}
+
+/*
+ * Send parity of the group ends with blockn (see x-fec in proto_tftp.h).
+ * All blocks of the group are still in retrans buffer, because the
+ * group size is not larger than the window.
+ */
+static int
+parity_output(TASK *task, u_int32_t blockn)
+{
+    int output_ok;
+    size_t len, maxlen, i;
+    u_int16_t lenxor;
+    u_int32_t first, walk;
+    const u_int8_t *data;
+    struct pkt_buff *pkb;
+    struct tftp_pkt *tpkt, *bpkt;
+    struct tftp_parity *tpar;
+
+    /* initialize variables */
+    if (stream_check(task_get_stream(task)) == 0) return 0;
+    first = (blockn - 1) / task_get_fec(task) * task_get_fec(task) + 1;
+    maxlen = 0;
+    for (walk = first; walk <= blockn; walk++) {
+        len = task_get_rbufsize(task, walk) - TFTP_HDLEN - TFTP_DATA_HDLEN;
+        if (len > maxlen) maxlen = len;
     }
 
     /* set up packet buffer */
-    pkb = pkb_alloc(TFTP_HDLEN + TFTP_DATA_HDLEN + bufsize);
+    pkb = pkb_alloc(TFTP_HDLEN + TFTP_PARITY_HDLEN + maxlen);
     if (pkb == NULL) {
         P_WARNING("pkb_alloc() failed.\n");
         return 0;
     }
     tpkt = PKB_TO_TFTP(pkb);
-    tdata = TFTP_TO_DATA(tpkt);
-
-    /* encapsulation data */
-    tpkt->Opcode = htons(TFTP_DATA);
-    tdata->BlockN = htons(task_get_blockn(task));
-    memcpy(tdata->Data, buf, bufsize);
+    tpar = TFTP_TO_PARITY(tpkt);
+    memset(tpar->Data, 0, maxlen);
+
+    /* XOR data of the group */
+    lenxor = 0;
+    for (walk = first; walk <= blockn; walk++) {
+        len = task_get_rbufsize(task, walk) - TFTP_HDLEN - TFTP_DATA_HDLEN;
+        bpkt = (struct tftp_pkt *)task_get_rbuf(task, walk);
+        data = TFTP_TO_DATA(bpkt)->Data;
+        if (task_get_rbufext(task, walk) != NULL)
+            data = task_get_rbufext(task, walk);
+        for (i = 0; i < len; i++) tpar->Data[i] ^= data[i];
+        lenxor ^= (u_int16_t)len;
+    }
 
-    /* store packet in retrans buffer */
-    rbufsize = TFTP_HDLEN + TFTP_DATA_HDLEN + bufsize;
-    task_set_rbufsize(task, rbufsize);
-    memcpy(rbuf, pkb->payload, rbufsize);
+    /* encapsulation */
+    tpkt->Opcode = htons(TFTP_PARITY);
+    tpar->BlockN = htons(blk_wire(task, first));
+    tpar->Count = htons((u_int16_t)(blockn - first + 1));
+    tpar->LenXor = htons(lenxor);
 
     /* output packet */
     output_ok = tftp_output(task_get_sockfd(task), pkb);
@@ -595,20 +1450,342 @@ data_output(TASK *task)
         P_WARNING("tftp_output() failed.\n");
         return 0;
     }
-    P_DEBUG("Task %d output block %d.\n", task_get_id(task),
-            task_get_blockn(task));
+    ParityCounter++;
+    P_DEBUG("Task %d output parity of block %d-%d.\n",
+            task_get_id(task), first, blockn);
+
+    return 1;
+}
+
+/* block number on the wire. see TFTP_FILE_MAX_SIZE in proto_tftp.h */
+static u_int16_t
+blk_wire(TASK *task, u_int32_t blockn)
+{
+    if (blockn == 0) return 0;
+    if (task_get_rollover(task) == 1) {
+        /* 65535 -> 1 */
+        return (u_int16_t)((blockn - 1) % TFTP_BLOCK_MAX + 1);
+    }
+
+    /* 65535 -> 0 */
+    return (u_int16_t)blockn;
+}
 
+/*
+ * Continue the group from the block next to what the new master has.
+ * The master can't have blocks not sent yet, so the last one sent
+ * with the number is taken.
+ */
+static int
+mcast_resume(TASK *task, u_int16_t received)
+{
+    int send_ok;
+    size_t blksize;
+    u_int32_t blockn, last;
+
+    blksize = task_get_blksize(task);
+    for (blockn = task_get_filln(task) - 1; blockn > 0; blockn--) {
+        if (blk_wire(task, blockn) == received) break;
+    }
+    last = task_get_fsize(task) / blksize + 1;
+    if (blockn >= last) {
+        /* master already has whole file */
+        return mcast_handover(task);
+    }
+    P_DEBUG("Task %d: Group resumes from block %d.\n",
+            task_get_id(task), blockn + 1);
+
+    /* blocks are read by offset, just rewind the block numbers */
+    task_set_type(task, TASK_TYPE_READ);
+    task_set_blockn(task, blockn + 1);
+    task_set_sendn(task, blockn + 1);
+    task_set_filln(task, blockn + 1);
+
+    send_ok = data_output(task);
+    if (send_ok == 0) {
+        P_WARNING("data_output() failed.\n");
+    }
+
+    return send_ok;
+}
+
+/* current master is done, ask next one. the group ends if none. */
+static int
+mcast_handover(TASK *task)
+{
+    int send_ok;
+
+    if (mcast_next(task) == 0) {
+        P_INFO("Task %d: All clients of the group done.\n",
+               task_get_id(task));
+        task_join(task, TASK_EXIT_NORMAL);
+        return 1;
+    }
+
+    task_set_state(task, TASK_ST_SEND);
+    send_ok = mcast_oack(task);
+    if (send_ok == 0) {
+        P_WARNING("mcast_oack() failed.\n");
+    }
+    OackCounter++;
     task_set_state(task, TASK_ST_WACK);
 
     return 1;
 }
 
+/* option related */
+static int
+opt_negotiate(TASK *task, struct tftp_req_str *reqs)
+{
+    int i, j, accepted;
+    unsigned int opts;
+    size_t len, namelen, vallen;
+    char reply[TFTP_OPT_VALLEN];
+    char oack[FILE_BUFSIZE];
+    struct tftp_pkt *tpkt;
+
+    /* initialize variables */
+    tpkt = (struct tftp_pkt *)oack;
+    tpkt->Opcode = htons(TFTP_OACK);
+    len = TFTP_HDLEN + TFTP_OACK_HDLEN;
+    accepted = 0;
+    opts = 0;
+
+    for (j = 0; opt_table[j].name != NULL; j++) {
+        for (i = 0; i < reqs->nopts; i++) {
+            if (strcasecmp(opt_table[j].name, reqs->Opts[i].Name) == 0)
+                break;
+        }
+        if (i == reqs->nopts) continue; /* not requested */
+        if (opt_table[j].handler(task, reqs->Opts[i].Value, reply) == 0) {
+            P_INFO("Task %d: option %s=%s rejected.\n", task_get_id(task),
+                   reqs->Opts[i].Name, reqs->Opts[i].Value);
+            continue;
+        }
+
+        namelen = strlen(opt_table[j].name) + 1;
+        vallen = strlen(reply) + 1;
+        if (len + namelen + vallen > sizeof(oack)) {
+            P_WARNING("Too many options. OACK trancated.\n");
+            break;
+        }
+        memcpy(oack + len, opt_table[j].name, namelen);
+        len += namelen;
+        memcpy(oack + len, reply, vallen);
+        len += vallen;
+        opts |= opt_table[j].flag;
+        accepted++;
+
+        P_INFO("Task %d: option %s=%s accepted.\n",
+               task_get_id(task), opt_table[j].name, reply);
+    }
+
+    if (accepted == 0) return 0;
+    task_set_opts(task, opts);
+
+    /* OACK occupies block 0 and is retransmitted like data blocks. */
+    task_set_blockn(task, 0);
+    memcpy(task_get_rbuf(task, 0), oack, len);
+    task_set_rbufsize(task, 0, len);
+
+    return accepted;
+}
+
+static int
+opt_multicast(TASK *task, const char *value, char *reply)
+{
+    /* RFC2090 Page 2: request has the option with empty value. */
+    if (TFTP_Mcast_Addr == NULL) return 0;
+    if (task_get_type(task) != TASK_TYPE_READ) return 0;
+    if (task_get_mode(task) != TFTP_MODE_OCTET) return 0; /* group is octet */
+    if (task_get_caddr(task) == NULL ||
+        task_get_caddr(task)->sa_family != AF_INET) return 0;
+
+    /* tell the options below. reply is rewritten by the group. */
+    task_set_opts(task, task_get_opts(task) | TFTP_OPTF_MULTICAST);
+    reply[0] = '\0';
+
+    return 1;
+}
+
+static int
+opt_blksize(TASK *task, const char *value, char *reply)
+{
+    long blksize, limit;
+    int mtu;
+
+    /* RFC2348 Page 2: valid values range between 8 and 65464 */
+    blksize = opt_atol(value, TFTP_BLKSIZE_MIN, TFTP_BLKSIZE_MAX);
+    if (blksize < 0) return 0;
+
+    /* keep DATA packet in path MTU (see NOTE in proto_tftp.h) */
+    mtu = udp_get_mtu(task_get_sockfd(task));
+    if (task_get_pmtu(task) > 0 && (mtu <= 0 || task_get_pmtu(task) < mtu))
+        mtu = task_get_pmtu(task);
+    if (mtu > 0) {
+        task_set_pmtu(task, mtu);
+        limit = mtu - UDP_IP_HDLEN - TFTP_HDLEN - TFTP_DATA_HDLEN;
+        if (limit < TFTP_DATA_MAX_SIZE) limit = TFTP_DATA_MAX_SIZE;
+        if (blksize > limit) {
+            P_INFO("Task %d: blksize %ld clamped to %ld by path MTU %d.\n",
+                   task_get_id(task), blksize, limit, mtu);
+            blksize = limit;
+            ClampCounter++;
+        }
+    }
+
+    /* DATA of WRQ must fit in receive buffer */
+    limit = RECV_BUFSIZE - TFTP_HDLEN - TFTP_DATA_HDLEN;
+    if (task_get_type(task) == TASK_TYPE_WRITE && blksize > limit) {
+        blksize = limit;
+        ClampCounter++;
+    }
+
+    /* RFC2348 Page 2: server may reply with a smaller value */
+    if (task_set_blksize(task, blksize) == 0) {
+        P_WARNING("task_set_blksize() failed.\n");
+        return 0;
+    }
+    snprintf(reply, TFTP_OPT_VALLEN, "%ld", blksize);
+
+    return 1;
+}
+
+static int
+opt_windowsize(TASK *task, const char *value, char *reply)
+{
+    long window;
+
+    /* multicast group is lock-step with master client */
+    if (task_get_opts(task) & TFTP_OPTF_MULTICAST) return 0;
+
+    /* RFC7440 Page 3: valid values range between 1 and 65535 */
+    window = opt_atol(value, 1, 65535);
+    if (window < 0) return 0;
+    if (window > TFTP_WINDOW_MAX) window = TFTP_WINDOW_MAX;
+
+    if (task_set_window(task, window) == 0) {
+        P_WARNING("task_set_window() failed.\n");
+        return 0;
+    }
+    snprintf(reply, TFTP_OPT_VALLEN, "%ld", window);
+
+    return 1;
+}
+
+static int
+opt_tsize(TASK *task, const char *value, char *reply)
+{
+    long tsize;
+
+    /* RFC2349 Page 2: WRQ tells the file size, and OACK echoes it. */
+    tsize = opt_atol(value, 0, LONG_MAX);
+    if (tsize < 0) return 0;
+    if (task_get_type(task) == TASK_TYPE_WRITE) task_set_fsize(task, tsize);
+
+    /* RRQ has tsize 0, OACK returns the file size. */
+
+    snprintf(reply, TFTP_OPT_VALLEN, "%lld", (long long)task_get_fsize(task));
+
+    return 1;
+}
+
+static int
+opt_timeout(TASK *task, const char *value, char *reply)
+{
+    long sec;
+
+    /* RFC2349 Page 2: valid values range between 1 and 255 seconds */
+    sec = opt_atol(value, 1, 255);
+    if (sec < 0) return 0;
+
+    /* client specified the interval, so don't back off nor adapt. */
+    task_set_rinit(task, sec * 1000 * 1000);
+    task_set_rbackoff(task, 1);
+    task_set_rttadaptive(task, 0);
+    snprintf(reply, TFTP_OPT_VALLEN, "%ld", sec);
+
+    return 1;
+}
+
+static int
+opt_utimeout(TASK *task, const char *value, char *reply)
+{
+    long usec;
+
+    /* same as timeout, but in [us] for fast networks */
+    usec = opt_atol(value, TFTP_UTIMEOUT_MIN, 255 * 1000 * 1000);
+    if (usec < 0) return 0;
+
+    task_set_rinit(task, usec);
+    task_set_rbackoff(task, 1);
+    task_set_rttadaptive(task, 0);
+    snprintf(reply, TFTP_OPT_VALLEN, "%ld", usec);
+
+    return 1;
+}
+
+static int
+opt_rollover(TASK *task, const char *value, char *reply)
+{
+    long rollover;
+
+    /* multicast group uses the default of server */
+    if (task_get_opts(task) & TFTP_OPTF_MULTICAST) return 0;
+
+    /* client tells the block number after 65535 */
+    rollover = opt_atol(value, 0, 1);
+    if (rollover < 0) return 0;
+
+    task_set_rollover(task, rollover);
+    snprintf(reply, TFTP_OPT_VALLEN, "%ld", rollover);
+
+    return 1;
+}
+
+static int
+opt_fec(TASK *task, const char *value, char *reply)
+{
+    long group;
+    unsigned int window;
+
+    /* experimental: blocks per parity group */
+    group = opt_atol(value, 2, TFTP_FEC_MAX);
+    if (group < 0) return 0;
+
+    /* parity is useless in lock-step, and the group must fit in window */
+    if (task_get_type(task) != TASK_TYPE_READ) return 0;
+    window = task_get_window(task);
+    if (window < 2) return 0;
+    if (group > window) group = window;
+
+    task_set_fec(task, group);
+    snprintf(reply, TFTP_OPT_VALLEN, "%ld", group);
+
+    return 1;
+}
+
+static long
+opt_atol(const char *value, long min, long max)
+{
+    long n;
+    char *end;
+
+    errno = 0;
+    n = strtol(value, &end, 10);
+    if (errno != 0 || *value == '\0' || *end != '\0') return -1;
+    if (n < min || n > max) return -1;
+
+    return n;
+}
+
 /* misc */
 static struct tftp_req_str *
 parse_req(struct pkt_buff *pkb)
 {
     int i, pkt_ok;
     unsigned char *walk;
+    char *opt, *name, *val, *end;
     struct tftp_req_str *reqs;
     struct tftp_pkt *tpkt;
     struct tftp_req *treq;
@@ -656,23 +1833,68 @@ parse_req(struct pkt_buff *pkb)
         return NULL;
     }
 
+    /* RFC2347: option and value pairs may follow Mode */
+    reqs->nopts = 0;
+    end = (char *)pkb->payload + pkb->size;
+    for (pkt_ok=1, name=(char *)walk + 1; name < end; name = val) {
+        opt = scan_str(name, end);
+        val = (opt != NULL) ? scan_str(opt, end) : NULL;
+        if (val == NULL) {
+            pkt_ok = 0;
+            break;
+        }
+        if (reqs->nopts >= TFTP_OPT_MAX) {
+            P_DEBUG("Too many options. \"%s\" ignored.\n", name);
+            continue;
+        }
+        reqs->Opts[reqs->nopts].Name = name;
+        reqs->Opts[reqs->nopts].Value = opt;
+        reqs->nopts++;
+    }
+    if (pkt_ok == 0) {
+        P_WARNING("The packet seemed to broken.\n");
+        safe_free(reqs);
+        return NULL;
+    }
+
     P_DEBUG("Requsted file name is \"%s\".\n", reqs->Filename);
     P_DEBUG("Transfer mode is \"%s\".\n", reqs->Mode);
+    P_DEBUG("%d option(s) found.\n", reqs->nopts);
 
     return reqs;
 }
 
+/* returns next octet of terminating '\0', or NULL if not terminated */
+static char *
+scan_str(char *walk, char *end)
+{
+    while (walk < end) {
+        if (*walk++ == '\0') return walk;
+    }
+
+    return NULL;
+}
+
 static int
-check_filest(char *fname)
+check_filest(char *fname, off_t *size)
 {
     int st_ok, retval;
     struct stat st;
 
-    st_ok = stat(fname, &st);
+    /* single probe of the index, see dirindex.h */
+    st_ok = dirindex_stat(fname, &st);
+    if (st_ok == 0) return FILE_ST_ENOENT;
+
+    if (st_ok < 0) {
+        /* known to be missing, see negcache.h */
+        if (negcache_lookup(fname)) return FILE_ST_ENOENT;
+        st_ok = stat(fname, &st);
+    }
 
     if (st_ok < 0) {
         switch (errno) {
             case ENOENT:
+                negcache_add(fname);
                 retval = FILE_ST_ENOENT;
                 break;
             case EACCES:
@@ -686,7 +1908,8 @@ check_filest(char *fname)
         return retval;
     }
 
-    P_DEBUG("file size is %d bytes.\n", st.st_size);
+    P_DEBUG("file size is %lld bytes.\n", (long long)st.st_size);
+    *size = st.st_size;
     if (st.st_size > TFTP_FILE_MAX_SIZE) {
         return FILE_ST_TOOBIG;
     }
@@ -697,6 +1920,33 @@ check_filest(char *fname)
     return FILE_ST_OK;
 }
 
+/* existing file may be replaced by WRQ only if it is world writable */
+static int
+check_writable(const char *fname)
+{
+    struct stat st;
+
+    if (stat(fname, &st) < 0) return errno == ENOENT;
+
+    return S_ISREG(st.st_mode) && (st.st_mode & S_IWOTH) != 0;
+}
+
+/* name to write. must be relative, and not go up by "..". */
+static int
+check_fname(const char *fname)
+{
+    const char *walk;
+
+    if (fname[0] == '\0' || fname[0] == '/') return 0;
+    for (walk = fname; walk != NULL; walk = strchr(walk, '/')) {
+        if (*walk == '/') walk++;
+        if (strncmp(walk, "..", 2) == 0 && (walk[2] == '/' || walk[2] == '\0'))
+            return 0;
+    }
+
+    return 1;
+}
+
 static int check_pktlen(int opcode, int size)
 {
     /* see proto_tftp.h: tftp_opcode */
@@ -707,6 +1957,8 @@ static int check_pktlen(int opcode, int size)
         TFTP_HDLEN + TFTP_DATA_HDLEN,    /* DATA */
         TFTP_HDLEN + TFTP_ACK_HDLEN,     /* ACK */
         TFTP_HDLEN + TFTP_ERR_HDLEN + 1, /* ERR */
+        TFTP_HDLEN + TFTP_OACK_HDLEN,    /* OACK */
+        TFTP_HDLEN + TFTP_PARITY_HDLEN,  /* PARITY */
     };
 
     if (size < min_table[opcode]) {
@@ -47,17 +47,49 @@ extern "C" {
 #include "pkt_buff.h"
 #include "task.h"
 
+enum tftp_opt_params {
+    TFTP_OPT_MAX = 16,                   /* max options in one request */
+    TFTP_OPT_VALLEN = 32,                /* max length of option value */
+    TFTP_ERR_PKTMAX = 64,                /* max length of error packet */
+};
+
+/* bits of options acknowledged, see task_get_opts() */
+enum tftp_opt_flags {
+    TFTP_OPTF_WINDOWSIZE = 0x01,
+    TFTP_OPTF_TSIZE      = 0x02,
+    TFTP_OPTF_TIMEOUT    = 0x04,
+    TFTP_OPTF_UTIMEOUT   = 0x08,
+    TFTP_OPTF_ROLLOVER   = 0x10,
+    TFTP_OPTF_BLKSIZE    = 0x20,
+    TFTP_OPTF_FEC        = 0x40,
+    TFTP_OPTF_MULTICAST  = 0x80,
+};
+
+/* transfer mode, see task_get_mode() */
+enum tftp_mode {
+    TFTP_MODE_OCTET,
+    TFTP_MODE_NETASCII,
+};
+
 /* From RFC1350 Page 6 */ 
 struct tftp_req {
     u_int8_t string[0];         /* We must find out the separater '\0' */
 };
 #define TFTP_REQ_HDLEN (0)
 
+/* From RFC2347 Page 2: options follow Mode */
+struct tftp_opt_str {
+    char *Name;
+    char *Value;
+};
+
 struct tftp_req_str {
     size_t fname_len;
     size_t mode_len;
     char *Filename;
     char *Mode;
+    int nopts;
+    struct tftp_opt_str Opts[TFTP_OPT_MAX];
 };
 
 /* From RFC1350 Page 7 */ 
@@ -80,6 +112,21 @@ struct tftp_err {
 };
 #define TFTP_ERR_HDLEN (sizeof(u_int16_t))
 
+/* From RFC2347 Page 3 */
+struct tftp_oack {
+    u_int8_t string[0];         /* option/value pairs, '\0' separated */
+};
+#define TFTP_OACK_HDLEN (0)
+
+/* Parity of a group of DATA blocks (experimental, x-fec option) */
+struct tftp_parity {
+    u_int16_t BlockN;           /* 1st block of the group */
+    u_int16_t Count;            /* number of blocks in the group */
+    u_int16_t LenXor;           /* XOR of data length of the blocks */
+    u_int8_t  Data[0];          /* XOR of data, zero padded */
+};
+#define TFTP_PARITY_HDLEN (3 * sizeof(u_int16_t))
+
 /* Generic tftp packet structure */
 struct tftp_pkt {
     u_int16_t Opcode;
@@ -96,6 +143,8 @@ struct tftp_pkt {
 #define TFTP_TO_DATA(tpkt) ((struct tftp_data *) &(tpkt->payload))
 #define TFTP_TO_ACK(tpkt)  ((struct tftp_ack *)  &(tpkt->payload))
 #define TFTP_TO_ERR(tpkt)  ((struct tftp_err *)  &(tpkt->payload))
+#define TFTP_TO_OACK(tpkt) ((struct tftp_oack *) &(tpkt->payload))
+#define TFTP_TO_PARITY(tpkt) ((struct tftp_parity *) &(tpkt->payload))
 
 /* From RFC1350 Page 4 */
 enum tftp_opcode {
@@ -104,6 +153,8 @@ enum tftp_opcode {
     TFTP_DATA  = 0x03,      /* Data */
     TFTP_ACK   = 0x04,      /* Ack */
     TFTP_ERROR = 0x05,      /* Error */
+    TFTP_OACK  = 0x06,      /* Option Acknowledgment (RFC2347) */
+    TFTP_PARITY = 0x07,     /* Parity (experimental, x-fec option) */
     TFTP_LAST
 };
 
@@ -117,53 +168,129 @@ enum tftp_errcode {
     TFTP_ETID        = 0x05, /* Unknown tranfer ID */
     TFTP_EEXIST      = 0x06, /* File already exists */
     TFTP_ENOUSER     = 0x07, /* No such user. */
+    TFTP_EOPTION     = 0x08, /* Option negotiation failed (RFC2347) */
 
     /* following definition is internal use only */
     TFTP_ENONE,              /* No error detected. */
     TFTP_ELAST
 };
 
+int tftp_init(void);
 int tftp_input(TASK *task, struct pkt_buff *pkb);
 int tftp_output(int sockfd, struct pkt_buff *pkb);
 int tftp_retrans(TASK *task);
+int tftp_pace(TASK *task);
 void tftp_report(void);
 
 enum tftp_params {
     TFTP_DATA_MAX_SIZE = 512,            /* max size of data packet's payload */
-    TFTP_FILE_MAX_SIZE = 65535 * 512 - 1,/* Max file size */
+    TFTP_BLKSIZE_MIN = 8,                /* RFC2348 min blksize */
+    TFTP_BLKSIZE_MAX = 65464,            /* RFC2348 max blksize */
+    TFTP_BLOCK_MAX = 65535,              /* max block number on the wire */
     RETRANS_MAX = 5,                     /* max retransmit packet */
     RETRANS_INIT_INTERVAL = 500 * 1000,  /* initial retrans interval [us] */
     RETRANS_BACKOFF_FACTOR = 2,          /* backoff factor */
+    TFTP_WINDOW_MAX = 64,                /* max windowsize we accept */
+    TFTP_UTIMEOUT_MIN = 10 * 1000,       /* min utimeout we accept [us] */
+    TFTP_FEC_MAX = 16,                   /* max blocks per parity group */
 };
 
+/* Max file size. off_t may be larger than enum. */
+#define TFTP_FILE_ROLL_SIZE(blksize) \
+    ((off_t)0xffffffffUL * (blksize) - 1)
+#define TFTP_FILE_NOROLL_SIZE(blksize) \
+    ((off_t)TFTP_BLOCK_MAX * (blksize) - 1)
+#define TFTP_FILE_MAX_SIZE TFTP_FILE_ROLL_SIZE(TFTP_BLKSIZE_MAX)
+
 /*
  * NOTE:
  *
  * - TFTP_DATA_MAX_SIZE
  *     In RFC1350, Payload size of TFTP data packet is 512 [bytes].
  *   So you never change this except you build your own protocol.
- *     proto_private.h define Max size of retrans buffer. If you change
- *   TFTP_DATA_MAX_SIZE you should change it.
+ *   RFC2348 blksize option changes it per session. Slots of retrans
+ *   buffer are resized to the block size negotiated.
+ *
+ * - blksize and path MTU
+ *     Blocks larger than path MTU are fragmented, and one lost fragment
+ *   loses the whole block. Transfer sockets are opened with DF bit
+ *   (IP_MTU_DISCOVER) where supported, and requested blksize is
+ *   clamped to IP_MTU of the socket (and to MTU saved in client
+ *   memory) minus IP, UDP and TFTP headers. Once OACK is sent the
+ *   block size can't be changed, so if send fails with EMSGSIZE later
+ *   (path MTU shrank), fragmentation is allowed for the rest of the
+ *   session and the new MTU is saved for the next one.
  *
  * - TFTP_FILE_MAX_SIZE
  *     In RFC1350, block number of TFTP data packet is 16bit width.
  *   And block number MUST unique. So max file size is limited to
- *   65535 * 512 - 1 [bytes]. Remember that block number start from 1 
- *   and last block size < 512.
+ *   65535 * 512 - 1 [bytes] (TFTP_FILE_NOROLL_SIZE). Remember that
+ *   block number start from 1 and last block size < 512. With blksize
+ *   option, 512 is read as the block size negotiated.
+ *     Most clients accept block number rollover, that is, the block
+ *   after 65535 is 0 (or 1 for some clients). Block numbers are kept
+ *   in 32bit internally and folded into 16bit on output, so the limit
+ *   is (2^32 - 1) * 512 - 1 [bytes] (TFTP_FILE_ROLL_SIZE). Rollover
+ *   value is given by -R and may be changed by "rollover" option per
+ *   session. If rollover is disabled, TFTP_FILE_NOROLL_SIZE is the
+ *   limit.
+ *     Both limits depend on the block size, which is known only after
+ *   options are negotiated. TFTP_FILE_MAX_SIZE (the limit for the max
+ *   blksize) is checked when the file is opened, and the limit for the
+ *   negotiated blksize after that.
+ *
+ * - TFTP_WINDOW_MAX
+ *     RFC7440 allows windowsize up to 65535 blocks. Each block in the
+ *   window occupies a slot of retrans buffer (see task_private.h), so
+ *   requests larger than this are negotiated down to TFTP_WINDOW_MAX.
+ *
+ * - x-fec option (experimental)
+ *     "x-fec" = K asks the server to send a PARITY packet (opcode 7)
+ *   after every K DATA blocks: block numbers 1..K, K+1..2K, and so on
+ *   make a group, and the last group may be shorter. Data of the group
+ *   is zero padded to the longest one and XORed, so the client can
+ *   rebuild one lost block per group without waiting for retransmit.
+ *   Length of the lost block is rebuilt from LenXor in the same way.
+ *     Parity is sent only after the first transmission of the last
+ *   block of the group. Resent blocks have no parity.
+ *     In lock-step transfer every block is acked before the next one
+ *   is sent, so parity arrives too late to help. The option is
+ *   accepted only with windowsize, and K is limited to the window
+ *   (all blocks of the group must be in retrans buffer). A client
+ *   using it should hold back the ack for a gap until the parity of
+ *   the group arrived. fec_test ("make fec_test") is such a client,
+ *   and checks that a block lost in every group is rebuilt.
  *
  * - Retransmit timing
  *     In RFC1123, TFTP MUST support exponential back off.
  *   But RFC1123 doesn't specify actual parameters.
  *   Any users should redefine retransmit timings to fit to
  *   there site.
- *     task.h specify select() timeout parameter. If you change
- *   retransmit timigs, you should also change it.
+ *     RETRANS_INIT_INTERVAL and RETRANS_MAX are only defaults. They can
+ *   be changed by command line (-t, -n), and each session copies them
+ *   into TASK. RFC2349 timeout option (or utimeout) overrides the
+ *   interval of the session and disables back off.
+ *
+ * - Stateless error reply
+ *     RRQ with unsupported mode, or for a file which can't be read
+ *   (mostly not found, e.g. PXE clients probing pxelinux.cfg/), is
+ *   answered before any task is made. The error packet is taken
+ *   from the table encoded by tftp_init() and sent from one socket
+ *   shared by all such replies, with the source address the request
+ *   came to. Error is never retransmitted (RFC1350), so nothing is
+ *   left behind. Errors found later, e.g. by option negotiation,
+ *   are sent by the task as before.
  *
  *
  * [Refernces]
  *   RFC764  Telenet Protocol Specification
  *   RFC1123 Requirements for Internet Hosts -- Applications and Support
+ *   RFC1191 Path MTU Discovery
  *   RFC1350 TFTP Revision 2
+ *   RFC2347 TFTP Option Extension
+ *   RFC2348 TFTP Blocksize Option
+ *   RFC2349 TFTP Timeout Interval and Transfer Size Options
+ *   RFC7440 TFTP Windowsize Option
  */
 #ifdef __cplusplus
 }
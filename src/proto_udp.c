@@ -56,6 +56,7 @@
 #include "pkt_buff.h"
 #include "proto_udp.h"
 #include "proto_tftp.h"
+#include "mcast.h"
 #include "util.h"
 #include "debug.h"
 
@@ -69,9 +70,13 @@
  */
 static unsigned int InputCounter = 0;
 static unsigned int OutputCounter = 0;
+static unsigned int FragmentCounter = 0;
+static unsigned int ReplyCounter = 0;
+static int ReplyFd = -1;            /* shared by replies without task */
 
 /* forward declarations of private function */
 struct pkt_buff *udp_recv(int sockfd);
+static int pkb_send(int sockfd, struct pkt_buff *pkb);
 
 /*
  * Exported functions
@@ -263,6 +268,9 @@ open_transfer(struct sockaddr *local, struct sockaddr *dest, socklen_t addrlen)
 #ifdef DSTADDR_OPT
     int on = 1;
 #endif
+#ifdef UDP_PMTU
+    int pmtudisc;
+#endif
 
     sockfd = socket(PF_INET, SOCK_DGRAM, 0);
     if (sockfd < 0) {
@@ -289,6 +297,62 @@ open_transfer(struct sockaddr *local, struct sockaddr *dest, socklen_t addrlen)
         close(sockfd);
         return -1;
     }
+#ifdef UDP_PMTU
+    /* set DF bit. packets larger than path MTU fail with EMSGSIZE. */
+    pmtudisc = IP_PMTUDISC_DO;
+    if ( setsockopt(sockfd, IPPROTO_IP, IP_MTU_DISCOVER,
+                    &pmtudisc, sizeof(pmtudisc)) < 0) {
+        P_WARNING("setsockopt() failed: %s.\n", strerror(errno));
+    }
+#endif
+
+    return sockfd;
+}
+
+/*
+ * Socket of a multicast group (RFC2090). Not connected, destination
+ * is given to each packet by pkb_setaddr().
+ */
+int
+open_group(struct sockaddr *local, socklen_t addrlen)
+{
+    int sockfd;
+    unsigned char ttl = MCAST_TTL;
+    struct in_addr ifaddr;
+#ifdef DSTADDR_OPT
+    int on = 1;
+#endif
+
+    sockfd = socket(PF_INET, SOCK_DGRAM, 0);
+    if (sockfd < 0) {
+        P_WARNING("sockfd() failed: %s.\n", strerror(errno));
+        return -1;
+    }
+
+#ifdef DSTADDR_OPT
+    if ( setsockopt(sockfd, IPPROTO_IP, DSTADDR_OPT, &on, sizeof(on)) < 0) {
+        P_WARNING("setsockopt() failed: %s.\n", strerror(errno));
+        close(sockfd);
+        return -1;
+    }
+#endif
+    ifaddr = ((struct sockaddr_in *)local)->sin_addr;
+    if (ifaddr.s_addr != INADDR_ANY) {
+        if ( bind(sockfd, local, addrlen) < 0) {
+            P_WARNING("bind() failed: %s.\n", strerror(errno));
+            close(sockfd);
+            return -1;
+        }
+        /* group is sent from the interface the requests came to */
+        if ( setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_IF,
+                        &ifaddr, sizeof(ifaddr)) < 0) {
+            P_WARNING("setsockopt() failed: %s.\n", strerror(errno));
+        }
+    }
+    if ( setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_TTL,
+                    &ttl, sizeof(ttl)) < 0) {
+        P_WARNING("setsockopt() failed: %s.\n", strerror(errno));
+    }
 
     return sockfd;
 }
@@ -310,6 +374,9 @@ int
 udp_output(int sockfd, struct pkt_buff *pkb)
 {
     int sendto_ok, retval = 1;
+#ifdef UDP_PMTU
+    int pmtudisc;
+#endif
 
     if (is_socket(sockfd) == 0) {
         P_WARNING("fd %d is not a socket.\n", sockfd);
@@ -323,7 +390,23 @@ udp_output(int sockfd, struct pkt_buff *pkb)
     /* XXX: sockfd may be not task id */
     P_DEBUG("Task %d: Sending UDP %d octed packet.\n",
             sockfd, pkb->size);
-    sendto_ok = send(sockfd, pkb->payload, pkb->size, 0);
+    sendto_ok = pkb_send(sockfd, pkb);
+#ifdef UDP_PMTU
+    if (sendto_ok < 0 && errno == EMSGSIZE) {
+        /*
+         * Path MTU shrank after block size was negotiated. Block size
+         * can't be changed now, so let the rest be fragmented.
+         */
+        P_INFO("fd %d: %d octet packet exceeds path MTU %d. "
+               "Fragmentation allowed.\n",
+               sockfd, pkb->size, udp_get_mtu(sockfd));
+        pmtudisc = IP_PMTUDISC_DONT;
+        setsockopt(sockfd, IPPROTO_IP, IP_MTU_DISCOVER,
+                   &pmtudisc, sizeof(pmtudisc));
+        FragmentCounter++;
+        sendto_ok = pkb_send(sockfd, pkb);
+    }
+#endif
     if (sendto_ok < 0) {
         P_WARNING("sendto() failed: %s\n", strerror(errno));
         retval = 0;
@@ -335,6 +418,64 @@ udp_output(int sockfd, struct pkt_buff *pkb)
     return retval;
 }
 
+/*
+ * Send buf to dest from the shared reply socket, for answers which
+ * need no task (see error_reply() in proto_tftp.c). The source address
+ * is local, the address the request came to, if it's known.
+ */
+int
+udp_reply(struct sockaddr *local, struct sockaddr *dest, socklen_t addrlen,
+          const void *buf, size_t len)
+{
+    struct msghdr msg;
+    struct iovec iov;
+#if defined(DSTADDR_OPT) && defined(IP_PKTINFO)
+    char cbuf[CMSG_SPACE(sizeof(struct in_pktinfo))];
+    struct cmsghdr *cmsgp;
+    struct in_pktinfo pktinfo;
+#endif
+
+    if (ReplyFd < 0) {
+        ReplyFd = socket(PF_INET, SOCK_DGRAM, 0);
+        if (ReplyFd < 0) {
+            P_WARNING("socket() failed: %s.\n", strerror(errno));
+            return 0;
+        }
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = (void *)buf;
+    iov.iov_len = len;
+    msg.msg_name = dest;
+    msg.msg_namelen = addrlen;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+#if defined(DSTADDR_OPT) && defined(IP_PKTINFO)
+    if (local != NULL && local->sa_family == AF_INET &&
+        ((struct sockaddr_in *)local)->sin_addr.s_addr != INADDR_ANY) {
+        memset(cbuf, 0, sizeof(cbuf));
+        memset(&pktinfo, 0, sizeof(pktinfo));
+        pktinfo.ipi_spec_dst = ((struct sockaddr_in *)local)->sin_addr;
+        msg.msg_control = cbuf;
+        msg.msg_controllen = sizeof(cbuf);
+        cmsgp = CMSG_FIRSTHDR(&msg);
+        cmsgp->cmsg_level = IPPROTO_IP;
+        cmsgp->cmsg_type = IP_PKTINFO;
+        cmsgp->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+        memcpy(CMSG_DATA(cmsgp), &pktinfo, sizeof(pktinfo));
+    }
+#endif
+
+    if (sendmsg(ReplyFd, &msg, 0) < 0) {
+        P_WARNING("sendmsg() failed: %s\n", strerror(errno));
+        return 0;
+    }
+    OutputCounter++;
+    ReplyCounter++;
+
+    return 1;
+}
+
 int
 udp_input(TASK *task)
 {
@@ -379,6 +520,36 @@ udp_input(TASK *task)
     return retval;
 }
 
+/* send to pkb->caddr if set by pkb_setaddr(), or to connected peer. */
+static int
+pkb_send(int sockfd, struct pkt_buff *pkb)
+{
+    struct msghdr msg;
+    struct iovec iov[2];
+
+    if (pkb->ext != NULL) {
+        /* payload is header of pkb->ext (see stream_map()) */
+        memset(&msg, 0, sizeof(msg));
+        iov[0].iov_base = pkb->payload;
+        iov[0].iov_len = pkb->size;
+        iov[1].iov_base = (void *)pkb->ext;
+        iov[1].iov_len = pkb->extlen;
+        if (pkb->caddr->sa_family != AF_UNSPEC) {
+            msg.msg_name = pkb->caddr;
+            msg.msg_namelen = pkb->addrlen;
+        }
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
+        return sendmsg(sockfd, &msg, 0);
+    }
+
+    if (pkb->caddr->sa_family == AF_UNSPEC)
+        return send(sockfd, pkb->payload, pkb->size, 0);
+
+    return sendto(sockfd, pkb->payload, pkb->size, 0,
+                  pkb->caddr, pkb->addrlen);
+}
+
 void
 udp_report(void)
 {
@@ -386,10 +557,33 @@ udp_report(void)
     P_INFO("--- UDP statics ---\n");
     P_INFO(" Input    Counter = %d\n", InputCounter);
     P_INFO(" Outout   Counter = %d\n", OutputCounter);
+    P_INFO(" Fragment Counter = %d\n", FragmentCounter);
+    P_INFO(" Reply    Counter = %d\n", ReplyCounter);
 
     return;
 }
 
+/*
+ * Path MTU of connected socket, -1 if unknown.
+ */
+int
+udp_get_mtu(int sockfd)
+{
+#ifdef UDP_PMTU
+    int mtu;
+    socklen_t len = sizeof(mtu);
+
+    if (getsockopt(sockfd, IPPROTO_IP, IP_MTU, &mtu, &len) < 0) {
+        P_DEBUG("getsockopt() failed: %s.\n", strerror(errno));
+        return -1;
+    }
+
+    return mtu;
+#else
+    return -1;
+#endif
+}
+
 
 /*
  * Private functions
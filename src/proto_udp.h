@@ -70,16 +70,28 @@ int open_portal(char *host, char *serv);
 void close_portal(int sockfd);
 int
 open_transfer(struct sockaddr *local, struct sockaddr *dest, socklen_t addrlen);
+int open_group(struct sockaddr *local, socklen_t addrlen);
 void close_transfer(int sockfd);
 
 int udp_input(TASK *task);
 int udp_output(int sockfd, struct pkt_buff *pkb);
+int udp_reply(struct sockaddr *local, struct sockaddr *dest, socklen_t addrlen,
+              const void *buf, size_t len);
 void udp_report(void);
+int udp_get_mtu(int sockfd);
 
 enum udp_recv_params {
     RECV_BUFSIZE = 1500,
 };
 
+enum udp_params {
+    UDP_IP_HDLEN = 20 + 8,      /* IPv4 + UDP header without IP options */
+};
+
+#if defined(IP_MTU_DISCOVER) && defined(IP_MTU)
+#  define UDP_PMTU /* path MTU of connected socket is available */
+#endif
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -0,0 +1,644 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#if HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+typedef struct __tftp_stream STREAM;
+#define __STREAM_PRIVATE__
+
+#include "stream.h"
+#include "ascii.h"
+#include "content.h"
+#include "util.h"
+#include "debug.h"
+
+#include "globals.h"
+
+#ifndef DEBUG_STREAM
+#  undef P_DEBUG
+#  define P_DEBUG(fmt...) /* null */
+#endif
+
+struct stream_chunk {
+    off_t offset;                   /* file offset of data, -1 if empty */
+    size_t len;                     /* bytes in data */
+    int refs;                       /* readers whose last read is here */
+    unsigned long used;             /* last use (for LRU) */
+    u_int8_t *data;                 /* STREAM_CHUNK bytes */
+};
+
+struct stream_src {
+    dev_t dev;                      /* key of the file */
+    ino_t ino;
+    time_t mtime;
+    off_t size;
+    int fd;                         /* shared descriptor */
+    u_int8_t *map;                  /* mmap()ed file (-z), or NULL */
+    int stale;                      /* mapped file has been changed */
+    int nref;                       /* number of readers */
+    int nchunk;                     /* chunks allocated */
+    unsigned long tick;             /* LRU clock */
+    unsigned long idle;             /* last close if nref is 0 (for LRU) */
+    struct stream_chunk ring[STREAM_RING];
+    struct stream_src *hnext;       /* hash chain */
+};
+
+/* per session reader */
+struct __tftp_stream {
+    struct stream_src *src;
+    struct stream_chunk *pin;       /* chunk referenced, NULL if none */
+    ASCII_IMAGE *image;             /* netascii image, NULL if octet */
+    CONTENT *content;               /* cached in memory, or NULL */
+};
+
+/*
+ * file scope variables
+ */
+static struct stream_src *SrcHash[STREAM_HASH];
+static int SrcUsed = 0;
+static int IdleUsed = 0;
+static unsigned long IdleTick = 0;
+
+static unsigned int OpenCounter = 0;
+static unsigned int ShareCounter = 0;
+static unsigned int HitCounter = 0;
+static unsigned int MissCounter = 0;
+static unsigned int BypassCounter = 0;
+static unsigned int ReuseCounter = 0;
+static unsigned int EvictCounter = 0;
+static unsigned int MapCounter = 0;
+static unsigned int StaleCounter = 0;
+
+/* forward declarations of private functions */
+static unsigned int src_hash(dev_t dev, ino_t ino);
+static struct stream_src *src_find(struct stat *st);
+static void src_free(struct stream_src *src);
+static void src_evict(int keep);
+static void src_map(struct stream_src *src);
+static int src_check(struct stream_src *src);
+static struct stream_chunk *chunk_get(struct stream_src *src, off_t offset);
+static struct stream_chunk *chunk_find(struct stream_src *src, off_t offset);
+static void chunk_pin(STREAM *stream, struct stream_chunk *chunk);
+
+/*
+ * Exported functions
+ */
+int
+stream_init(void)
+{
+    memset(SrcHash, 0, sizeof(SrcHash));
+    SrcUsed = 0;
+    IdleUsed = 0;
+
+    return 1;
+}
+
+/*
+ * Open reader of the file. Returns NULL with errno set on failure.
+ */
+STREAM *
+stream_open(const char *fname, int mode)
+{
+    int fd, i, save_errno;
+    unsigned int h;
+    struct stat st;
+    struct stream_src *src;
+    CONTENT *content;
+    STREAM *stream;
+
+    /* whole file in memory? (see content.h) */
+    if (mode == STREAM_MODE_OCTET) {
+        content = content_open(fname);
+        if (content != NULL) {
+            stream = (STREAM *)safe_malloc(sizeof(STREAM));
+            if (stream == NULL) {
+                content_close(content);
+                errno = ENOMEM;
+                return NULL;
+            }
+            stream->src = NULL;
+            stream->pin = NULL;
+            stream->image = NULL;
+            stream->content = content;
+            return stream;
+        }
+    }
+
+    /* descriptor of the file is open? (see stream.h) */
+    if (mode == STREAM_MODE_OCTET && stat(fname, &st) == 0) {
+        src = src_find(&st);
+        if (src != NULL) {
+            stream = (STREAM *)safe_malloc(sizeof(STREAM));
+            if (stream == NULL) {
+                errno = ENOMEM;
+                return NULL;
+            }
+            stream->pin = NULL;
+            stream->image = NULL;
+            stream->content = NULL;
+            stream->src = src;
+            src->nref++;
+            P_DEBUG("\"%s\" shared by %d readers.\n", fname, src->nref);
+            return stream;
+        }
+    }
+
+    fd = open(fname, O_RDONLY);
+    if (fd < 0 && (errno == EMFILE || errno == ENFILE) && IdleUsed > 0) {
+        src_evict(0);
+        fd = open(fname, O_RDONLY);
+    }
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) < 0) {
+        save_errno = errno;
+        close(fd);
+        errno = save_errno;
+        return NULL;
+    }
+    stream = (STREAM *)safe_malloc(sizeof(STREAM));
+    if (stream == NULL) {
+        close(fd);
+        errno = ENOMEM;
+        return NULL;
+    }
+    stream->pin = NULL;
+    stream->image = NULL;
+    stream->content = NULL;
+
+    if (mode == STREAM_MODE_NETASCII) {
+        stream->src = NULL;
+        stream->image = ascii_open(fd, &st);
+        save_errno = errno;
+        close(fd);
+        if (stream->image == NULL) {
+            safe_free(stream);
+            errno = save_errno;
+            return NULL;
+        }
+        return stream;
+    }
+
+    /* changed between stat() and open()? */
+    src = src_find(&st);
+    if (src != NULL) {
+        close(fd);
+        src->nref++;
+        stream->src = src;
+        P_DEBUG("\"%s\" shared by %d readers.\n", fname, src->nref);
+        return stream;
+    }
+
+    src = (struct stream_src *)safe_malloc(sizeof(struct stream_src));
+    if (src == NULL) {
+        close(fd);
+        safe_free(stream);
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(src, 0, sizeof(*src));
+    src->dev = st.st_dev;
+    src->ino = st.st_ino;
+    src->mtime = st.st_mtime;
+    src->size = st.st_size;
+    src->fd = fd;
+    src->nref = 1;
+    for (i = 0; i < STREAM_RING; i++) src->ring[i].offset = -1;
+    if (TFTP_Mmap) src_map(src);
+    h = src_hash(st.st_dev, st.st_ino);
+    src->hnext = SrcHash[h];
+    SrcHash[h] = src;
+    SrcUsed++;
+    OpenCounter++;
+
+    stream->src = src;
+
+    return stream;
+}
+
+void
+stream_close(STREAM *stream)
+{
+    int i;
+    struct stream_src *src;
+
+    if (stream == NULL) {
+        P_WARNING("Invalid stream specified.\n");
+        return;
+    }
+    if (stream->image != NULL) {
+        ascii_close(stream->image);
+        safe_free(stream);
+        return;
+    }
+    if (stream->content != NULL) {
+        content_close(stream->content);
+        safe_free(stream);
+        return;
+    }
+    src = stream->src;
+    if (stream->pin != NULL) stream->pin->refs--;
+    safe_free(stream);
+
+    if (--src->nref > 0) return;
+
+    /* last reader. keep the descriptor for next session. */
+    for (i = 0; i < src->nchunk; i++) {
+        safe_free(src->ring[i].data);
+        src->ring[i].offset = -1;
+    }
+    src->nchunk = 0;
+    src->idle = ++IdleTick;
+    IdleUsed++;
+    if (IdleUsed > STREAM_IDLE_MAX) src_evict(STREAM_IDLE_MAX);
+
+    return;
+}
+
+/*
+ * Read len bytes at offset. Returns bytes read, which is less than
+ * len only at EOF, or -1 on error.
+ */
+ssize_t
+stream_read(STREAM *stream, off_t offset, void *buf, size_t len)
+{
+    size_t done, n;
+    off_t base;
+    ssize_t nread;
+    struct stream_chunk *chunk;
+
+    if (stream == NULL) {
+        P_WARNING("Invalid stream specified.\n");
+        return -1;
+    }
+    if (stream->image != NULL)
+        return ascii_read(stream->image, offset, buf, len);
+    if (stream->content != NULL)
+        return content_read(stream->content, offset, buf, len);
+    if (stream->src->map != NULL) {
+        if (src_check(stream->src) == 0) return -1;
+        if (offset >= stream->src->size) return 0;
+        if (len > stream->src->size - offset) len = stream->src->size - offset;
+        memcpy(buf, stream->src->map + offset, len);
+        return len;
+    }
+
+    for (done = 0; done < len; done += n) {
+        base = (offset + done) / STREAM_CHUNK * STREAM_CHUNK;
+        chunk = chunk_get(stream->src, base);
+        if (chunk == NULL) {
+            /* ring is full of referenced chunks */
+            nread = pread(stream->src->fd, (u_int8_t *)buf + done,
+                          len - done, offset + done);
+            if (nread < 0) {
+                P_WARNING("pread() failed: %s.\n", strerror(errno));
+                return -1;
+            }
+            BypassCounter++;
+            return done + nread;
+        }
+        chunk_pin(stream, chunk);
+
+        if (offset + done >= base + (off_t)chunk->len) break; /* EOF */
+        n = chunk->len - (offset + done - base);
+        if (n > len - done) n = len - done;
+        memcpy((u_int8_t *)buf + done, chunk->data + (offset + done - base), n);
+        if (chunk->len < STREAM_CHUNK) {
+            done += n;
+            break;
+        }
+    }
+
+    return done;
+}
+
+/*
+ * Pointer to len bytes at offset in the mapping. Returns bytes there,
+ * which is less than len only at EOF, or -1 if the file is not mapped
+ * (use stream_read()). Valid until the stream is closed.
+ */
+ssize_t
+stream_map(STREAM *stream, off_t offset, size_t len, const u_int8_t **data)
+{
+    struct stream_src *src;
+
+    if (stream == NULL) {
+        P_WARNING("Invalid stream specified.\n");
+        return -1;
+    }
+    if (stream->content != NULL)
+        return content_map(stream->content, offset, len, data);
+    src = stream->src;
+    if (src == NULL || src->map == NULL) return -1;
+    if (src_check(src) == 0) return -1; /* stream_read() fails too */
+
+    if (offset >= src->size) {
+        *data = src->map;
+        return 0;
+    }
+    if (len > src->size - offset) len = src->size - offset;
+    *data = src->map + offset;
+
+    return len;
+}
+
+/*
+ * Check that slices returned by stream_map() can still be read.
+ * Returns 0 if the mapped file has been changed (see stream.h).
+ */
+int
+stream_check(STREAM *stream)
+{
+    if (stream == NULL) {
+        P_WARNING("Invalid stream specified.\n");
+        return 0;
+    }
+    if (stream->src == NULL || stream->src->map == NULL) return 1;
+
+    return src_check(stream->src);
+}
+
+/*
+ * Encoded DATA packet of blockn if the file is in the content cache
+ * (see content.h). Returns length of the packet, or -1 if none.
+ */
+ssize_t
+stream_packet(STREAM *stream, size_t blksize, int rollover,
+              u_int32_t blockn, const u_int8_t **pkt)
+{
+    if (stream == NULL) {
+        P_WARNING("Invalid stream specified.\n");
+        return -1;
+    }
+    if (stream->content == NULL) return -1;
+
+    return content_packet(stream->content, blksize, rollover, blockn, pkt);
+}
+
+off_t
+stream_get_size(STREAM *stream)
+{
+    if (stream == NULL) {
+        P_WARNING("Invalid stream specified.\n");
+        return 0;
+    }
+    if (stream->image != NULL) return ascii_get_size(stream->image);
+    if (stream->content != NULL) return content_get_size(stream->content);
+
+    return stream->src->size;
+}
+
+void
+stream_report(void)
+{
+    P_INFO("--- stream statics ---\n");
+    P_INFO(" Entry    Counter = %d\n", SrcUsed);
+    P_INFO(" Idle     Counter = %d\n", IdleUsed);
+    P_INFO(" Open     Counter = %d\n", OpenCounter);
+    P_INFO(" Reuse    Counter = %d\n", ReuseCounter);
+    P_INFO(" Evict    Counter = %d\n", EvictCounter);
+    P_INFO(" Map      Counter = %d\n", MapCounter);
+    P_INFO(" Stale    Counter = %d\n", StaleCounter);
+    P_INFO(" Share    Counter = %d\n", ShareCounter);
+    P_INFO(" Hit      Counter = %d\n", HitCounter);
+    P_INFO(" Miss     Counter = %d\n", MissCounter);
+    P_INFO(" Bypass   Counter = %d\n", BypassCounter);
+
+    return;
+}
+
+/*
+ * Private functions
+ */
+static unsigned int
+src_hash(dev_t dev, ino_t ino)
+{
+    return (unsigned int)(dev * 31 + ino) % STREAM_HASH;
+}
+
+/* open file of st. idle one of old contents is closed. */
+static struct stream_src *
+src_find(struct stat *st)
+{
+    struct stream_src *src, *next;
+
+    for (src = SrcHash[src_hash(st->st_dev, st->st_ino)]; src != NULL;
+         src = next) {
+        next = src->hnext;
+        if (src->dev != st->st_dev || src->ino != st->st_ino) continue;
+        if (src->mtime == st->st_mtime && src->size == st->st_size) {
+            if (src->nref > 0) {
+                ShareCounter++;
+            } else {
+                IdleUsed--;
+                ReuseCounter++;
+            }
+            return src;
+        }
+        if (src->nref == 0) src_free(src);
+    }
+
+    return NULL;
+}
+
+/* close descriptor of the file. (chunks are freed by last reader) */
+static void
+src_free(struct stream_src *src)
+{
+    struct stream_src **walk;
+
+    for (walk = &SrcHash[src_hash(src->dev, src->ino)]; *walk != NULL;
+         walk = &(*walk)->hnext) {
+        if (*walk == src) {
+            *walk = src->hnext;
+            break;
+        }
+    }
+    if (src->nref == 0) IdleUsed--;
+    if (src->map != NULL) munmap(src->map, src->size);
+    close(src->fd);
+    safe_free(src);
+    SrcUsed--;
+
+    return;
+}
+
+/* map whole file read-only. left unmapped if it can't be. */
+static void
+src_map(struct stream_src *src)
+{
+    void *map;
+
+    if (src->size <= 0 || (off_t)(size_t)src->size != src->size) return;
+    map = mmap(NULL, src->size, PROT_READ, MAP_SHARED, src->fd, 0);
+    if (map == MAP_FAILED) {
+        P_WARNING("mmap() failed: %s.\n", strerror(errno));
+        return;
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise(map, src->size, MADV_SEQUENTIAL);
+#endif
+#ifdef MADV_WILLNEED
+    madvise(map, src->size, MADV_WILLNEED);
+#endif
+    src->map = (u_int8_t *)map;
+    MapCounter++;
+
+    return;
+}
+
+/* mapping still matches the file? stale ones stay stale. */
+static int
+src_check(struct stream_src *src)
+{
+    struct stat st;
+
+    if (src->stale) return 0;
+    if (fstat(src->fd, &st) == 0 &&
+        st.st_size == src->size && st.st_mtime == src->mtime) return 1;
+
+    P_WARNING("Mapped file (inode %lu) changed while being sent.\n",
+              (unsigned long)src->ino);
+    src->stale = 1;
+    StaleCounter++;
+
+    return 0;
+}
+
+/* close least recently used idle descriptors until keep are left. */
+static void
+src_evict(int keep)
+{
+    int i;
+    struct stream_src *src, *lru;
+
+    while (IdleUsed > keep) {
+        lru = NULL;
+        for (i = 0; i < STREAM_HASH; i++) {
+            for (src = SrcHash[i]; src != NULL; src = src->hnext) {
+                if (src->nref == 0 && (lru == NULL || src->idle < lru->idle))
+                    lru = src;
+            }
+        }
+        if (lru == NULL) break;
+        src_free(lru);
+        EvictCounter++;
+    }
+
+    return;
+}
+
+/* chunk of the offset (aligned). read from file if not cached. */
+static struct stream_chunk *
+chunk_get(struct stream_src *src, off_t offset)
+{
+    int i;
+    ssize_t nread;
+    struct stream_chunk *chunk;
+
+    chunk = chunk_find(src, offset);
+    if (chunk != NULL) {
+        chunk->used = ++src->tick;
+        HitCounter++;
+        return chunk;
+    }
+
+    /* LRU of unreferenced chunks */
+    for (i = 0; i < src->nchunk; i++) {
+        if (src->ring[i].refs == 0 &&
+            (chunk == NULL || src->ring[i].used < chunk->used))
+            chunk = &src->ring[i];
+    }
+    /* only one reader goes forward, no need to keep the past. */
+    if ((chunk == NULL || src->nref > 1) && src->nchunk < STREAM_RING) {
+        if (chunk == NULL || chunk->offset >= 0) {
+            chunk = &src->ring[src->nchunk];
+            chunk->data = (u_int8_t *)safe_malloc(STREAM_CHUNK);
+            if (chunk->data == NULL) return NULL;
+            src->nchunk++;
+        }
+    }
+    if (chunk == NULL) return NULL;
+
+    nread = pread(src->fd, chunk->data, STREAM_CHUNK, offset);
+    if (nread < 0) {
+        P_WARNING("pread() failed: %s.\n", strerror(errno));
+        chunk->offset = -1;
+        return NULL;
+    }
+    chunk->offset = offset;
+    chunk->len = nread;
+    chunk->used = ++src->tick;
+    MissCounter++;
+
+    return chunk;
+}
+
+static struct stream_chunk *
+chunk_find(struct stream_src *src, off_t offset)
+{
+    int i;
+
+    for (i = 0; i < src->nchunk; i++) {
+        if (src->ring[i].offset == offset) return &src->ring[i];
+    }
+
+    return NULL;
+}
+
+/* move reference of the reader to chunk */
+static void
+chunk_pin(STREAM *stream, struct stream_chunk *chunk)
+{
+    if (stream->pin == chunk) return;
+    if (stream->pin != NULL) stream->pin->refs--;
+    chunk->refs++;
+    stream->pin = chunk;
+
+    return;
+}
@@ -0,0 +1,133 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __STREAM_H__
+#define __STREAM_H__
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <sys/types.h>
+
+#ifndef __STREAM_PRIVATE__
+typedef struct __tftp_stream STREAM;
+
+struct __tftp_stream {
+    /* stream structure is protected. Only stream.c can read actual value. */
+    char *__dummy[0];
+};
+#endif
+
+int stream_init(void);
+STREAM *stream_open(const char *fname, int mode);
+void stream_close(STREAM *stream);
+ssize_t stream_read(STREAM *stream, off_t offset, void *buf, size_t len);
+ssize_t stream_map(STREAM *stream, off_t offset, size_t len,
+                   const u_int8_t **data);
+int stream_check(STREAM *stream);
+ssize_t stream_packet(STREAM *stream, size_t blksize, int rollover,
+                      u_int32_t blockn, const u_int8_t **pkt);
+off_t stream_get_size(STREAM *stream);
+void stream_report(void);
+
+enum stream_mode {
+    STREAM_MODE_OCTET,          /* file as is */
+    STREAM_MODE_NETASCII,       /* translated image (see ascii.h) */
+};
+
+enum stream_params {
+    STREAM_CHUNK = 32 * 1024,   /* bytes read from file at a time */
+    STREAM_RING = 16,           /* max chunks cached per file */
+    STREAM_HASH = 64,           /* size of hash table of files */
+    STREAM_IDLE_MAX = 32,       /* max descriptors kept without reader */
+};
+
+/*
+ * NOTE:
+ *
+ * - Shared stream
+ *     Sessions reading the same file (same device, inode, mtime and
+ *   size) share one file descriptor and a ring of chunks read by
+ *   pread(). A chunk is referenced by the sessions whose last read
+ *   was in it, and is not reused while referenced, so sessions going
+ *   together read the disk once. An unreferenced chunk is reused
+ *   first. The ring grows up to STREAM_RING chunks only if the file
+ *   has more than one reader; reads beyond that go to the file
+ *   directly without caching. Memory used for a file doesn't depend
+ *   on the number of sessions.
+ *     A file replaced or modified while being sent has new mtime, so
+ *   new sessions get a new stream, and old ones continue with the
+ *   old descriptor.
+ *
+ * - Descriptor cache
+ *     The descriptor is kept open after the last reader closes, so a
+ *   file requested again and again (e.g. a boot loader) is not
+ *   open()ed per session. stream_open() stat()s the name and looks
+ *   up (device, inode, mtime, size) first, and open()s only if no
+ *   descriptor is found. Chunks of an idle file are freed (the page
+ *   cache has the data). Up to STREAM_IDLE_MAX idle descriptors are
+ *   kept, the least recently used one is closed beyond that, and all
+ *   of them are closed if open() fails by EMFILE or ENFILE. An idle
+ *   descriptor whose file has been modified is closed when found.
+ *
+ * - mmap() serving (-z)
+ *     The file is mmap()ed read-only (MADV_SEQUENTIAL, MADV_WILLNEED)
+ *   when its descriptor is opened, and the mapping is shared by
+ *   sessions as the descriptor is. stream_map() returns a pointer
+ *   into the mapping instead of copying, and the DATA packet is sent
+ *   by sendmsg() of the header and the slice (see pkb->ext), so no
+ *   byte of the file is copied in user space. The mapping is removed
+ *   when the descriptor is closed, so a modified file (new mtime) is
+ *   mapped again. Empty files, netascii images, and files which
+ *   can't be mapped are read by stream_read() as before.
+ *     A file truncated while mapped makes SIGBUS (memcpy) or EFAULT
+ *   (sendmsg) on access beyond the new end. The descriptor is
+ *   fstat()ed before a slice is handed out or copied, and again
+ *   before a slice is resent (stream_check()). Once the size or mtime
+ *   differs from the mapping, the stream is stale: stream_map() and
+ *   stream_read() fail, and the session is ended by an error (the
+ *   rest of the file would not match what was sent). New sessions
+ *   open the new file. This narrows the window to one packet; -z is
+ *   still for images which are replaced (renamed over), not
+ *   rewritten in place.
+ */
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* __STREAM_H__ */
@@ -58,7 +58,18 @@
 #include "proto_tftp.h"
 #include "task.h"
 #include "timer.h"
+#include "client.h"
+#include "content.h"
+#include "cong.h"
+#include "dirindex.h"
+#include "handoff.h"
+#include "mcast.h"
+#include "dupreq.h"
+#include "negcache.h"
+#include "prefetch.h"
+#include "ascii.h"
 #include "util.h"
+#include "warm.h"
 #include "debug.h"
 
 #include "globals.h"
@@ -78,6 +89,7 @@ static unsigned int TaskCounter = 0;
 /* forward declarations of private functions */
 static TASK *task_alloc(int type, int sockfd);
 static void task_free(TASK *task);
+static int rbuf_alloc(TASK *task, unsigned int window, size_t slotsize);
 static TASK *ttbl_add(TASK *task);
 static int ttbl_del(TASK *task);
 static int renew_task_fds(fd_set *temp);
@@ -86,6 +98,7 @@ static int wlst_lookup(int value, int flag);
 static int wlst_delete(int value);
 static int wlst_vector(TASK *vector[]);
 static int do_retrans(TASK *taskv[]);
+static int do_pace(TASK *taskv[]);
 
 /*
  * Exported functions
@@ -117,6 +130,13 @@ task_create(int type, struct sockaddr *laddr, struct sockaddr *caddr,
             P_WARNING("open_portal() failed.\n");
             return NULL;
         }
+    } else if (caddr == NULL) {
+        P_DEBUG("Open group socket....\n");
+        sockfd = open_group(laddr, addrlen);
+        if (sockfd < 0) {
+            P_WARNING("open_group() failed.\n");
+            return NULL;
+        }
     } else { 
         sockfd = open_transfer(laddr, caddr, addrlen);
         if (sockfd < 0) {
@@ -131,6 +151,9 @@ task_create(int type, struct sockaddr *laddr, struct sockaddr *caddr,
         P_WARNING("task_alloc() failed.\n");
         return NULL;
     }
+    if (caddr != NULL && addrlen <= sizeof(task->caddr)) {
+        memcpy(&task->caddr, caddr, addrlen);
+    }
 
     if (ttbl_add(task) == NULL) {
         P_WARNING("ttbl_add() failed.\n");
@@ -159,6 +182,14 @@ task_join(TASK *task, int state)
 
     FD_CLR(task->sockfd, &ActiveFds);
     wlst_delete(task->sockfd);
+    if (task->type != TASK_TYPE_PORTAL && task->nxmit > 0) {
+        P_INFO("Task %d: cwnd %u, ssthresh %u, %u blocks sent, %u resent.\n",
+               task->sockfd, task->cwnd, task->ssthresh,
+               task->nxmit, task->nrexmit);
+        client_learn(task);
+    }
+    mcast_leave(task); /* free the group if task is a multicast group */
+    dupreq_del(task);
     del_ok = ttbl_del(task);
     if (del_ok == 0) {
         P_WARNING("ttbl_del() failed.\n");
@@ -181,16 +212,16 @@ task_join(TASK *task, int state)
 int
 task_main(void)
 {
-    int sockfd, sel_err, nwait, retrans;
+    int sockfd, sel_err, nwait, retrans, hfd, pfd, maxfd;
+    long sync;
     TASK *wait_tasks[TASK_ID_MAX], *retrans_tasks[TASK_ID_MAX];
+    TASK *pace_tasks[TASK_ID_MAX];
     fd_set rfds;
     struct timeval tv;
     struct timeval *tout;
 
     for(;;) {
-        tv.tv_sec = 0;           /* [s] */
-        tv.tv_usec = 500 * 1000; /* [ms] */
-
+        warm_check(); /* exits if signaled */
         if (ActiveFdMax < 0) {
             P_WARNING("No task.\n");
             break;
@@ -200,34 +231,78 @@ task_main(void)
         nwait = wlst_vector(wait_tasks);
         if (nwait > 0) {
             P_DEBUG("Waiting task found. Timer enabled.\n");
+            timer_next(wait_tasks, &tv, SELECT_TIMEOUT * 1000);
             tout = &tv;
         } else {
             P_DEBUG("Wainting task not found. Timer disabled.\n");
             udp_report();
             tftp_report();
             timer_report();
+            cong_report();
+            client_report();
+            content_report();
+            dirindex_report();
+            dupreq_report();
+            negcache_report();
+            prefetch_report();
+            mcast_report();
+            stream_report();
+            ascii_report();
+            upload_report();
+            warm_report();
             pkb_report();
             util_report();
             tout = NULL;
         }
-
+        sync = upload_next();
+        if (sync >= 0 && (tout == NULL ||
+                          tout->tv_sec * 1000 * 1000 + tout->tv_usec > sync)) {
+            /* wake up for batched fsync of uploads */
+            tv.tv_sec = sync / (1000 * 1000);
+            tv.tv_usec = sync % (1000 * 1000);
+            tout = &tv;
+        }
 
         P_DEBUG("Switching task...\n");
         FD_COPY(&ActiveFds, &rfds);
-        sel_err = select(ActiveFdMax + 1, &rfds, NULL, NULL, tout);
+        maxfd = ActiveFdMax;
+        hfd = handoff_fd();
+        if (hfd >= 0) FD_SET(hfd, &rfds);
+        if (hfd > maxfd) maxfd = hfd;
+        pfd = prefetch_fd();
+        if (pfd >= 0) FD_SET(pfd, &rfds);
+        if (pfd > maxfd) maxfd = pfd;
+        sel_err = select(maxfd + 1, &rfds, NULL, NULL, tout);
         if (sel_err < 0) {
+            if (errno == EINTR) continue;
             P_WARNING("select() failed: %s.\n", strerror(errno));
             break;
         }
-        else if (sel_err == 0) {
+        if (hfd >= 0 && FD_ISSET(hfd, &rfds)) {
+            /* exits if the new server is accepted. */
+            handoff_accept();
+            FD_CLR(hfd, &rfds);
+            if (--sel_err == 0) continue;
+        }
+        if (pfd >= 0 && FD_ISSET(pfd, &rfds)) {
+            prefetch_done();
+            FD_CLR(pfd, &rfds);
+            if (--sel_err == 0) continue;
+        }
+        upload_sync(0);
+        if (sel_err == 0) {
             if (nwait > 0) {
+                if (timer_pace(wait_tasks, pace_tasks) > 0) {
+                    P_DEBUG("Send next burst.\n");
+                    do_pace(pace_tasks);
+                }
                 retrans = timer_update(wait_tasks, retrans_tasks);
                 if (retrans > 0) {
                     P_DEBUG("Retrans packet.\n");
                     do_retrans(retrans_tasks);
                 }
             }
-            else {
+            else if (sync < 0) {
                 P_WARNING("Timer enabled, but no wait task found. BUG?\n");
             }
         }
@@ -241,6 +316,11 @@ task_main(void)
             
             wlst_vector(wait_tasks); /* CWAIT tasks may be done in above. */
 
+            if (timer_pace(wait_tasks, pace_tasks) > 0) {
+                P_DEBUG("Send next burst.\n");
+                do_pace(pace_tasks);
+            }
+
             P_DEBUG("Update retrans timer.\n");
             retrans = timer_update(wait_tasks, retrans_tasks);
             if (retrans > 0) {
@@ -250,354 +330,1180 @@ task_main(void)
         }
     }
 
-    /* end of infinite loop */
-    return -1;
+    /* end of infinite loop */
+    return -1;
+}
+
+/*
+ * task attribute operations.
+ */
+int
+task_get_sockfd(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    return task->sockfd;
+}
+
+int
+task_get_id(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    return task_get_sockfd(task); /* sockfd is used for id */
+}
+
+int
+task_set_state(TASK *task, int state)
+{
+#ifdef DEBUG
+    int old_state;
+#endif
+    struct timeval tv;
+
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+    if (state < 0 || state >= TASK_ST_LAST) {
+        P_WARNING("Invalid state specified.\n");
+        return 0;
+    }
+
+    if (state == TASK_ST_WACK) {
+        gettimeofday(&tv, NULL);
+        task->retrans.tv_sec = tv.tv_sec;
+        task->retrans.tv_usec = tv.tv_usec;
+        wlst_lookup(task->sockfd, WLST_CREATE);
+    } else {
+        task->retrans.tv_sec = 0;
+        task->retrans.tv_usec = 0;
+        task->retrans_interval = task->retrans_init; /* [us] */
+        task->retrans_counter = 0;
+        wlst_delete(task->sockfd);
+    }
+
+#ifdef DEBUG
+    old_state = task->state;
+#endif
+    task->state = state;
+    P_DEBUG("Task %d state %d -> %d\n", task->sockfd, old_state, state);
+
+    return 1;
+}
+
+int
+task_get_state(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return TASK_ST_INVAL;
+    }
+
+    return task->state;
+}
+
+char *
+task_get_rbuf(TASK *task, u_int32_t blockn)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return NULL;
+    }
+
+    return task->rbuf + (blockn % task->window) * task->slotsize;
+}
+
+size_t
+task_get_rbufsize(TASK *task, u_int32_t blockn)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    return task->slot[blockn % task->window].size;
+}
+
+size_t
+task_get_maxrbufsize(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    return task->slotsize;
+}
+
+int
+task_set_rbufsize(TASK *task, u_int32_t blockn, size_t size)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+    if (size > task->slotsize) {
+        P_WARNING("Too big size (%d bytes) specified.\n", size);
+        return 0;
+    }
+
+    task->slot[blockn % task->window].size = size;
+    task->slot[blockn % task->window].ext = NULL;
+    task->slot[blockn % task->window].pkt = NULL;
+
+    return 1;
+}
+
+/*
+ * Data of the block is at ext (mmap()ed file, see stream_map()), and
+ * rbuf has only the header. Set after task_set_rbufsize().
+ */
+int
+task_set_rbufext(TASK *task, u_int32_t blockn, const u_int8_t *ext)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    task->slot[blockn % task->window].ext = ext;
+
+    return 1;
+}
+
+const u_int8_t *
+task_get_rbufext(TASK *task, u_int32_t blockn)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return NULL;
+    }
+
+    return task->slot[blockn % task->window].ext;
+}
+
+/*
+ * Whole packet of the block (header too) is at pkt (packet image, see
+ * content.h). Data is also seen by task_get_rbufext(). Set after
+ * task_set_rbufsize().
+ */
+int
+task_set_rbufpkt(TASK *task, u_int32_t blockn, const u_int8_t *pkt)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    task->slot[blockn % task->window].pkt = pkt;
+    task->slot[blockn % task->window].ext = pkt + TFTP_HDLEN + TFTP_DATA_HDLEN;
+
+    return 1;
+}
+
+const u_int8_t *
+task_get_rbufpkt(TASK *task, u_int32_t blockn)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return NULL;
+    }
+
+    return task->slot[blockn % task->window].pkt;
+}
+
+int
+task_stamp_rbuf(TASK *task, u_int32_t blockn, int first)
+{
+    struct rbuf_slot *slot;
+
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    slot = &task->slot[blockn % task->window];
+    if (first) {
+        gettimeofday(&slot->stamp, NULL);
+        task->nxmit++;
+    } else {
+        task->nrexmit++;
+        /* Karn's algorithm: never measure RTT of resent block. */
+        slot->stamp.tv_sec = 0;
+        slot->stamp.tv_usec = 0;
+    }
+
+    return 1;
+}
+
+long
+task_get_rbufage(TASK *task, u_int32_t blockn)
+{
+    struct rbuf_slot *slot;
+    struct timeval tv;
+
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return -1;
+    }
+
+    slot = &task->slot[blockn % task->window];
+    if (slot->stamp.tv_sec == 0 && slot->stamp.tv_usec == 0) return -1;
+
+    gettimeofday(&tv, NULL);
+
+    return (tv.tv_sec - slot->stamp.tv_sec) * 1000 * 1000 +
+           (tv.tv_usec - slot->stamp.tv_usec);
+}
+
+int
+task_set_window(TASK *task, unsigned int window)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+    if (window == 0) {
+        P_WARNING("Invalid window size specified.\n");
+        return 0;
+    }
+    if (window == task->window) return 1;
+
+    if (rbuf_alloc(task, window, task->slotsize) == 0) {
+        P_WARNING("rbuf_alloc() failed.\n");
+        return 0;
+    }
+
+    P_DEBUG("task %d: window size is %u.\n", task->sockfd, task->window);
+
+    return 1;
+}
+
+unsigned int
+task_get_window(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    return task->window;
+}
+
+int
+task_set_blksize(TASK *task, size_t blksize)
+{
+    size_t slotsize;
+
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+    if (blksize == 0) {
+        P_WARNING("Invalid block size specified.\n");
+        return 0;
+    }
+
+    slotsize = TFTP_HDLEN + TFTP_DATA_HDLEN + blksize;
+    if (slotsize < RETRANS_BUFSIZE) slotsize = RETRANS_BUFSIZE;
+    if (slotsize != task->slotsize) {
+        if (rbuf_alloc(task, task->window, slotsize) == 0) {
+            P_WARNING("rbuf_alloc() failed.\n");
+            return 0;
+        }
+    }
+    task->blksize = blksize;
+
+    P_DEBUG("task %d: block size is %u.\n", task->sockfd, task->blksize);
+
+    return 1;
+}
+
+size_t
+task_get_blksize(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    return task->blksize;
+}
+
+int
+task_set_pmtu(TASK *task, int pmtu)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+    if (pmtu < 0) {
+        P_WARNING("Invalid MTU specified.\n");
+        return 0;
+    }
+
+    task->pmtu = pmtu;
+
+    return 1;
+}
+
+int
+task_get_pmtu(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    return task->pmtu;
+}
+
+int
+task_set_fec(TASK *task, unsigned int fec)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    task->fec = fec;
+
+    return 1;
+}
+
+unsigned int
+task_get_fec(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    return task->fec;
+}
+
+int
+task_set_type(TASK *task, int type)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return TASK_TYPE_INVAL;
+    }
+
+    if (type <= TASK_TYPE_INVAL || type >= TASK_TYPE_LAST) {
+        P_WARNING("Invalid type specified.\n");
+        return TASK_TYPE_INVAL;
+    }
+
+    task->type = type;
+
+    return task->type;
+}
+
+int
+task_get_type(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return TASK_TYPE_INVAL;
+    }
+
+    return task->type;
+}
+
+int
+task_set_mode(TASK *task, int mode)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    task->mode = mode;
+
+    return 1;
+}
+
+int
+task_get_mode(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    return task->mode;
+}
+
+int
+task_set_file(TASK *task, FILE *file)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+    if (file == NULL) {
+        P_WARNING("Invalid file specified.\n");
+        return 0;
+    }
+
+    task->file = file;
+    
+    return 1;
+}
+
+FILE *
+task_get_file(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return NULL;
+    }
+
+    return task->file;
+}
+
+int
+task_set_stream(TASK *task, STREAM *stream)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+    if (stream == NULL) {
+        P_WARNING("Invalid stream specified.\n");
+        return 0;
+    }
+
+    task->stream = stream;
+
+    return 1;
+}
+
+STREAM *
+task_get_stream(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return NULL;
+    }
+
+    return task->stream;
+}
+
+/* NULL detaches the upload (committed) from task */
+int
+task_set_upload(TASK *task, UPLOAD *upload)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    task->upload = upload;
+
+    return 1;
+}
+
+UPLOAD *
+task_get_upload(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return NULL;
+    }
+
+    return task->upload;
+}
+
+int
+task_set_dupreq(TASK *task, void *dupreq)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    task->dupreq = dupreq;
+
+    return 1;
+}
+
+void *
+task_get_dupreq(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return NULL;
+    }
+
+    return task->dupreq;
+}
+
+int
+task_set_fsize(TASK *task, off_t size)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+    if (size < 0) {
+        P_WARNING("Invalid size specified.\n");
+        return 0;
+    }
+
+    task->fsize = size;
+
+    return 1;
+}
+
+off_t
+task_get_fsize(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    return task->fsize;
+}
+
+long
+task_get_rsec(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    return task->retrans.tv_sec;
+}
+
+int
+task_set_rsec(TASK *task, long sec)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+    if (sec < 0) {
+        P_WARNING("Invalid sec sepecified.\n");
+        return 0;
+    }
+
+    task->retrans.tv_sec = sec;
+
+    return 1;
+}
+
+long
+task_get_rusec(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    return task->retrans.tv_usec;
+}
+
+int
+task_set_rusec(TASK *task, long usec)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+    if (usec < 0) {
+        P_WARNING("Invalid usec specified.\n");
+        return 0;
+    }
+
+    task->retrans.tv_usec = usec;
+
+    return 1;
+}
+
+int
+task_set_rcounter(TASK *task, int count)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+    if (count < 0) {
+        P_WARNING("Invalid counter value specified.\n");
+        return 0;
+    }
+
+
+    task->retrans_counter = count;
+
+    return 1;
+}
+
+int
+task_get_rcounter(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return -1;
+    }
+
+    return task->retrans_counter;
+}
+
+int
+task_inc_rcounter(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    task->retrans_counter++;
+
+    return 1;
+}
+
+long
+task_get_rinterval(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    return task->retrans_interval;
+}
+
+int
+task_set_rinterval(TASK *task, long interval)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    task->retrans_interval = interval;
+
+    P_DEBUG("task %d: retrans interval is %ld [us].\n",
+            task->sockfd, task->retrans_interval);
+
+    return 1;
+}
+
+int
+task_set_rtt(TASK *task, long srtt, long rttvar)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    task->srtt = srtt;
+    task->rttvar = rttvar;
+
+    P_DEBUG("task %d: srtt %ld [us], rttvar %ld [us].\n",
+            task->sockfd, task->srtt, task->rttvar);
+
+    return 1;
+}
+
+long
+task_get_srtt(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return -1;
+    }
+
+    return task->srtt;
+}
+
+long
+task_get_rttvar(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    return task->rttvar;
+}
+
+int
+task_set_rttadaptive(TASK *task, int adaptive)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    task->rtt_adaptive = adaptive;
+
+    return 1;
+}
+
+int
+task_get_rttadaptive(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    return task->rtt_adaptive;
 }
 
-/*
- * task attribute operations.
- */
 int
-task_get_sockfd(TASK *task)
+task_set_rinit(TASK *task, long interval)
 {
     if (task == NULL) {
         P_WARNING("Invalid task specified.\n");
         return 0;
     }
+    if (interval <= 0) {
+        P_WARNING("Invalid interval specified.\n");
+        return 0;
+    }
 
-    return task->sockfd;
+    task->retrans_init = interval;
+    task->retrans_interval = interval;
+
+    P_DEBUG("task %d: initial retrans interval is %ld [us].\n",
+            task->sockfd, task->retrans_init);
+
+    return 1;
 }
 
-int
-task_get_id(TASK *task)
+long
+task_get_rinit(TASK *task)
 {
     if (task == NULL) {
         P_WARNING("Invalid task specified.\n");
         return 0;
     }
 
-    return task_get_sockfd(task); /* sockfd is used for id */
+    return task->retrans_init;
 }
 
 int
-task_set_state(TASK *task, int state)
+task_set_rmax(TASK *task, int count)
 {
-#ifdef DEBUG
-    int old_state;
-#endif
-    struct timeval tv;
-
     if (task == NULL) {
         P_WARNING("Invalid task specified.\n");
         return 0;
     }
-    if (state < 0 || state >= TASK_ST_LAST) {
-        P_WARNING("Invalid state specified.\n");
+    if (count < 0) {
+        P_WARNING("Invalid counter value specified.\n");
         return 0;
     }
 
-    if (state == TASK_ST_WACK) {
-        gettimeofday(&tv, NULL);
-        task->retrans.tv_sec = tv.tv_sec;
-        task->retrans.tv_usec = tv.tv_usec;
-        wlst_lookup(task->sockfd, WLST_CREATE);
-    } else {
-        task->retrans.tv_sec = 0;
-        task->retrans.tv_usec = 0;
-        task->retrans_interval = RETRANS_INIT_INTERVAL; /* [us] */
-        task->retrans_counter = 0;
-        wlst_delete(task->sockfd);
-    }
-
-#ifdef DEBUG
-    old_state = task->state;
-#endif
-    task->state = state;
-    P_DEBUG("Task %d state %d -> %d\n", task->sockfd, old_state, state);
+    task->retrans_max = count;
 
     return 1;
 }
 
 int
-task_get_state(TASK *task)
+task_get_rmax(TASK *task)
 {
     if (task == NULL) {
         P_WARNING("Invalid task specified.\n");
-        return TASK_ST_INVAL;
+        return 0;
     }
 
-    return task->state;
+    return task->retrans_max;
 }
 
-char *
-task_get_rbuf(TASK *task)
+int
+task_set_rbackoff(TASK *task, int factor)
 {
     if (task == NULL) {
         P_WARNING("Invalid task specified.\n");
-        return NULL;
+        return 0;
+    }
+    if (factor < 1) {
+        P_WARNING("Invalid backoff factor specified.\n");
+        return 0;
     }
 
-    return task->rbuf;
+    task->retrans_backoff = factor;
+
+    return 1;
 }
 
-size_t
-task_get_rbufsize(TASK *task)
+int
+task_get_rbackoff(TASK *task)
 {
     if (task == NULL) {
         P_WARNING("Invalid task specified.\n");
         return 0;
     }
 
-    return task->rbuf_size;
+    return task->retrans_backoff;
 }
 
-size_t
-task_get_maxrbufsize(TASK *task)
+int
+task_set_blockn(TASK *task, u_int32_t blockn)
 {
     if (task == NULL) {
         P_WARNING("Invalid task specified.\n");
         return 0;
     }
 
-    return RETRANS_BUFSIZE;
+    task->BlockN = blockn;
+
+    return 1;
+}
+
+u_int32_t
+task_get_blockn(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invlid task specified.\n");
+        return 0;
+    }
+
+    return task->BlockN;
 }
 
 int
-task_set_rbufsize(TASK *task, size_t size)
+task_inc_blockn(TASK *task)
 {
     if (task == NULL) {
         P_WARNING("Invalid task specified.\n");
         return 0;
     }
-    if (size > RETRANS_BUFSIZE) {
-        P_WARNING("Too big size (%d bytes) specified.\n", size);
+
+    task->BlockN++;
+
+    return 1;
+}
+
+int
+task_set_sendn(TASK *task, u_int32_t blockn)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
         return 0;
     }
 
-    task->rbuf_size = size;
+    task->SendN = blockn;
 
     return 1;
 }
 
-int
-task_set_type(TASK *task, int type)
+u_int32_t
+task_get_sendn(TASK *task)
 {
     if (task == NULL) {
         P_WARNING("Invalid task specified.\n");
-        return TASK_TYPE_INVAL;
+        return 0;
     }
 
-    if (type <= TASK_TYPE_INVAL || type >= TASK_TYPE_LAST) {
-        P_WARNING("Invalid type specified.\n");
-        return TASK_TYPE_INVAL;
+    return task->SendN;
+}
+
+int
+task_set_filln(TASK *task, u_int32_t blockn)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
     }
 
-    task->type = type;
+    task->FillN = blockn;
 
-    return task->type;
+    return 1;
 }
 
-int
-task_get_type(TASK *task)
+u_int32_t
+task_get_filln(TASK *task)
 {
     if (task == NULL) {
         P_WARNING("Invalid task specified.\n");
-        return TASK_TYPE_INVAL;
+        return 0;
     }
 
-    return task->type;
+    return task->FillN;
 }
 
 int
-task_set_file(TASK *task, FILE *file)
+task_set_rollover(TASK *task, int rollover)
 {
     if (task == NULL) {
         P_WARNING("Invalid task specified.\n");
         return 0;
     }
-    if (file == NULL) {
-        P_WARNING("Invalid file specified.\n");
+    if (rollover < -1 || rollover > 1) {
+        P_WARNING("Invalid rollover value specified.\n");
         return 0;
     }
 
-    task->file = file;
-    
+    task->rollover = rollover;
+
     return 1;
 }
 
-FILE *
-task_get_file(TASK *task)
+int
+task_get_rollover(TASK *task)
 {
     if (task == NULL) {
         P_WARNING("Invalid task specified.\n");
-        return NULL;
+        return -1;
     }
 
-    return task->file;
+    return task->rollover;
 }
 
-long
-task_get_rsec(TASK *task)
+struct sockaddr *
+task_get_caddr(TASK *task)
 {
     if (task == NULL) {
         P_WARNING("Invalid task specified.\n");
-        return 0;
+        return NULL;
     }
+    if (task->caddr.ss_family == AF_UNSPEC) return NULL;
 
-    return task->retrans.tv_sec;
+    return (struct sockaddr *)&task->caddr;
 }
 
 int
-task_set_rsec(TASK *task, long sec)
+task_set_opts(TASK *task, unsigned int opts)
 {
     if (task == NULL) {
         P_WARNING("Invalid task specified.\n");
         return 0;
     }
-    if (sec < 0) {
-        P_WARNING("Invalid sec sepecified.\n");
+
+    task->opts = opts;
+
+    return 1;
+}
+
+unsigned int
+task_get_opts(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
         return 0;
     }
 
-    task->retrans.tv_sec = sec;
+    return task->opts;
+}
 
-    return 1;
+u_int32_t
+task_get_nxmit(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    return task->nxmit;
 }
 
-long
-task_get_rusec(TASK *task)
+u_int32_t
+task_get_nrexmit(TASK *task)
 {
     if (task == NULL) {
         P_WARNING("Invalid task specified.\n");
         return 0;
     }
 
-    return task->retrans.tv_usec;
+    return task->nrexmit;
 }
 
 int
-task_set_rusec(TASK *task, long usec)
+task_set_cwnd(TASK *task, unsigned int cwnd)
 {
     if (task == NULL) {
         P_WARNING("Invalid task specified.\n");
         return 0;
     }
-    if (usec < 0) {
-        P_WARNING("Invalid usec specified.\n");
+    if (cwnd == 0) {
+        P_WARNING("Invalid window size specified.\n");
         return 0;
     }
 
-    task->retrans.tv_usec = usec;
+    task->cwnd = cwnd;
 
     return 1;
 }
 
+unsigned int
+task_get_cwnd(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    return task->cwnd;
+}
+
 int
-task_set_rcounter(TASK *task, int count)
+task_set_ssthresh(TASK *task, unsigned int ssthresh)
 {
     if (task == NULL) {
         P_WARNING("Invalid task specified.\n");
         return 0;
     }
-    if (count < 0) {
-        P_WARNING("Invalid counter value specified.\n");
+    if (ssthresh == 0) {
+        P_WARNING("Invalid threshold specified.\n");
         return 0;
     }
 
-
-    task->retrans_counter = count;
+    task->ssthresh = ssthresh;
 
     return 1;
 }
 
-int
-task_get_rcounter(TASK *task)
+unsigned int
+task_get_ssthresh(TASK *task)
 {
     if (task == NULL) {
         P_WARNING("Invalid task specified.\n");
-        return -1;
+        return 0;
     }
 
-    return task->retrans_counter;
+    return task->ssthresh;
 }
 
 int
-task_inc_rcounter(TASK *task)
+task_set_cwndacc(TASK *task, unsigned int acc)
 {
     if (task == NULL) {
         P_WARNING("Invalid task specified.\n");
         return 0;
     }
 
-    task->retrans_counter++;
+    task->cwnd_acc = acc;
 
     return 1;
 }
 
-long
-task_get_rinterval(TASK *task)
+unsigned int
+task_get_cwndacc(TASK *task)
 {
     if (task == NULL) {
         P_WARNING("Invalid task specified.\n");
         return 0;
     }
 
-    return task->retrans_interval;
+    return task->cwnd_acc;
 }
 
 int
-task_set_rinterval(TASK *task, long interval)
+task_set_recover(TASK *task, u_int32_t blockn)
 {
     if (task == NULL) {
         P_WARNING("Invalid task specified.\n");
         return 0;
     }
 
-    task->retrans_interval = interval;
-
-    P_DEBUG("task %d: retrans interval is %ld [us].\n",
-            task->sockfd, task->retrans_interval);
+    task->recover = blockn;
 
     return 1;
 }
 
+u_int32_t
+task_get_recover(TASK *task)
+{
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return 0;
+    }
+
+    return task->recover;
+}
+
 int
-task_set_blockn(TASK *task, u_int16_t blockn)
+task_set_burst(TASK *task, unsigned int burst)
 {
     if (task == NULL) {
         P_WARNING("Invalid task specified.\n");
         return 0;
     }
 
-    task->BlockN = blockn;
+    task->burst = burst;
 
     return 1;
 }
 
-u_int16_t
-task_get_blockn(TASK *task)
+unsigned int
+task_get_burst(TASK *task)
 {
     if (task == NULL) {
-        P_WARNING("Invlid task specified.\n");
+        P_WARNING("Invalid task specified.\n");
         return 0;
     }
 
-    return task->BlockN;
+    return task->burst;
 }
 
+/*
+ * Send next burst after usec [us]. 0 stops pacing timer.
+ */
 int
-task_inc_blockn(TASK *task)
+task_set_pace(TASK *task, long usec)
 {
+    struct timeval tv;
+
     if (task == NULL) {
         P_WARNING("Invalid task specified.\n");
         return 0;
     }
 
-    task->BlockN++;
+    if (usec <= 0) {
+        task->pace.tv_sec = 0;
+        task->pace.tv_usec = 0;
+        return 1;
+    }
+
+    gettimeofday(&tv, NULL);
+    tv.tv_sec += usec / (1000 * 1000);
+    tv.tv_usec += usec % (1000 * 1000);
+    if (tv.tv_usec >= 1000 * 1000) {
+        tv.tv_sec++;
+        tv.tv_usec -= 1000 * 1000;
+    }
+    task->pace.tv_sec = tv.tv_sec;
+    task->pace.tv_usec = tv.tv_usec;
 
     return 1;
 }
 
+/*
+ * Time until next burst [us], -1 if pacing timer is stopped.
+ */
+long
+task_get_pace(TASK *task)
+{
+    long remain;
+    struct timeval tv;
+
+    if (task == NULL) {
+        P_WARNING("Invalid task specified.\n");
+        return -1;
+    }
+    if (task->pace.tv_sec == 0 && task->pace.tv_usec == 0) return -1;
+
+    gettimeofday(&tv, NULL);
+    remain = (task->pace.tv_sec - tv.tv_sec) * 1000 * 1000 +
+             (task->pace.tv_usec - tv.tv_usec);
+
+    return remain < 0 ? 0 : remain;
+}
+
 /*
  * private functions
  */
@@ -619,21 +1525,57 @@ task_alloc(int type, int sockfd)
         P_WARNING("safe_malloc() failed: %s.\n", strerror(errno));
         return NULL;
     }
+    /* window of 1 block is RFC1350 lock-step transfer */
+    task->window = 0;
+    task->slotsize = RETRANS_BUFSIZE;
+    task->rbuf = NULL;
+    task->slot = NULL;
+    task->blksize = TFTP_DATA_MAX_SIZE;
+    task->pmtu = 0;
+    task->fec = 0;
+    if (task_set_window(task, 1) == 0) {
+        P_WARNING("task_set_window() failed.\n");
+        safe_free(task);
+        return NULL;
+    }
     task->sockfd = sockfd;
     task->type = type;
+    task->mode = 0;
     task->state = TASK_ST_INIT;
-    /* rbuf is static array in TASK */
-    task->rbuf_size = 0;
     task->retrans.tv_sec = 0;
     task->retrans.tv_usec = 0;
-    task->retrans_interval = RETRANS_INIT_INTERVAL;
+    task->retrans_interval = TFTP_Retrans_Init;
     task->retrans_counter = 0;
+    task->retrans_init = TFTP_Retrans_Init;
+    task->retrans_max = TFTP_Retrans_Max;
+    task->retrans_backoff = RETRANS_BACKOFF_FACTOR;
     task->file = NULL;
+    task->stream = NULL;
+    task->upload = NULL;
+    task->dupreq = NULL;
+    task->fsize = 0;
+    task->rollover = TFTP_Rollover;
+    task->srtt = -1;
+    task->rttvar = 0;
+    task->rtt_adaptive = 1;
+    memset(&task->caddr, 0, sizeof(task->caddr));
+    task->opts = 0;
+    task->nxmit = 0;
+    task->nrexmit = 0;
+    task->cwnd = CONG_CWND_INIT;
+    task->ssthresh = CONG_SSTHRESH_INIT;
+    task->cwnd_acc = 0;
+    task->recover = 0;
+    task->burst = 0;
+    task->pace.tv_sec = 0;
+    task->pace.tv_usec = 0;
     if (type == TASK_TYPE_READ) {
         task->BlockN = 1;
     } else {
         task->BlockN = 0;
     }
+    task->SendN = task->BlockN;
+    task->FillN = task->BlockN;
 
     TaskCounter++;
     P_DEBUG("Task entry allocated. id %d, total %d.\n",
@@ -660,6 +1602,10 @@ task_free(TASK *task)
     sockfd = task->sockfd;
     close(task->sockfd);
     if (task->file != NULL) fclose(task->file);
+    if (task->stream != NULL) stream_close(task->stream);
+    if (task->upload != NULL) upload_close(task->upload); /* aborted */
+    safe_free(task->rbuf);
+    safe_free(task->slot);
     safe_free(task);
 
     TaskCounter--;
@@ -668,6 +1614,40 @@ task_free(TASK *task)
     return;
 }
 
+/*
+ * (Re)allocate retrans buffer of window * slotsize bytes.
+ * NOTE: contents of the retrans buffer are discarded.
+ *       Call this before the first block is stored.
+ */
+static int
+rbuf_alloc(TASK *task, unsigned int window, size_t slotsize)
+{
+    char *rbuf;
+    struct rbuf_slot *slot;
+
+    rbuf = (char *)safe_malloc(window * slotsize);
+    if (rbuf == NULL) {
+        P_WARNING("safe_malloc() failed: %s.\n", strerror(errno));
+        return 0;
+    }
+    slot = (struct rbuf_slot *)safe_malloc(window * sizeof(struct rbuf_slot));
+    if (slot == NULL) {
+        P_WARNING("safe_malloc() failed: %s.\n", strerror(errno));
+        safe_free(rbuf);
+        return 0;
+    }
+    memset(slot, 0, window * sizeof(struct rbuf_slot));
+
+    if (task->rbuf != NULL) safe_free(task->rbuf);
+    if (task->slot != NULL) safe_free(task->slot);
+    task->rbuf = rbuf;
+    task->slot = slot;
+    task->window = window;
+    task->slotsize = slotsize;
+
+    return 1;
+}
+
 static TASK *
 ttbl_add(TASK *task)
 {
@@ -853,3 +1833,21 @@ do_retrans(TASK *taskv[])
 
     return 1;
 }
+
+static int
+do_pace(TASK *taskv[])
+{
+    TASK **taskp;
+    int err = 0;
+
+    for (taskp=taskv; *taskp != NULL; taskp++) {
+        if (tftp_pace(*taskp) == 0) {
+            P_WARNING("tftp_pace() failed.\n");
+            err = 1;
+        }
+    }
+
+    if (err == 1) return 0;
+
+    return 1;
+}
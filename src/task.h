@@ -47,6 +47,9 @@ extern "C" {
 #include <sys/socket.h>
 #include <sys/time.h>
 
+#include "stream.h"
+#include "upload.h"
+
 #ifndef __TASK_PRIVATE_H__
 typedef struct __tftp_task TASK;
 
@@ -75,17 +78,46 @@ int task_get_sockfd(TASK *task);
 /* State */
 int task_set_state(TASK *task, int state);
 int task_get_state(TASK *task);
-/* Retrans buffer */
-char *task_get_rbuf(TASK *task);
-int task_set_rbufsize(TASK *task, size_t size);
-size_t task_get_rbufsize(TASK *task);
+/* Retrans buffer (one slot per block in the window) */
+char *task_get_rbuf(TASK *task, u_int32_t blockn);
+int task_set_rbufsize(TASK *task, u_int32_t blockn, size_t size);
+size_t task_get_rbufsize(TASK *task, u_int32_t blockn);
 size_t task_get_maxrbufsize(TASK *task);
+int task_set_rbufext(TASK *task, u_int32_t blockn, const u_int8_t *ext);
+const u_int8_t *task_get_rbufext(TASK *task, u_int32_t blockn);
+int task_set_rbufpkt(TASK *task, u_int32_t blockn, const u_int8_t *pkt);
+const u_int8_t *task_get_rbufpkt(TASK *task, u_int32_t blockn);
+int task_stamp_rbuf(TASK *task, u_int32_t blockn, int first);
+long task_get_rbufage(TASK *task, u_int32_t blockn);
+/* Window size */
+int task_set_window(TASK *task, unsigned int window);
+unsigned int task_get_window(TASK *task);
+/* Block size */
+int task_set_blksize(TASK *task, size_t blksize);
+size_t task_get_blksize(TASK *task);
+/* Path MTU */
+int task_set_pmtu(TASK *task, int pmtu);
+int task_get_pmtu(TASK *task);
+/* Parity group size (x-fec option) */
+int task_set_fec(TASK *task, unsigned int fec);
+unsigned int task_get_fec(TASK *task);
 /* Type */
 int task_set_type(TASK *task, int type);
 int task_get_type(TASK *task);
+/* Transfer mode (TFTP_MODE_*) */
+int task_set_mode(TASK *task, int mode);
+int task_get_mode(TASK *task);
 /* File */
 int task_set_file(TASK *task, FILE *file);
 FILE *task_get_file(TASK *task);
+int task_set_stream(TASK *task, STREAM *stream);
+STREAM *task_get_stream(TASK *task);
+int task_set_upload(TASK *task, UPLOAD *upload);
+UPLOAD *task_get_upload(TASK *task);
+int task_set_dupreq(TASK *task, void *dupreq);
+void *task_get_dupreq(TASK *task);
+int task_set_fsize(TASK *task, off_t size);
+off_t task_get_fsize(TASK *task);
 /* Retrans timer state time */
 int task_set_rsec(TASK *task, long sec);
 long task_get_rsec(TASK *task);
@@ -98,10 +130,52 @@ int task_inc_rcounter(TASK *task);
 /* Retrans interval */
 long task_get_rinterval(TASK *task);
 int task_set_rinterval(TASK *task, long interval);
+/* Retrans parameters (per session) */
+int task_set_rinit(TASK *task, long interval);
+long task_get_rinit(TASK *task);
+int task_set_rmax(TASK *task, int count);
+int task_get_rmax(TASK *task);
+int task_set_rbackoff(TASK *task, int factor);
+int task_get_rbackoff(TASK *task);
+/* Round trip time */
+int task_set_rtt(TASK *task, long srtt, long rttvar);
+long task_get_srtt(TASK *task);
+long task_get_rttvar(TASK *task);
+int task_set_rttadaptive(TASK *task, int adaptive);
+int task_get_rttadaptive(TASK *task);
 /* Block number */
-int task_set_blockn(TASK *task, u_int16_t blockn);
-u_int16_t task_get_blockn(TASK *task);
+int task_set_blockn(TASK *task, u_int32_t blockn);
+u_int32_t task_get_blockn(TASK *task);
 int task_inc_blockn(TASK *task);
+int task_set_sendn(TASK *task, u_int32_t blockn);
+u_int32_t task_get_sendn(TASK *task);
+int task_set_filln(TASK *task, u_int32_t blockn);
+u_int32_t task_get_filln(TASK *task);
+/* Block number rollover */
+int task_set_rollover(TASK *task, int rollover);
+int task_get_rollover(TASK *task);
+/* Client address */
+struct sockaddr *task_get_caddr(TASK *task);
+/* Options negotiated */
+int task_set_opts(TASK *task, unsigned int opts);
+unsigned int task_get_opts(TASK *task);
+/* Transmit statistics (counted by task_stamp_rbuf) */
+u_int32_t task_get_nxmit(TASK *task);
+u_int32_t task_get_nrexmit(TASK *task);
+/* Congestion control (see cong.h) */
+int task_set_cwnd(TASK *task, unsigned int cwnd);
+unsigned int task_get_cwnd(TASK *task);
+int task_set_ssthresh(TASK *task, unsigned int ssthresh);
+unsigned int task_get_ssthresh(TASK *task);
+int task_set_cwndacc(TASK *task, unsigned int acc);
+unsigned int task_get_cwndacc(TASK *task);
+int task_set_recover(TASK *task, u_int32_t blockn);
+u_int32_t task_get_recover(TASK *task);
+int task_set_burst(TASK *task, unsigned int burst);
+unsigned int task_get_burst(TASK *task);
+/* Pacing timer */
+int task_set_pace(TASK *task, long usec);
+long task_get_pace(TASK *task);
 
 /*
  * Constant value and parameters
@@ -134,7 +208,7 @@ enum task_exit_state {
 
 enum task_params {
     TASK_ID_MAX = 500, /* MUST smaller than FD_SETSIZE */
-    SELECT_TIMEOUT = 500, /* [ms] MUST smaller than RETRANS_INIT_INTERVAL */
+    SELECT_TIMEOUT = 500, /* [ms] max sleep while retrans timer running */
 };
 
 #ifdef __cplusplus
@@ -44,12 +44,16 @@ extern "C" {
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/time.h>
+
+#include "stream.h"
+#include "upload.h"
 
 #ifdef __TASK_H__
 #  error "task_private.h" must included before "task.h".
 #endif
 
-#define RETRANS_BUFSIZE 600         /* max payload size (not include header) */
+#define RETRANS_BUFSIZE 600         /* min size of a retrans buffer slot */
                                     /* MUST lager than TFTP_DATA_MAX_SIZE */
 struct int_list {
     int value;
@@ -57,19 +61,57 @@ struct int_list {
     struct int_list *next;
 };
 
+/* attributes of each slot of retrans buffer */
+struct rbuf_slot {
+    size_t size;                    /* length of retransmit data */
+    const u_int8_t *ext;            /* data outside of rbuf, or NULL */
+    const u_int8_t *pkt;            /* whole packet outside of rbuf */
+    struct timeval stamp;           /* 1st transmit time, 0 if resent */
+};
+
 typedef struct __tftp_task TASK;
 
 struct __tftp_task {
     int sockfd;                     /* socket fd (used for identifire) */
     int type;                       /* task type(portal, read, write) */
+    int mode;                       /* transfer mode (octet, netascii) */
     int state;                      /* task status */
-    size_t rbuf_size;               /* length of retransmit data */
     struct timeval retrans;         /* retrans timer start time */
     long retrans_interval;          /* retrnas interval */
     int  retrans_counter;           /* number of retrans tryed */
+    long retrans_init;              /* initial retrans interval [us] */
+    int  retrans_max;               /* max number of retrans */
+    int  retrans_backoff;           /* backoff factor of retrans interval */
     FILE *file;                     /* file to read/write */
-    u_int16_t BlockN;               /* Block number of TFTP */
-    char rbuf[RETRANS_BUFSIZE];     /* buffer for retransmit */
+    STREAM *stream;                 /* shared reader of file to read */
+    UPLOAD *upload;                 /* writer of file to write */
+    void *dupreq;                   /* request remembered (see dupreq.h) */
+    off_t fsize;                    /* size of file */
+    int rollover;                   /* block number after 65535, or -1 */
+    /* block numbers don't wrap here. 16bit value is made on output. */
+    u_int32_t BlockN;               /* oldest block not acked yet */
+    u_int32_t SendN;                /* next block to be sent */
+    u_int32_t FillN;                /* next block to be read into rbuf */
+    unsigned int window;            /* number of rbuf slots (RFC7440) */
+    struct rbuf_slot *slot;         /* window entries */
+    size_t slotsize;                /* bytes per slot, >= RETRANS_BUFSIZE */
+    char *rbuf;                     /* window * slotsize bytes */
+    size_t blksize;                 /* data bytes per block (RFC2348) */
+    int pmtu;                       /* path MTU known, 0 if unknown */
+    unsigned int fec;               /* blocks per parity group, 0 if off */
+    long srtt;                      /* smoothed RTT [us], -1 if unknown */
+    long rttvar;                    /* RTT variation [us] */
+    int rtt_adaptive;               /* retrans interval follows RTT */
+    struct sockaddr_storage caddr;  /* client address */
+    unsigned int opts;              /* options acknowledged (TFTP_OPTF_*) */
+    u_int32_t nxmit;                /* number of blocks sent */
+    u_int32_t nrexmit;              /* number of blocks resent */
+    unsigned int cwnd;              /* congestion window [blocks] */
+    unsigned int ssthresh;          /* slow start threshold [blocks] */
+    unsigned int cwnd_acc;          /* blocks acked in congestion avoidance */
+    u_int32_t recover;              /* SendN at the last cwnd reduction */
+    unsigned int burst;             /* blocks sent in this round trip */
+    struct timeval pace;            /* time to send next burst, 0 if none */
 };
 
 #ifndef FD_COPY
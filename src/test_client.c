@@ -0,0 +1,186 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * test_client: helpers shared by the test clients (see test_client.h).
+ */
+#if HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "proto_tftp.h"
+#include "test_client.h"
+
+enum test_client_params {
+    TC_OPTSTR_MAX = 64,         /* max getopt(3) string */
+    TC_REQ_MAX = 512,           /* max request */
+};
+
+static size_t rrq_add(u_int8_t *req, size_t len, const char *str);
+
+int
+test_getopt(int argc, char *argv[], const char *opts, const char *usage,
+            test_opt_fn opt_fn, struct test_args *args)
+{
+    int ch, ok;
+    char optstr[TC_OPTSTR_MAX];
+
+    args->port = 69;
+    args->blksize = TFTP_DATA_MAX_SIZE;
+    snprintf(optstr, sizeof(optstr), "p:b:%s", opts);
+    ok = 1;
+    while ((ch = getopt(argc, argv, optstr)) != -1) {
+        switch (ch) {
+            case 'p': args->port = atoi(optarg); break;
+            case 'b': args->blksize = (size_t)atol(optarg); break;
+            case '?': ok = 0; break;
+            default:
+                if (opt_fn == NULL || opt_fn(ch, optarg) == 0) ok = 0;
+                break;
+        }
+    }
+    if (ok == 0 || argc - optind != 2 ||
+        args->blksize < TFTP_BLKSIZE_MIN ||
+        args->blksize > TFTP_BLKSIZE_MAX) {
+        fprintf(stderr, "usage: %s [-p port] [-b blksize] %s "
+                "file reference\n", argv[0], usage);
+        return 0;
+    }
+    args->file = argv[optind];
+    args->ref = argv[optind + 1];
+
+    return 1;
+}
+
+u_int8_t *
+test_load(const char *path, size_t *size)
+{
+    FILE *fp;
+    struct stat st;
+    u_int8_t *buf;
+
+    fp = fopen(path, "rb");
+    if (fp == NULL || fstat(fileno(fp), &st) < 0) {
+        perror(path);
+        return NULL;
+    }
+    *size = st.st_size;
+    buf = (u_int8_t *)malloc(*size + 1);
+    if (buf == NULL || fread(buf, 1, *size, fp) != *size) {
+        fprintf(stderr, "unable to read %s.\n", path);
+        return NULL;
+    }
+    fclose(fp);
+
+    return buf;
+}
+
+u_int32_t
+test_nblock(size_t size, size_t blksize)
+{
+    if (size / blksize + 1 > TFTP_BLOCK_MAX) {
+        fprintf(stderr, "reference too large for blksize %lu.\n",
+                (unsigned long)blksize);
+        return 0;
+    }
+
+    return size / blksize + 1;
+}
+
+/* append a string of the request. returns the length, even if full */
+static size_t
+rrq_add(u_int8_t *req, size_t len, const char *str)
+{
+    size_t n;
+
+    n = strlen(str) + 1;
+    if (len + n <= TC_REQ_MAX) memcpy(req + len, str, n);
+
+    return len + n;
+}
+
+int
+test_rrq(int sock, const struct sockaddr_in *to, const char *file,
+         const char *const *opts)
+{
+    u_int8_t req[TC_REQ_MAX];
+    size_t len;
+    u_int16_t opcode;
+
+    opcode = htons(TFTP_RRQ);
+    memcpy(req, &opcode, sizeof(opcode));
+    len = rrq_add(req, TFTP_HDLEN, file);
+    len = rrq_add(req, len, "octet");
+    for (; *opts != NULL; opts++) len = rrq_add(req, len, *opts);
+    if (len > sizeof(req)) {
+        fprintf(stderr, "request too long.\n");
+        return 0;
+    }
+    if (sendto(sock, req, len, 0, (const struct sockaddr *)to,
+               sizeof(*to)) < 0) {
+        perror("sendto()");
+        return 0;
+    }
+
+    return 1;
+}
+
+void
+test_ack(int sock, const struct sockaddr_in *to, u_int16_t blockn)
+{
+    u_int16_t ack[2];
+
+    ack[0] = htons(TFTP_ACK);
+    ack[1] = htons(blockn);
+    if (sendto(sock, ack, sizeof(ack), 0, (const struct sockaddr *)to,
+               sizeof(*to)) < 0) {
+        perror("sendto()");
+    }
+
+    return;
+}
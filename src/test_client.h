@@ -0,0 +1,96 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __TEST_CLIENT_H__
+#define __TEST_CLIENT_H__
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/*
+ * Helpers shared by the test clients (fec_test, mcast_test). They are
+ * not linked into sue.tftpd.
+ */
+
+/* arguments common to the clients: [-p port] [-b blksize] file reference */
+struct test_args {
+    int port;                   /* server port, 69 */
+    size_t blksize;             /* requested blksize, 512 */
+    const char *file;           /* file name in the request */
+    const char *ref;            /* the file under the root of the server */
+};
+
+/*
+ * option of the client itself. returns 0 if arg is not valid.
+ */
+typedef int (*test_opt_fn)(int ch, const char *arg);
+
+int test_getopt(int argc, char *argv[], const char *opts, const char *usage,
+                test_opt_fn opt_fn, struct test_args *args);
+u_int8_t *test_load(const char *path, size_t *size);
+u_int32_t test_nblock(size_t size, size_t blksize);
+int test_rrq(int sock, const struct sockaddr_in *to, const char *file,
+             const char *const *opts);
+void test_ack(int sock, const struct sockaddr_in *to, u_int16_t blockn);
+
+/*
+ * NOTE:
+ *
+ * - test_getopt()
+ *     opts and usage are the options of the client in getopt(3) and
+ *   usage forms ("w:k:", "[-w window] [-k group]"), which are passed to
+ *   opt_fn. -p and -b are taken here. Returns 0 (usage is printed) if
+ *   an option is not valid or file and reference are not given.
+ *
+ * - test_rrq()
+ *     opts is the list of option name and value, terminated by NULL.
+ *   Mode is always octet.
+ *
+ * - test_nblock()
+ *     Blocks a file of size bytes makes (the last one is short, may be
+ *   empty). Returns 0 if it is more than block number without rollover.
+ */
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* __TEST_CLIENT_H__ */
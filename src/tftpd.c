@@ -46,13 +46,29 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/time.h>
 #include <sys/socket.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include "proto_udp.h"
 #include "proto_tftp.h"
 #include "task.h"
+#include "timer.h"
+#include "client.h"
+#include "content.h"
+#include "dirindex.h"
+#include "handoff.h"
+#include "mcast.h"
+#include "dupreq.h"
+#include "negcache.h"
+#include "prefetch.h"
+#include "stream.h"
+#include "ascii.h"
+#include "upload.h"
 #include "util.h"
+#include "warm.h"
 #include "tftpd.h"
 #include "debug.h"
 #define GLOBAL_DEFINE
@@ -74,10 +90,17 @@ int
 main(int argc, char *argv[])
 {
     int chroot_ok, chdir_ok, daemon_ok;
-    int task_err, nodaemon = 0, nochroot = 1, noclose = 1;
+    int task_err, nodaemon = 0, nochroot = 1, noclose = 1, use_index = 0;
+    long msec;
+    struct timeval start, now;
     pid_t pid;
     TASK *portal_task;
     FILE *flog = NULL, *fpid = NULL;
+    size_t cache_size = 0;
+    int cache_zip = 0;
+    int use_prefetch = 1;
+    char *handoff_path = NULL;
+    char *warm_path = NULL;
     char *Root_dir = NULL, *Log_file = LOGFILE, *Pid_file = PIDFILE;
     extern char *optarg;
     extern int optind, opterr, optopt;
@@ -85,20 +108,86 @@ main(int argc, char *argv[])
 
     printf("hogehgoe\n");
     
+    gettimeofday(&start, NULL);
+
     /* environment setup */
     TFTP_Address = NULL;
     TFTP_Port = "69";
+    TFTP_Retrans_Init = RETRANS_INIT_INTERVAL;
+    TFTP_Retrans_Max = RETRANS_MAX;
+    TFTP_Rto_Min = RTO_MIN;
+    TFTP_Rto_Max = RTO_MAX;
+    TFTP_Rollover = 0;
+    TFTP_Mcast_Addr = NULL;
+    TFTP_Mcast_Port = MCAST_PORT;
+    TFTP_Write = 0;
+    TFTP_Mmap = 0;
     for (;;) {
         int c;
 
-        c = getopt(argc, argv, "l:p:P:r:Dhv");
+        c = getopt(argc, argv, "c:CFg:G:H:il:m:M:n:p:P:r:R:t:wW:zDhv");
 
         if (c == -1) break;
 
         switch (c) {
+            case 'c':
+                if (atol(optarg) < 0) {
+                    fprintf(stderr, "Error. Invalid cache size %s\n\n",
+                            optarg);
+                    print_help();
+                    return 1;
+                }
+                cache_size = (size_t)atol(optarg) * 1024 * 1024;
+                break;
+            case 'C':
+                cache_zip = 1;
+                break;
+            case 'F':
+                use_prefetch = 0;
+                break;
+            case 'g':
+                if (!IN_MULTICAST(ntohl(inet_addr(optarg)))) {
+                    fprintf(stderr, "Error. Invalid multicast address %s\n\n",
+                            optarg);
+                    print_help();
+                    return 1;
+                }
+                TFTP_Mcast_Addr = optarg;
+                break;
+            case 'G':
+                TFTP_Mcast_Port = atoi(optarg);
+                if (TFTP_Mcast_Port < 1 ||
+                    TFTP_Mcast_Port > 65535 - MCAST_GROUP_MAX) {
+                    fprintf(stderr, "Error. Invalid multicast port %s\n\n",
+                            optarg);
+                    print_help();
+                    return 1;
+                }
+                break;
+            case 'H':
+                handoff_path = optarg;
+                break;
+            case 'i':
+                use_index = 1;
+                break;
             case 'l':
                 Log_file = optarg;
                 break;
+            case 'm':
+                TFTP_Rto_Min = atol(optarg) * 1000;
+                break;
+            case 'M':
+                TFTP_Rto_Max = atol(optarg) * 1000;
+                break;
+            case 'n':
+                TFTP_Retrans_Max = atoi(optarg);
+                if (TFTP_Retrans_Max < 1) {
+                    fprintf(stderr, "Error. Invalid retransmit count %s\n\n",
+                            optarg);
+                    print_help();
+                    return 1;
+                }
+                break;
             case 'p':
                 TFTP_Port = optarg;
                 break;
@@ -108,6 +197,38 @@ main(int argc, char *argv[])
             case 'r':
                 Root_dir = optarg;
                 break;
+            case 'R':
+                if (strcmp(optarg, "0") == 0) {
+                    TFTP_Rollover = 0;
+                } else if (strcmp(optarg, "1") == 0) {
+                    TFTP_Rollover = 1;
+                } else if (strcmp(optarg, "off") == 0) {
+                    TFTP_Rollover = -1;
+                } else {
+                    fprintf(stderr, "Error. Invalid rollover value %s\n\n",
+                            optarg);
+                    print_help();
+                    return 1;
+                }
+                break;
+            case 't':
+                TFTP_Retrans_Init = atol(optarg) * 1000;
+                if (TFTP_Retrans_Init < 1000) {
+                    fprintf(stderr, "Error. Invalid retransmit interval %s\n\n",
+                            optarg);
+                    print_help();
+                    return 1;
+                }
+                break;
+            case 'w':
+                TFTP_Write = 1;
+                break;
+            case 'W':
+                warm_path = optarg;
+                break;
+            case 'z':
+                TFTP_Mmap = 1;
+                break;
             case 'D':
                 nodaemon = 1;
                 break;
@@ -127,6 +248,12 @@ main(int argc, char *argv[])
         }
     }
 
+    if (TFTP_Rto_Min < 1000 || TFTP_Rto_Max < TFTP_Rto_Min) {
+        fprintf(stderr, "Error. Invalid retransmit interval range.\n\n");
+        print_help();
+        return 1;
+    }
+
     /* -r MUST specified. */
     if (nodaemon == 0) {
         if (Root_dir == NULL) {
@@ -135,6 +262,12 @@ main(int argc, char *argv[])
         }
     }
 
+    if (warm_path != NULL && cache_size == 0) {
+        fprintf(stderr, "Error. -W needs cache size by -c.\n\n");
+        print_help();
+        return 1;
+    }
+
     if (nodaemon == 1) Log_file = NULL;
 
     if (Log_file == NULL) {
@@ -162,6 +295,25 @@ main(int argc, char *argv[])
 
     P_DEBUG("Initializeing TASK\n");
     task_init();
+    tftp_init();
+    client_init();
+    mcast_init();
+    dupreq_init();
+    negcache_init();
+    stream_init();
+    content_init(cache_size, cache_zip);
+    ascii_init();
+    upload_init();
+    /* the old server releases the port after handing off. */
+    if (handoff_init(handoff_path) == 0) {
+        P_ERROR("handoff_init() failed. Unable to start service. \n");
+        goto Error;
+    }
+    /* after handoff, the old server has written the manifest. */
+    if (warm_init(warm_path) == 0) {
+        P_ERROR("warm_init() failed. Unable to start service. \n");
+        goto Error;
+    }
     /*
      * task_new MUST called before chroot() because it refers
      * /etc/services.
@@ -186,6 +338,11 @@ main(int argc, char *argv[])
         }
     }
 
+    /* after chroot(), names in the index are same as requested. */
+    if (use_index) dirindex_build(nodaemon == 0);
+    /* hot set is cached before the first request is taken. */
+    warm_run();
+
     if (nodaemon == 0) {
         daemon_ok = daemon(nochroot, noclose);
         if (daemon_ok < 0) {
@@ -196,8 +353,13 @@ main(int argc, char *argv[])
         fprintf(fpid, "%d", pid);
         fclose(fpid);
     }
+    /* worker thread doesn't survive daemon(). */
+    prefetch_init(cache_size > 0, use_prefetch);
 
-    P_INFO("Starting service...\n");
+    gettimeofday(&now, NULL);
+    msec = (now.tv_sec - start.tv_sec) * 1000 +
+           (now.tv_usec - start.tv_usec) / 1000;
+    P_INFO("Starting service... (%ld [ms] after start)\n", msec);
     task_err = task_main(); /* infinite loop */
     
     if (task_err == 0) {
@@ -237,6 +399,21 @@ print_help(void)
            "  -P <pidfile>   ... specify pidfile.\n"
            "  -r <directory> ... directory to chdir()\n"
            "  -p <port>      ... specify port number.\n"
+           "  -t <msec>      ... initial retransmit interval. (default: 500)\n"
+           "  -n <count>     ... max number of retransmit. (default: 5)\n"
+           "  -m <msec>      ... min of adaptive retransmit interval. (default: 20)\n"
+           "  -M <msec>      ... max of adaptive retransmit interval. (default: 5000)\n"
+           "  -R <0|1|off>   ... block number after 65535. (default: 0)\n"
+           "  -c <MB>        ... cache files in memory up to MB. (default: 0)\n"
+           "  -C             ... compress files cached by -c (LZ4).\n"
+           "  -F             ... don't prefetch files predicted (see -c).\n"
+           "  -g <address>   ... enable multicast option with group address.\n"
+           "  -G <port>      ... port of 1st multicast group. (default: 1758)\n"
+           "  -H <socket>    ... take over cache of the running server by socket.\n"
+           "  -i             ... index files under the root in memory.\n"
+           "  -w             ... allow write request (upload).\n"
+           "  -W <manifest>  ... pre-warm cache (-c) from manifest, rewritten at exit.\n"
+           "  -z             ... send files from mmap()ed images.\n"
            "  -D             ... debug mode. don't daemon().\n"
            "  -h             ... print help (this)\n"
            "  -v             ... print version\n" 
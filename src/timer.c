@@ -40,6 +40,7 @@
 #  include "config.h"
 #endif
 
+#include <stdlib.h>
 #include <sys/time.h>
 
 #include "task.h"
@@ -47,6 +48,8 @@
 #include "util.h"
 #include "debug.h"
 
+#include "globals.h"
+
 #ifndef DEBUG_TIMER
 #  undef P_DEBUG
 #  define P_DEBUG(fmt...) /* null */
@@ -57,6 +60,13 @@
  */
 static unsigned int ExpireCounter = 0;
 static unsigned int ResetCounter = 0;
+static unsigned int SampleCounter = 0;
+static unsigned int RttHist[TIMER_HIST_MAX];
+static unsigned int RtoHist[TIMER_HIST_MAX];
+
+/* forward declarations of private functions */
+static void hist_add(unsigned int hist[], long usec);
+static void hist_report(const char *name, unsigned int hist[]);
 
 /*
  * Exported functions
@@ -86,7 +96,7 @@ timer_update(TASK *wait_tasks[], TASK *retrans_tasks[])
             continue;
         }
 
-        if (diff > interval) {
+        if (diff >= interval) {
             P_DEBUG("Timer expired for task %d.\n", task_get_sockfd(*walk));
             task_set_rsec(*walk, tv.tv_sec);
             task_set_rusec(*walk, tv.tv_usec);
@@ -101,12 +111,157 @@ timer_update(TASK *wait_tasks[], TASK *retrans_tasks[])
     return i;
 }
 
+/*
+ * Set the time until the earliest retrans or pacing timer expires
+ * to tv. Sleep time is limited by max [us].
+ */
+int
+timer_next(TASK *wait_tasks[], struct timeval *tv, long max)
+{
+    struct timeval now;
+    TASK **walk;
+    long sdiff, udiff, diff, remain, pace;
+
+    gettimeofday(&now, NULL);
+
+    remain = max;
+    for(walk=wait_tasks; *walk != NULL; walk++) {
+        sdiff = now.tv_sec - task_get_rsec(*walk);
+        udiff = now.tv_usec - task_get_rusec(*walk);
+        diff = sdiff * 1000 * 1000 + udiff;
+
+        if (task_get_rinterval(*walk) - diff < remain)
+            remain = task_get_rinterval(*walk) - diff;
+        pace = task_get_pace(*walk);
+        if (pace >= 0 && pace < remain) remain = pace;
+    }
+    if (remain < 0) remain = 0;
+
+    tv->tv_sec = remain / (1000 * 1000);
+    tv->tv_usec = remain % (1000 * 1000);
+
+    return 1;
+}
+
+/*
+ * Pick up tasks whose pacing timer expired. The timer is stopped.
+ */
+int
+timer_pace(TASK *wait_tasks[], TASK *pace_tasks[])
+{
+    int i=0;
+    TASK **walk;
+
+    for(walk=wait_tasks; *walk != NULL; walk++) {
+        if (task_get_pace(*walk) == 0) {
+            task_set_pace(*walk, 0);
+            pace_tasks[i] = *walk;
+            i++;
+        }
+    }
+
+    pace_tasks[i] = NULL;
+
+    return i;
+}
+
+/*
+ * Update SRTT/RTTVAR of the task by RTT sample [us] (RFC6298 2.2, 2.3)
+ * and renew retrans interval of the task.
+ */
+int
+timer_rtt_sample(TASK *task, long rtt)
+{
+    long srtt, rttvar, rto;
+
+    if (rtt < 0) return 0;
+
+    srtt = task_get_srtt(task);
+    rttvar = task_get_rttvar(task);
+    if (srtt < 0) {
+        /* 1st measurement */
+        srtt = rtt;
+        rttvar = rtt / 2;
+    } else {
+        rttvar = (3 * rttvar + labs(srtt - rtt)) / 4;
+        srtt = (7 * srtt + rtt) / 8;
+    }
+    task_set_rtt(task, srtt, rttvar);
+    rto = timer_rto(srtt, rttvar);
+
+    SampleCounter++;
+    hist_add(RttHist, rtt);
+
+    if (task_get_rttadaptive(task) == 0) return 1;
+
+    hist_add(RtoHist, rto);
+    task_set_rinit(task, rto);
+
+    return 1;
+}
+
+/*
+ * Compute RTO [us] from SRTT/RTTVAR (RFC6298 2.3, 2.4, 2.5).
+ */
+long
+timer_rto(long srtt, long rttvar)
+{
+    long rto;
+
+    rto = srtt + (4 * rttvar > RTO_GRANULARITY ? 4 * rttvar : RTO_GRANULARITY);
+    if (rto < TFTP_Rto_Min) rto = TFTP_Rto_Min;
+    if (rto > TFTP_Rto_Max) rto = TFTP_Rto_Max;
+
+    return rto;
+}
+
 void
 timer_report(void)
 {
     P_INFO("--- timer statics ---\n");
     P_INFO(" Expire   Counter = %d\n", ExpireCounter);
     P_INFO(" Reset    Counter = %d\n", ResetCounter);
+    P_INFO(" Sample   Counter = %d\n", SampleCounter);
+    hist_report("RTT", RttHist);
+    hist_report("RTO", RtoHist);
+
+    return;
+}
+
+/*
+ * Private functions
+ */
+static void
+hist_add(unsigned int hist[], long usec)
+{
+    int i;
+    long limit;
+
+    for (i = 0, limit = TIMER_HIST_MIN; i < TIMER_HIST_MAX - 1; i++) {
+        if (usec < limit) break;
+        limit *= 2;
+    }
+    hist[i]++;
+
+    return;
+}
+
+static void
+hist_report(const char *name, unsigned int hist[])
+{
+    int i;
+    long limit;
+
+    for (i = 0, limit = TIMER_HIST_MIN; i < TIMER_HIST_MAX; i++) {
+        if (hist[i] != 0) {
+            if (i == TIMER_HIST_MAX - 1) {
+                P_INFO(" %s >= %8ld [us] = %d\n", name, limit / 2, hist[i]);
+            } else {
+                P_INFO(" %s <  %8ld [us] = %d\n", name, limit, hist[i]);
+            }
+        }
+        limit *= 2;
+    }
 
     return;
 }
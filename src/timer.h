@@ -45,12 +45,36 @@ extern "C" {
 #include "task.h"
 
 int timer_update(TASK *wait_tasks[], TASK *retrans_tasks[]);
+int timer_next(TASK *wait_tasks[], struct timeval *tv, long max);
+int timer_pace(TASK *wait_tasks[], TASK *pace_tasks[]);
+int timer_rtt_sample(TASK *task, long rtt);
+long timer_rto(long srtt, long rttvar);
 void timer_report(void);
 
 enum timer_params {
     TIMER_THRESHOLD = 500 * 1000, /* [us] */
+    RTO_MIN = 20 * 1000,          /* default lower bound of RTO [us] */
+    RTO_MAX = 5 * 1000 * 1000,    /* default upper bound of RTO [us] */
+    RTO_GRANULARITY = 1000,       /* clock granularity G of RFC6298 [us] */
+    TIMER_HIST_MIN = 128,         /* upper limit of 1st histogram bin [us] */
+    TIMER_HIST_MAX = 18,          /* number of histogram bins (x2 each) */
 };
 
+/*
+ * NOTE:
+ *
+ * - RTO
+ *     Retransmit timeout of each session is computed from measured
+ *   RTT as RFC6298 does (SRTT + max(G, 4 * RTTVAR)), and bounded by
+ *   RTO_MIN and RTO_MAX (changed by -m, -M). Blocks once resent are
+ *   not measured (Karn's algorithm). RTT is measured against the
+ *   block acked, so with windowsize the last block of the window
+ *   gives the sample.
+ *
+ * [References]
+ *   RFC6298 Computing TCP's Retransmission Timer
+ */
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
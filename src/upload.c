@@ -0,0 +1,511 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#if HAVE_CONFIG_H
+#  include "config.h"
+#endif
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE /* O_TMPFILE, fallocate() */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+typedef struct __tftp_upload UPLOAD;
+#define __UPLOAD_PRIVATE__
+
+#include "upload.h"
+#include "negcache.h"
+#include "util.h"
+#include "debug.h"
+
+#ifndef DEBUG_UPLOAD
+#  undef P_DEBUG
+#  define P_DEBUG(fmt...) /* null */
+#endif
+
+#if defined(O_TMPFILE) && defined(AT_EMPTY_PATH)
+#  define UPLOAD_TMPFILE /* unnamed file is available */
+#endif
+
+struct __tftp_upload {
+    char *fname;                    /* target name */
+    char *dir;                      /* directory of target */
+    char *tmpname;                  /* temporary name */
+    int tmpfile;                    /* 1 if opened by O_TMPFILE */
+    int fd;
+    off_t size;                     /* bytes written */
+    u_int8_t *wbuf;                 /* write-behind buffer */
+    size_t wlen;                    /* bytes in wbuf */
+    int committed;                  /* 1 if in sync queue */
+    struct timeval done;            /* time committed */
+    UPLOAD *next;                   /* sync queue */
+};
+
+/*
+ * file scope variables
+ */
+static UPLOAD *SyncHead = NULL;
+static UPLOAD *SyncTail = NULL;
+static int SyncUsed = 0;
+static int TmpfileOk = -1;          /* -1 if not probed yet */
+static unsigned int TmpSeq = 0;
+
+static unsigned int OpenCounter = 0;
+static unsigned int WriteCounter = 0;
+static unsigned int SyncCounter = 0;
+static unsigned int PublishCounter = 0;
+static unsigned int AbortCounter = 0;
+static unsigned int FailCounter = 0;
+
+/* forward declarations of private functions */
+static int wbuf_flush(UPLOAD *upload);
+static void upload_free(UPLOAD *upload);
+static int tmp_name(UPLOAD *upload);
+#ifdef UPLOAD_TMPFILE
+static int tmpfile_link(int fd, const char *name);
+static int tmpfile_probe(const char *dir);
+#endif
+static int publish(UPLOAD *upload);
+
+/*
+ * Exported functions
+ */
+int
+upload_init(void)
+{
+    SyncHead = NULL;
+    SyncTail = NULL;
+    SyncUsed = 0;
+    TmpfileOk = -1;
+
+    return 1;
+}
+
+/*
+ * Start writing fname. tsize is the size told by client, or 0.
+ * Returns NULL with errno set on failure.
+ */
+UPLOAD *
+upload_open(const char *fname, off_t tsize)
+{
+    int err;
+    char *slash;
+    struct stat st;
+    UPLOAD *upload;
+
+    upload = (UPLOAD *)safe_malloc(sizeof(UPLOAD));
+    if (upload == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(upload, 0, sizeof(*upload));
+    upload->fd = -1;
+    upload->fname = (char *)safe_malloc(strlen(fname) + 1);
+    upload->dir = (char *)safe_malloc(strlen(fname) + 2);
+    upload->wbuf = (u_int8_t *)safe_malloc(UPLOAD_WBUF);
+    if (upload->fname == NULL || upload->dir == NULL || upload->wbuf == NULL) {
+        upload_free(upload);
+        errno = ENOMEM;
+        return NULL;
+    }
+    strcpy(upload->fname, fname);
+    strcpy(upload->dir, fname);
+    slash = strrchr(upload->dir, '/');
+    if (slash == NULL) {
+        strcpy(upload->dir, ".");
+    } else if (slash == upload->dir) {
+        slash[1] = '\0';
+    } else {
+        *slash = '\0';
+    }
+
+#ifdef UPLOAD_TMPFILE
+    if (TmpfileOk < 0) TmpfileOk = tmpfile_probe(upload->dir);
+    if (TmpfileOk == 1) {
+        upload->fd = open(upload->dir, O_TMPFILE | O_WRONLY, 0644);
+        if (upload->fd >= 0) upload->tmpfile = 1;
+    }
+#endif
+    if (upload->fd < 0) {
+        upload->fd = tmp_name(upload);
+        if (upload->fd < 0) {
+            err = errno;
+            upload_free(upload);
+            errno = err;
+            return NULL;
+        }
+        fchmod(upload->fd, 0644);
+    }
+    /* file replaced keeps its mode (it is world writable, see upload.h) */
+    if (stat(fname, &st) == 0) fchmod(upload->fd, st.st_mode & 07777);
+
+    /* reserve space for whole file. */
+    if (tsize > 0) {
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+        err = fallocate(upload->fd, FALLOC_FL_KEEP_SIZE, 0, tsize) < 0 ?
+              errno : 0;
+#elif defined(HAVE_POSIX_FALLOCATE)
+        err = posix_fallocate(upload->fd, 0, tsize);
+#else
+        err = 0;
+#endif
+        if (err == ENOSPC || err == EFBIG || err == EDQUOT) {
+            P_INFO("Unable to allocate %lld bytes for \"%s\".\n",
+                   (long long)tsize, fname);
+            upload_close(upload);
+            errno = err;
+            return NULL;
+        }
+    }
+    OpenCounter++;
+
+    return upload;
+}
+
+/* append data. written to file when buffer is full. */
+int
+upload_write(UPLOAD *upload, const void *buf, size_t len)
+{
+    size_t n;
+
+    if (upload == NULL) {
+        P_WARNING("Invalid upload specified.\n");
+        return 0;
+    }
+
+    while (len > 0) {
+        n = UPLOAD_WBUF - upload->wlen;
+        if (n > len) n = len;
+        memcpy(upload->wbuf + upload->wlen, buf, n);
+        upload->wlen += n;
+        buf = (const u_int8_t *)buf + n;
+        len -= n;
+        if (upload->wlen == UPLOAD_WBUF && wbuf_flush(upload) == 0) return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Last block received. The upload is published by upload_sync()
+ * and must not be used after this.
+ */
+int
+upload_commit(UPLOAD *upload)
+{
+    if (upload == NULL) {
+        P_WARNING("Invalid upload specified.\n");
+        return 0;
+    }
+
+    if (wbuf_flush(upload) == 0) return 0;
+    /* posix_fallocate() may extend the file beyond the data */
+    if (ftruncate(upload->fd, upload->size) < 0) {
+        P_WARNING("ftruncate() failed: %s.\n", strerror(errno));
+        return 0;
+    }
+    safe_free(upload->wbuf);
+    upload->wbuf = NULL;
+
+    upload->committed = 1;
+    gettimeofday(&upload->done, NULL);
+    upload->next = NULL;
+    if (SyncTail != NULL) {
+        SyncTail->next = upload;
+    } else {
+        SyncHead = upload;
+    }
+    SyncTail = upload;
+    SyncUsed++;
+
+    return 1;
+}
+
+/* discard upload not committed. */
+void
+upload_close(UPLOAD *upload)
+{
+    if (upload == NULL) {
+        P_WARNING("Invalid upload specified.\n");
+        return;
+    }
+    if (upload->committed) return; /* sync queue owns it */
+
+    P_DEBUG("Upload of \"%s\" discarded.\n", upload->fname);
+    if (upload->tmpfile == 0 && upload->tmpname != NULL)
+        unlink(upload->tmpname);
+    upload_free(upload);
+    AbortCounter++;
+
+    return;
+}
+
+/*
+ * fsync() and publish uploads in the queue, if the batch is full or
+ * the oldest one waited enough. Returns number of uploads published.
+ */
+int
+upload_sync(int force)
+{
+    int n, fd;
+    const char *lastdir;
+    UPLOAD *walk, *next;
+
+    if (SyncHead == NULL) return 0;
+    if (force == 0 && SyncUsed < UPLOAD_SYNC_BATCH && upload_next() > 0)
+        return 0;
+
+    /* data first, so that names never point to partial files */
+    for (walk = SyncHead; walk != NULL; walk = walk->next) {
+        if (fsync(walk->fd) < 0) {
+            P_WARNING("fsync() failed: %s.\n", strerror(errno));
+        }
+    }
+    SyncCounter++;
+
+    n = 0;
+    for (walk = SyncHead; walk != NULL; walk = walk->next) {
+        if (publish(walk) == 0) {
+            P_WARNING("Unable to publish \"%s\".\n", walk->fname);
+            if (walk->tmpfile == 0) unlink(walk->tmpname);
+            FailCounter++;
+        } else {
+            n++;
+            PublishCounter++;
+        }
+    }
+
+    /* make the new names durable, once per directory in a row */
+    lastdir = NULL;
+    for (walk = SyncHead; walk != NULL; walk = walk->next) {
+        if (lastdir == NULL || strcmp(lastdir, walk->dir) != 0) {
+            fd = open(walk->dir, O_RDONLY);
+            if (fd >= 0) {
+                fsync(fd);
+                close(fd);
+            }
+        }
+        lastdir = walk->dir;
+    }
+
+    for (walk = SyncHead; walk != NULL; walk = next) {
+        next = walk->next;
+        upload_free(walk);
+    }
+    SyncHead = SyncTail = NULL;
+    SyncUsed = 0;
+
+    return n;
+}
+
+/* time [us] until upload_sync() has work to do, -1 if none. */
+long
+upload_next(void)
+{
+    long remain;
+    struct timeval now;
+
+    if (SyncHead == NULL) return -1;
+
+    gettimeofday(&now, NULL);
+    remain = UPLOAD_SYNC_DELAY -
+             ((now.tv_sec - SyncHead->done.tv_sec) * 1000 * 1000 +
+              (now.tv_usec - SyncHead->done.tv_usec));
+
+    return remain > 0 ? remain : 0;
+}
+
+void
+upload_report(void)
+{
+    P_INFO("--- upload statics ---\n");
+    P_INFO(" Entry    Counter = %d\n", SyncUsed);
+    P_INFO(" Open     Counter = %d\n", OpenCounter);
+    P_INFO(" Write    Counter = %d\n", WriteCounter);
+    P_INFO(" Sync     Counter = %d\n", SyncCounter);
+    P_INFO(" Publish  Counter = %d\n", PublishCounter);
+    P_INFO(" Abort    Counter = %d\n", AbortCounter);
+    P_INFO(" Fail     Counter = %d\n", FailCounter);
+
+    return;
+}
+
+/*
+ * Private functions
+ */
+static int
+wbuf_flush(UPLOAD *upload)
+{
+    size_t done;
+    ssize_t n;
+
+    for (done = 0; done < upload->wlen; done += n) {
+        n = pwrite(upload->fd, upload->wbuf + done, upload->wlen - done,
+                   upload->size + done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                n = 0;
+                continue;
+            }
+            P_WARNING("pwrite() failed: %s.\n", strerror(errno));
+            return 0;
+        }
+    }
+    upload->size += upload->wlen;
+    upload->wlen = 0;
+    WriteCounter++;
+
+    return 1;
+}
+
+static void
+upload_free(UPLOAD *upload)
+{
+    if (upload->fd >= 0) close(upload->fd);
+    safe_free(upload->fname);
+    safe_free(upload->dir);
+    safe_free(upload->tmpname);
+    safe_free(upload->wbuf);
+    safe_free(upload);
+
+    return;
+}
+
+/*
+ * Set hidden name in the directory of target to tmpname. The file is
+ * created and opened unless opened by O_TMPFILE. Returns fd, or 0 for
+ * O_TMPFILE, or -1 on error.
+ */
+static int
+tmp_name(UPLOAD *upload)
+{
+    int fd;
+    size_t len;
+    const char *base;
+
+    base = strrchr(upload->fname, '/');
+    base = (base == NULL) ? upload->fname : base + 1;
+    len = strlen(upload->dir) + strlen(base) + 32;
+    safe_free(upload->tmpname);
+    upload->tmpname = (char *)safe_malloc(len);
+    if (upload->tmpname == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if (upload->tmpfile) {
+        snprintf(upload->tmpname, len, "%s/.%s.%d.%u",
+                 upload->dir, base, (int)getpid(), TmpSeq++);
+        return 0;
+    }
+
+    snprintf(upload->tmpname, len, "%s/.%s.XXXXXX", upload->dir, base);
+    fd = mkstemp(upload->tmpname);
+
+    return fd;
+}
+
+#ifdef UPLOAD_TMPFILE
+/* give a name to unnamed file */
+static int
+tmpfile_link(int fd, const char *name)
+{
+    char path[64];
+
+    /* AT_EMPTY_PATH needs privilege, /proc may not be in chroot. */
+    if (linkat(fd, "", AT_FDCWD, name, AT_EMPTY_PATH) == 0) return 1;
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    if (linkat(AT_FDCWD, path, AT_FDCWD, name, AT_SYMLINK_FOLLOW) == 0)
+        return 1;
+
+    return 0;
+}
+
+/* O_TMPFILE is usable only if the file can be linked later. */
+static int
+tmpfile_probe(const char *dir)
+{
+    int fd, ok;
+    char name[PATH_MAX];
+
+    fd = open(dir, O_TMPFILE | O_WRONLY, 0600);
+    if (fd < 0) return 0;
+    snprintf(name, sizeof(name), "%s/.probe.%d", dir, (int)getpid());
+    ok = tmpfile_link(fd, name);
+    if (ok) unlink(name);
+    close(fd);
+    P_DEBUG("O_TMPFILE is %s.\n", ok ? "usable" : "not usable");
+
+    return ok;
+}
+#endif
+
+static int
+publish(UPLOAD *upload)
+{
+
+#ifdef UPLOAD_TMPFILE
+    if (upload->tmpfile) {
+        /* name it, then replace target by rename() */
+        for (;;) {
+            if (tmp_name(upload) < 0) return 0;
+            if (tmpfile_link(upload->fd, upload->tmpname)) break;
+            if (errno != EEXIST) return 0;
+        }
+    }
+#endif
+    if (rename(upload->tmpname, upload->fname) < 0) {
+        P_WARNING("rename() failed: %s.\n", strerror(errno));
+        if (upload->tmpfile) unlink(upload->tmpname);
+        return 0;
+    }
+    negcache_forget(upload->fname);
+    P_INFO("Upload of \"%s\" published, %lld bytes.\n",
+           upload->fname, (long long)upload->size);
+
+    return 1;
+}
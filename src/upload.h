@@ -0,0 +1,105 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __UPLOAD_H__
+#define __UPLOAD_H__
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <sys/types.h>
+
+#ifndef __UPLOAD_PRIVATE__
+typedef struct __tftp_upload UPLOAD;
+
+struct __tftp_upload {
+    /* upload structure is protected. Only upload.c can read actual value. */
+    char *__dummy[0];
+};
+#endif
+
+int upload_init(void);
+UPLOAD *upload_open(const char *fname, off_t tsize);
+int upload_write(UPLOAD *upload, const void *buf, size_t len);
+int upload_commit(UPLOAD *upload);
+void upload_close(UPLOAD *upload);
+int upload_sync(int force);
+long upload_next(void);
+void upload_report(void);
+
+enum upload_params {
+    UPLOAD_WBUF = 256 * 1024,       /* write-behind buffer [bytes] */
+    UPLOAD_SYNC_BATCH = 32,         /* uploads synced at a time */
+    UPLOAD_SYNC_DELAY = 200 * 1000, /* max delay of sync [us] */
+};
+
+/*
+ * NOTE:
+ *
+ * - Overwrite
+ *     With -w any client may write, and TFTP has no authentication. As
+ *   in other tftpd, a WRQ creates a new file, but replaces an existing
+ *   one only if it is world writable (mode o+w). So images served to
+ *   every node (boot loaders, kernels) can't be replaced unless the
+ *   administrator makes them writable on purpose. Other requests for
+ *   existing files are rejected with "Access violation". The new file
+ *   keeps the mode of the one it replaces.
+ *
+ * - Write-behind
+ *     DATA of WRQ is acked as soon as it is copied to the write-behind
+ *   buffer of the session, and the buffer is written by one pwrite()
+ *   when it is full. If tsize option is given, the space is allocated
+ *   by fallocate() first, and a request which doesn't fit is rejected
+ *   with "Disk full". Write errors after ack are reported to client
+ *   by ERROR packet.
+ *
+ * - Atomic publish
+ *     Data is written to an unnamed file (O_TMPFILE) in the directory
+ *   of the target, or to a hidden temporary file ".name.XXXXXX" if
+ *   O_TMPFILE is not usable. After the last block, the upload waits
+ *   in a queue. Uploads in the queue are fsync()'ed together when
+ *   UPLOAD_SYNC_BATCH are queued or the oldest waited for
+ *   UPLOAD_SYNC_DELAY, then renamed to the target name. Readers see
+ *   the old file or the complete new one, never a partial one. An
+ *   upload aborted leaves nothing.
+ */
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* __UPLOAD_H__ */
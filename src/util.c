@@ -183,6 +183,20 @@ safe_malloc(size_t size)
     return p;
 }
 
+/* resize a block of safe_malloc(). ptr is left as is on failure. */
+void *
+safe_realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    if (ptr == NULL) return safe_malloc(size);
+    p = realloc(ptr, size);
+    if (p == NULL) return NULL;
+    P_DEBUG("safe_realloc() called. total %d blocks.\n", MallocCounter);
+
+    return p;
+}
+
 void
 safe_free(void *ptr)
 {
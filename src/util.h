@@ -108,6 +108,7 @@ int P_DEBUG(const char *fmt, ...);
 
 int is_socket(int sockfd);
 void *safe_malloc(size_t size);
+void *safe_realloc(void *ptr, size_t size);
 void safe_free(void *ptr);
 char *strsockaddr(struct sockaddr *sa, socklen_t salen);
 char *strsockfd(int sockfd);
@@ -0,0 +1,365 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#if HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include "warm.h"
+#include "content.h"
+#include "util.h"
+#include "debug.h"
+
+#ifndef DEBUG_WARM
+#  undef P_DEBUG
+#  define P_DEBUG(fmt...) /* null */
+#endif
+
+struct warm_ent {
+    char *fname;
+    unsigned int hash;
+    int explicit;                   /* listed without count */
+    long count;                     /* requests (halved from manifest) */
+    struct warm_ent *hnext;         /* hash chain */
+    struct warm_ent *next;          /* all entries */
+};
+
+/*
+ * file scope variables
+ */
+static int Fd = -1;                 /* manifest, -1 if disabled */
+static struct warm_ent *WarmHash[WARM_HASH];
+static struct warm_ent *WarmList = NULL;
+static int WarmUsed = 0;
+static int Warming = 0;             /* don't count requests by warm_run() */
+static volatile sig_atomic_t Stopping = 0;
+static struct timeval WarmEnd;
+
+static unsigned int WarmCounter = 0;
+static unsigned long long WarmBytes = 0;
+static long WarmMsec = 0;
+static unsigned int RequestCounter = 0;
+static unsigned int HotCounter = 0;
+static unsigned int FirstCounter = 0;
+static unsigned int FirstHotCounter = 0;
+static unsigned int FullCounter = 0;
+
+/* forward declarations of private functions */
+static unsigned int name_hash(const char *fname);
+static struct warm_ent *ent_get(const char *fname);
+static int ent_cmp(const void *a, const void *b);
+static void on_signal(int sig);
+
+/*
+ * Exported functions
+ */
+/* read manifest at path. MUST be called before chroot(). */
+int
+warm_init(const char *path)
+{
+    FILE *fp;
+    char line[WARM_LINE], *name, *end;
+    long count;
+    size_t len;
+    struct warm_ent *ent;
+    struct sigaction sa;
+
+    memset(WarmHash, 0, sizeof(WarmHash));
+    if (path == NULL) return 1;
+
+    Fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (Fd < 0) {
+        P_ERROR("Can't open manifest %s: %s.\n", path, strerror(errno));
+        return 0;
+    }
+    fp = fdopen(dup(Fd), "r");
+    if (fp == NULL) {
+        P_ERROR("fdopen() failed: %s.\n", strerror(errno));
+        return 0;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        len = strlen(line);
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        if (len == 0 || line[0] == '#') continue;
+
+        /* "<count> <name>" or "<name>" */
+        count = -1;
+        name = line;
+        if (isdigit((unsigned char)line[0])) {
+            count = strtol(line, &end, 10);
+            if (*end == ' ' && end[1] != '\0') name = end + 1;
+            else count = -1;
+        }
+        ent = ent_get(name);
+        if (ent == NULL) break;
+        if (count < 0) ent->explicit = 1;
+        else ent->count = count / 2;
+    }
+    fclose(fp);
+
+    /* let select() return, the manifest is written in warm_check(). */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+
+    return 1;
+}
+
+/*
+ * Read files of the manifest into the cache and pin them. Returns
+ * number of files warmed.
+ */
+int
+warm_run(void)
+{
+    int i, n;
+    off_t size;
+    struct timeval start;
+    struct warm_ent **ents, *ent;
+
+    gettimeofday(&start, NULL);
+    WarmEnd = start;
+    if (Fd < 0 || WarmUsed == 0) return 0;
+
+    ents = (struct warm_ent **)safe_malloc(WarmUsed * sizeof(*ents));
+    if (ents == NULL) {
+        P_WARNING("safe_malloc() failed.\n");
+        return 0;
+    }
+    for (n = 0, ent = WarmList; ent != NULL; ent = ent->next) ents[n++] = ent;
+    qsort(ents, n, sizeof(*ents), ent_cmp);
+
+    Warming = 1;
+    for (i = 0; i < n; i++) {
+        size = content_pin(ents[i]->fname);
+        if (size < 0) {
+            P_DEBUG("\"%s\" not warmed.\n", ents[i]->fname);
+            continue;
+        }
+        WarmCounter++;
+        WarmBytes += size;
+    }
+    Warming = 0;
+    safe_free(ents);
+
+    gettimeofday(&WarmEnd, NULL);
+    WarmMsec = (WarmEnd.tv_sec - start.tv_sec) * 1000 +
+               (WarmEnd.tv_usec - start.tv_usec) / 1000;
+    P_INFO("%d files (%llu bytes) warmed in %ld [ms].\n",
+           WarmCounter, WarmBytes, WarmMsec);
+
+    return WarmCounter;
+}
+
+/* fname requested, served from the cache if hot. */
+void
+warm_request(const char *fname, int hot)
+{
+    struct warm_ent *ent;
+    struct timeval now;
+
+    if (Fd < 0 || Warming) return;
+
+    RequestCounter++;
+    if (hot) HotCounter++;
+    gettimeofday(&now, NULL);
+    if (now.tv_sec - WarmEnd.tv_sec < WARM_WINDOW) {
+        FirstCounter++;
+        if (hot) FirstHotCounter++;
+    }
+
+    ent = ent_get(fname);
+    if (ent != NULL) ent->count++;
+
+    return;
+}
+
+/* rewrite the manifest (see warm.h). Returns 0 on failure. */
+int
+warm_save(void)
+{
+    int i, n;
+    FILE *fp;
+    struct warm_ent **ents, *ent;
+
+    if (Fd < 0) return 1;
+
+    ents = (struct warm_ent **)safe_malloc((WarmUsed + 1) * sizeof(*ents));
+    if (ents == NULL) {
+        P_WARNING("safe_malloc() failed.\n");
+        return 0;
+    }
+    for (n = 0, ent = WarmList; ent != NULL; ent = ent->next) ents[n++] = ent;
+    qsort(ents, n, sizeof(*ents), ent_cmp);
+
+    if (ftruncate(Fd, 0) < 0 || lseek(Fd, 0, SEEK_SET) < 0 ||
+        (fp = fdopen(dup(Fd), "w")) == NULL) {
+        P_WARNING("Can't write manifest: %s.\n", strerror(errno));
+        safe_free(ents);
+        return 0;
+    }
+    fprintf(fp, "# written by %s at exit\n", PACKAGE);
+    for (i = 0; i < n; i++) {
+        if (ents[i]->explicit)
+            fprintf(fp, "%s\n", ents[i]->fname);
+        else if (ents[i]->count > 0)
+            fprintf(fp, "%ld %s\n", ents[i]->count, ents[i]->fname);
+    }
+    fflush(fp);
+    fsync(fileno(fp));
+    fclose(fp);
+    safe_free(ents);
+    P_INFO("Manifest written, %d names.\n", n);
+
+    return 1;
+}
+
+/* called in the main loop. exits if signaled. */
+void
+warm_check(void)
+{
+    if (Stopping == 0) return;
+
+    P_INFO("Signal %d received. exitting..\n", (int)Stopping);
+    warm_save();
+    warm_report();
+    exit(0);
+}
+
+void
+warm_report(void)
+{
+    if (Fd < 0) return;
+
+    P_INFO("--- cache warm-up statics ---\n");
+    P_INFO(" Entry    Counter = %d\n", WarmUsed);
+    P_INFO(" Warm     Counter = %d\n", WarmCounter);
+    P_INFO(" Warm     Bytes   = %llu\n", WarmBytes);
+    P_INFO(" Warm Time [ms]   = %ld\n", WarmMsec);
+    P_INFO(" Request  Counter = %d\n", RequestCounter);
+    P_INFO(" Hot      Counter = %d\n", HotCounter);
+    P_INFO(" First    Counter = %d\n", FirstCounter);
+    P_INFO(" First Hot [%%]    = %d\n",
+           FirstCounter ? FirstHotCounter * 100 / FirstCounter : 0);
+    P_INFO(" Full     Counter = %d\n", FullCounter);
+
+    return;
+}
+
+/*
+ * Private functions
+ */
+static unsigned int
+name_hash(const char *fname)
+{
+    unsigned int h;
+    const unsigned char *p;
+
+    for (h = 0, p = (const unsigned char *)fname; *p != '\0'; p++)
+        h = h * 31 + *p;
+
+    return h;
+}
+
+/* entry of fname, added if new. NULL if full. */
+static struct warm_ent *
+ent_get(const char *fname)
+{
+    unsigned int h;
+    struct warm_ent *ent;
+
+    h = name_hash(fname);
+    for (ent = WarmHash[h % WARM_HASH]; ent != NULL; ent = ent->hnext) {
+        if (ent->hash == h && strcmp(ent->fname, fname) == 0) return ent;
+    }
+    if (WarmUsed >= WARM_MAX) {
+        FullCounter++;
+        return NULL;
+    }
+
+    ent = (struct warm_ent *)safe_malloc(sizeof(struct warm_ent));
+    if (ent == NULL) return NULL;
+    memset(ent, 0, sizeof(*ent));
+    ent->fname = (char *)safe_malloc(strlen(fname) + 1);
+    if (ent->fname == NULL) {
+        safe_free(ent);
+        return NULL;
+    }
+    strcpy(ent->fname, fname);
+    ent->hash = h;
+    ent->hnext = WarmHash[h % WARM_HASH];
+    WarmHash[h % WARM_HASH] = ent;
+    ent->next = WarmList;
+    WarmList = ent;
+    WarmUsed++;
+
+    return ent;
+}
+
+/* explicit names first, then most requested first. */
+static int
+ent_cmp(const void *a, const void *b)
+{
+    const struct warm_ent *x = *(const struct warm_ent * const *)a;
+    const struct warm_ent *y = *(const struct warm_ent * const *)b;
+
+    if (x->explicit != y->explicit) return y->explicit - x->explicit;
+    if (x->count != y->count) return (x->count < y->count) ? 1 : -1;
+
+    return strcmp(x->fname, y->fname);
+}
+
+static void
+on_signal(int sig)
+{
+    Stopping = sig;
+}
@@ -0,0 +1,84 @@
+/*
+   sue.tftpd:
+   $Id$
+
+   This file is part of sue.tftpd.
+     
+   Copyright 2002 SUENAGA Hiroki <hsuenaga@jaist.ac.jp>.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without 
+   modification, are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice,
+      this list of conditions and the following disclaimer.
+   2. Redistributions in binary form must reproduce the above copyright notice,
+      this list of conditions and the following disclaimer in the documentation
+      and/or other materials provided with the distribution.
+   3. All advertising materials mentioning features or use of this software
+      must display the following acknowledgement:
+
+        This product includes software developed by
+        SUENAGA Hiroki <hsuenaga@jaist.ac.jp> and its contributors.
+
+   4. Neither the name of authors nor the names of its contributors may be used
+      to endorse or promote products derived from this software without
+      specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND ANY
+   EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+   (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+   ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+   THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __WARM_H__
+#define __WARM_H__
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+int warm_init(const char *path);
+int warm_run(void);
+void warm_request(const char *fname, int hot);
+int warm_save(void);
+void warm_check(void);
+void warm_report(void);
+
+enum warm_params {
+    WARM_MAX = 4096,        /* names counted */
+    WARM_HASH = 256,        /* number of hash buckets */
+    WARM_LINE = 1024,       /* max bytes of a manifest line */
+    WARM_WINDOW = 3600,     /* [s] requests after warm-up reported */
+};
+
+/*
+ * NOTE:
+ *
+ * - Cache pre-warming (-W)
+ *     With -W <manifest> (and -c), the files listed in the manifest
+ *   are read into the content cache (content.h) and pinned there
+ *   before the first request is taken. Pinned files are never
+ *   evicted; a pinned file changed on disk is dropped as others and
+ *   cached again unpinned when requested. Files are warmed in order
+ *   of the list (below) until the budget is full.
+ *     A manifest line is "<count> <name>", or just "<name>" for a
+ *   file always warmed first (an explicit list). Lines starting with
+ *   '#' are ignored. The server counts octet requests per name, and
+ *   rewrites the manifest at exit (SIGTERM, SIGINT, or handing off by
+ *   -H) with explicit names as they were and the others by count,
+ *   most requested first. A count read from the manifest is halved
+ *   first, so files not requested any more go out in a few runs. The
+ *   manifest is opened before chroot().
+ *     Warm-up time, and how many of the requests in WARM_WINDOW after
+ *   warm-up were served from the cache (hot), are reported.
+ */
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* __WARM_H__ */